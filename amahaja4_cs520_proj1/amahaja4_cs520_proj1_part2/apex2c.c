@@ -0,0 +1,360 @@
+/*
+ *  apex2c.c
+ *  Contains the ahead-of-time translator of an APEX program into a
+ *  standalone C program
+ *
+ *  Every instruction becomes a statement labelled with its PC, preceded by
+ *  a #line directive pointing back at the input file. BZ/BNZ jump to their
+ *  labels directly and JUMP goes through a switch over every PC. With
+ *  --cycles each basic block is annotated with its interval-model estimate,
+ *  calibrated on the pipeline of this build, and the program accumulates
+ *  the estimate as it runs.
+ *
+ *  Usage : apex2c <input_file> <output.c> [--cycles]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "interval.h"
+
+/* What the generated code does for an opcode, in the order of the table */
+enum
+{
+    C_ADD,
+    C_SUB,
+    C_MUL,
+    C_AND,
+    C_OR,
+    C_EXOR,
+    C_MOVC,
+    C_LOAD,
+    C_STORE,
+    C_BZ,
+    C_BNZ,
+    C_JUMP,
+    C_HALT,
+    C_NOP		// Everything else, executed as a no-op like APEX_functional_step
+};
+
+static int
+classify(const APEX_Instruction* ins)
+{
+  static const char* opcodes[] = { "ADD", "SUB", "MUL", "AND", "OR", "EX-OR", "MOVC",
+                                   "LOAD", "STORE", "BZ", "BNZ", "JUMP", "HALT" };
+  for (int i = 0; i < C_NOP; ++i) {
+    if (strcmp(ins->opcode, opcodes[i]) == 0) {
+      return i;
+    }
+  }
+  return C_NOP;
+}
+
+static int
+ends_block(int op)
+{
+  return op == C_BZ || op == C_BNZ || op == C_JUMP || op == C_HALT;
+}
+
+static int
+valid_register(int r)
+{
+  return r >= 0 && r < 16;
+}
+
+/* Checks the registers an instruction uses, they become array indices */
+static int
+check_registers(const APEX_Instruction* ins, int op, int line)
+{
+  int ok = 1;
+  if (op <= C_EXOR) {
+    ok = valid_register(ins->rd) && valid_register(ins->rs1) && valid_register(ins->rs2);
+  } else if (op == C_MOVC) {
+    ok = valid_register(ins->rd);
+  } else if (op == C_LOAD) {
+    ok = valid_register(ins->rd) && valid_register(ins->rs1);
+  } else if (op == C_STORE) {
+    ok = valid_register(ins->rs1) && valid_register(ins->rs2);
+  } else if (op == C_JUMP) {
+    ok = valid_register(ins->rs1);
+  }
+  if (!ok) {
+    fprintf(stderr, "APEX_Error : Register out of range at line %d (%s)\n", line, ins->opcode);
+  }
+  return ok;
+}
+
+/* Statement continuing at target, the end of the program if it is not an instruction */
+static void
+emit_goto(FILE* out, int target, int code_memory_size)
+{
+  int index = get_code_index(target);
+  if (target >= 4000 && (target - 4000) % 4 == 0 && index < code_memory_size) {
+    fprintf(out, "goto L%d;", target);
+  } else {
+    fprintf(out, "{ pc = %d; goto end; }", target);
+  }
+}
+
+static void
+emit_prologue(FILE* out, const char* input, const int* data_memory, int cycles)
+{
+  fprintf(out, "/*\n * Generated by apex2c from %s, do not edit.\n", input);
+  fprintf(out, " * Usage : <program> [max_instructions], the limit is checked at taken branches and JUMPs\n */\n");
+  fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n\n");
+  fprintf(out, "#define DATA_MEMORY_SIZE %d\n\n", DATA_MEMORY_SIZE);
+  fprintf(out, "static int regs[16];\nstatic int data_memory[DATA_MEMORY_SIZE]");
+  /* Initial data of an object input */
+  int used = DATA_MEMORY_SIZE;
+  while (used > 0 && data_memory[used - 1] == 0) {
+    used--;
+  }
+  for (int i = 0; i < used; ++i) {
+    fprintf(out, "%s%d", i == 0 ? " = { " : i % 16 == 0 ? ",\n  " : ", ", data_memory[i]);
+  }
+  fprintf(out, "%s;\n", used ? " }" : "");
+  fprintf(out, "static int zero_flag;\n\n");
+  fprintf(out, "int\nmain(int argc, char const* argv[])\n{\n");
+  fprintf(out, "  long limit = argc > 1 ? atol(argv[1]) : -1;\n");
+  fprintf(out, "  long instructions = 0;\n");
+  if (cycles) {
+    fprintf(out, "  long cycles = 0;\n");
+  }
+  fprintf(out, "  int pc = 4000;\n  int address = 0;\n\n");
+  fprintf(out, "  (void)limit;\n  (void)address;\n  goto L4000;\n");
+}
+
+static void
+emit_dispatch(FILE* out, int code_memory_size)
+{
+  fprintf(out, "\n  /* Computed JUMP targets */\ndispatch:\n  switch (pc) {\n");
+  for (int i = 0; i < code_memory_size; ++i) {
+    fprintf(out, "    case %d: goto L%d;\n", 4000 + 4 * i, 4000 + 4 * i);
+  }
+  fprintf(out, "    default: goto end;\n  }\n\n");
+}
+
+static void
+emit_epilogue(FILE* out, int code_memory_size, const APEX_Interval_Params* params)
+{
+  fprintf(out, "end:\n");
+  fprintf(out, "  printf(\"(apex) >> Native run complete at pc %%d \\n\", pc);\n");
+  fprintf(out, "  printf(\"Total Instructions Present: %d, Total instructions processed: %%ld \\n\", instructions);\n",
+          code_memory_size);
+  if (params) {
+    fprintf(out, "  printf(\"Estimated clock cycles: %%ld \\n\", instructions ? cycles + %d : 0);\n",
+            params->fill_drain);
+  }
+  fprintf(out, "  printf(\"\\n\\n=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\\n\\n\");\n");
+  fprintf(out, "  for (int i = 0; i < 16; i++) {\n");
+  fprintf(out, "    printf(\"|\\tREG[%%d]\\t|\\tValue = %%d\\t|\\n\", i, regs[i]);\n  }\n");
+  fprintf(out, "  printf(\"\\n\\n============== STATE OF DATA MEMORY =============\\n\\n\");\n");
+  fprintf(out, "  for (int j = 0; j < 100; j++) {\n");
+  fprintf(out, "    printf(\"|\\tMEM[%%d]\\t|\\tData Value = %%d\\t|\\n\", j, data_memory[j]);\n  }\n");
+  fprintf(out, "  return 0;\n\n  /* Program, #line maps it back to the input */\n");
+}
+
+/* Leaves for the end when the address in 'address' is out of range */
+static void
+emit_address_check(FILE* out, int pc)
+{
+  fprintf(out, "  if (address < 0 || address >= DATA_MEMORY_SIZE) {\n");
+  fprintf(out, "    fprintf(stderr, \"APEX_Error : Data memory access out of range at pc %d\\n\");\n", pc);
+  fprintf(out, "    pc = %d;\n    goto end;\n  }\n", pc);
+}
+
+static void
+emit_instruction(FILE* out, const APEX_Instruction* ins, int op, int pc, int code_memory_size,
+                 const APEX_Interval_Params* params)
+{
+  static const char* operators[] = { "+", "-", "*", "&", "|", "^" };
+  int next_pc = pc + 4;
+
+  switch (op) {
+    case C_ADD:
+    case C_SUB:
+    case C_MUL:
+    case C_AND:
+    case C_OR:
+    case C_EXOR:
+      /* Through unsigned, overflow wraps as on the simulator's host */
+      fprintf(out, "  regs[%d] = (int)((unsigned)regs[%d] %s (unsigned)regs[%d]);\n", ins->rd, ins->rs1,
+              operators[op], ins->rs2);
+      if (op <= C_MUL) {
+        fprintf(out, "  zero_flag = regs[%d] == 0;\n", ins->rd);
+      }
+      break;
+    case C_MOVC:
+      fprintf(out, "  regs[%d] = %d;\n", ins->rd, ins->imm);
+      break;
+    case C_LOAD:
+      fprintf(out, "  address = (int)((unsigned)regs[%d] + %du);\n", ins->rs1, ins->imm);
+      emit_address_check(out, pc);
+      fprintf(out, "  regs[%d] = data_memory[address];\n", ins->rd);
+      break;
+    case C_STORE:
+      fprintf(out, "  address = (int)((unsigned)regs[%d] + %du);\n", ins->rs2, ins->imm);
+      emit_address_check(out, pc);
+      fprintf(out, "  data_memory[address] = regs[%d];\n", ins->rs1);
+      break;
+    case C_HALT:
+      fprintf(out, "  instructions++;\n  pc = %d;\n  goto end;\n", next_pc);
+      return;
+  }
+  fprintf(out, "  instructions++;\n");
+
+  if (op == C_BZ || op == C_BNZ) {
+    fprintf(out, "  if (%szero_flag) {\n", op == C_BZ ? "" : "!");
+    if (params && params->taken_penalty) {
+      fprintf(out, "    cycles += %d;\n", params->taken_penalty);
+    }
+    fprintf(out, "    if (limit >= 0 && instructions >= limit) { pc = %d; goto end; }\n    ",
+            pc + ins->imm);
+    emit_goto(out, pc + ins->imm, code_memory_size);
+    fprintf(out, "\n  }\n");
+  } else if (op == C_JUMP) {
+    if (params && params->jump_penalty) {
+      fprintf(out, "  cycles += %d;\n", params->jump_penalty);
+    }
+    fprintf(out, "  pc = (int)((unsigned)regs[%d] + %du);\n", ins->rs1, ins->imm);
+    fprintf(out, "  if (limit >= 0 && instructions >= limit) goto end;\n");
+    fprintf(out, "  goto dispatch;\n");
+    return;
+  }
+  if (get_code_index(next_pc) >= code_memory_size) {
+    fprintf(out, "  pc = %d;\n  goto end;\n", next_pc);
+  }
+}
+
+/*
+ * Writes the C translation of the program. With params, blocks are
+ * annotated with their estimated cycles and the program counts them.
+ */
+static int
+translate(const char* input, const APEX_Instruction* code, int code_memory_size, const int* data_memory,
+          FILE* out, const APEX_Interval_Params* params)
+{
+  int* cost = calloc(code_memory_size, sizeof(*cost));
+  char* target = calloc(code_memory_size + 1, 1);
+  char* leader = calloc(code_memory_size + 1, 1);
+  if (!cost || !target || !leader) {
+    free(cost);
+    free(target);
+    free(leader);
+    return -1;
+  }
+
+  /* Labels are only emitted where jumped to, blocks also start after a branch */
+  int jumps = 0;
+  target[0] = leader[0] = 1;
+  for (int i = 0; i < code_memory_size; ++i) {
+    int op = classify(&code[i]);
+    jumps |= op == C_JUMP;
+    if (op == C_BZ || op == C_BNZ) {
+      int t = 4000 + 4 * i + code[i].imm;
+      int index = get_code_index(t);
+      if (t >= 4000 && (t - 4000) % 4 == 0 && index < code_memory_size) {
+        target[index] = leader[index] = 1;
+      }
+    }
+    if (ends_block(op)) {
+      leader[i + 1] = 1;
+    }
+  }
+  if (jumps) {
+    /* Any of them may be computed, blocks stay split at static leaders only */
+    memset(target, 1, code_memory_size);
+  }
+
+  /* Dispatch and the end go first, #line directives only follow them */
+  emit_prologue(out, input, data_memory, params != NULL);
+  if (jumps) {
+    emit_dispatch(out, code_memory_size);
+  }
+  emit_epilogue(out, code_memory_size, params);
+
+  for (int i = 0; i < code_memory_size; ++i) {
+    const APEX_Instruction* ins = &code[i];
+    int op = classify(ins);
+    int pc = 4000 + 4 * i;
+    if (!check_registers(ins, op, i + 1)) {
+      free(cost);
+      free(target);
+      free(leader);
+      return -1;
+    }
+
+    if (leader[i]) {
+      int end = i;
+      while (end + 1 < code_memory_size && !leader[end + 1]) {
+        end++;
+      }
+      if (params) {
+        int total = APEX_interval_block_cycles(params, &code[i], end - i + 1, &cost[i]);
+        fprintf(out, "  /* Block %d-%d: %d instructions, about %d cycles */\n", pc, 4000 + 4 * end,
+                end - i + 1, total);
+      }
+    }
+
+    if (target[i]) {
+      fprintf(out, "L%d:\n", pc);
+    }
+    fprintf(out, "#line %d \"%s\"\n", i + 1, input);
+    if (params && cost[i]) {
+      fprintf(out, "  cycles += %d;\n", cost[i]);
+    }
+    emit_instruction(out, ins, op, pc, code_memory_size, params);
+  }
+
+  fprintf(out, "}\n");
+  free(cost);
+  free(target);
+  free(leader);
+  return 0;
+}
+
+int
+main(int argc, char const* argv[])
+{
+  if (argc < 3 || (argc == 4 && strcmp(argv[3], "--cycles") != 0) || argc > 4) {
+    fprintf(stderr, "APEX_Help : Usage %s <input_file> <output.c> [--cycles]\n", argv[0]);
+    exit(1);
+  }
+  int cycles = argc == 4;
+
+  APEX_CPU* cpu = APEX_cpu_init(argv[1], "simulate", "0");
+  if (!cpu) {
+    fprintf(stderr, "APEX_Error : Unable to initialize CPU\n");
+    exit(1);
+  }
+
+  APEX_Interval_Params params;
+  if (cycles && APEX_interval_calibrate(cpu, &params)) {
+    fprintf(stderr, "APEX_Error : Interval model calibration failed\n");
+    APEX_cpu_stop(cpu);
+    exit(1);
+  }
+
+  FILE* out = fopen(argv[2], "w");
+  if (!out) {
+    fprintf(stderr, "APEX_Error : Unable to create %s\n", argv[2]);
+    APEX_cpu_stop(cpu);
+    exit(1);
+  }
+  /* Objects decode on fetch, the translation reads the whole code memory */
+  for (int i = 0; i < cpu->code_memory_size; ++i) {
+    APEX_code_at(cpu, i);
+  }
+  int failed = translate(argv[1], cpu->code_memory, cpu->code_memory_size, cpu->data_memory, out,
+                         cycles ? &params : NULL);
+  if (fclose(out) || failed) {
+    fprintf(stderr, "APEX_Error : Unable to translate %s\n", argv[1]);
+    remove(argv[2]);
+    APEX_cpu_stop(cpu);
+    exit(1);
+  }
+
+  APEX_cpu_stop(cpu);
+  return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ *  apex_as.c
+ *  Contains the assembler of APEX text programs into binary objects
+ *
+ *  The text is parsed and annotated like the simulator does, then every
+ *  line is encoded into one record of object.h. The optional data file
+ *  holds integers, separated by whitespace or commas, placed in data
+ *  memory from address 0.
+ *
+ *  Usage : apex_as <input_file> <output_object> [--data <data_file>]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "object.h"
+#include "arena.h"
+
+/* Reads at most DATA_MEMORY_SIZE integers into data, returns the count or -1 */
+static int
+read_data(const char* filename, int* data)
+{
+  FILE* fp = fopen(filename, "r");
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to open data file %s\n", filename);
+    return -1;
+  }
+  int count = 0;
+  int value;
+  while (fscanf(fp, " %d ,", &value) == 1) {
+    if (count == DATA_MEMORY_SIZE) {
+      fprintf(stderr, "APEX_Error : %s holds more than %d words\n", filename, DATA_MEMORY_SIZE);
+      fclose(fp);
+      return -1;
+    }
+    data[count++] = value;
+  }
+  int complete = feof(fp);
+  fclose(fp);
+  if (!complete) {
+    fprintf(stderr, "APEX_Error : %s has something other than an integer after word %d\n",
+            filename, count);
+    return -1;
+  }
+  return count;
+}
+
+int
+main(int argc, char const* argv[])
+{
+  if (argc != 3 && (argc != 5 || strcmp(argv[3], "--data") != 0)) {
+    fprintf(stderr, "APEX_Help : Usage %s <input_file> <output_object> [--data <data_file>]\n",
+            argv[0]);
+    exit(1);
+  }
+  if (APEX_object_is_file(argv[1])) {
+    fprintf(stderr, "APEX_Error : %s is already an object\n", argv[1]);
+    exit(1);
+  }
+
+  int size;
+  APEX_Instruction* code_memory = create_code_memory(argv[1], &size);
+  if (!code_memory) {
+    fprintf(stderr, "APEX_Error : Unable to parse %s\n", argv[1]);
+    exit(1);
+  }
+
+  static int data[DATA_MEMORY_SIZE];
+  int num_data = argc == 5 ? read_data(argv[4], data) : 0;
+  APEX_Object_Ins* records = malloc(sizeof(*records) * size);
+  if (num_data < 0 || !records) {
+    APEX_free(code_memory);
+    free(records);
+    exit(1);
+  }
+
+  int failed = 0;
+  int flags = 0;
+  for (int i = 0; i < size; ++i) {
+    failed |= APEX_object_encode(&code_memory[i], &records[i], i + 1);
+    if (strcmp(code_memory[i].opcode, "ROI_BEGIN") == 0) {
+      flags |= OBJECT_HAS_ROI;
+    }
+  }
+  if (failed || APEX_object_write(argv[2], records, size, data, num_data, flags)) {
+    fprintf(stderr, "APEX_Error : Unable to assemble %s\n", argv[1]);
+    APEX_free(code_memory);
+    free(records);
+    exit(1);
+  }
+
+  printf("%s: %d instructions, %d data words, %zu bytes\n", argv[2], size, num_data,
+         sizeof(APEX_Object_Header) + sizeof(*records) * size + sizeof(int) * num_data);
+  APEX_free(code_memory);
+  free(records);
+  return 0;
+}
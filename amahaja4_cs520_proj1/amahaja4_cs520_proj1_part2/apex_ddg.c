@@ -0,0 +1,339 @@
+/*
+ *  apex_ddg.c
+ *  Contains the dependence graph analysis of retired instruction traces
+ *
+ *  For every run in the trace, builds the dynamic dependence graph: each
+ *  retired instruction depends on the last ones to write the registers it
+ *  reads, to set the zero flag it branches on, to STORE to the word it
+ *  LOADs (true dependences), and on the last BZ, BNZ or JUMP before it
+ *  (control). Scheduling every instruction as soon as its producers have
+ *  finished gives the critical path, the cycles no pipeline of these
+ *  latencies can beat; the latest it could finish without lengthening the
+ *  path gives its slack. Prints:
+ *  - the critical path with and without control dependences,
+ *  - the observed cycles split into dependences, one instruction per cycle
+ *    and the stalls and flushes of the pipeline on top,
+ *  - the edges the critical path goes through,
+ *  - the instructions most often on it, with their mean slack.
+ *
+ *  Usage : apex_ddg <retire_trace> [instructions]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "retire_trace.h"
+#include "stats.h"
+#include "trace.h"
+
+#define DEFAULT_INSTRUCTIONS 10
+
+/* Producers of a node, -1 for none */
+enum
+{
+  EDGE_RS1,
+  EDGE_RS2,
+  EDGE_ZERO,
+  EDGE_MEMORY,
+  EDGE_CONTROL,
+  NUM_EDGES
+};
+
+typedef struct Ddg_Node
+{
+    int producers[NUM_EDGES];
+    long earliest;		// Finish, scheduled as soon as possible
+    long latest;		// Finish, as late as the critical path allows
+} Ddg_Node;
+
+/* Records of one run */
+typedef struct Run_Trace
+{
+    APEX_Retired* records;
+    long count;
+    long capacity;
+} Run_Trace;
+
+/* Of one static instruction */
+typedef struct Pc_Slack
+{
+    int pc;
+    int opcode;
+    long executions;
+    long critical;		// Executions with no slack
+    long slack;			// Sum over executions
+} Pc_Slack;
+
+static int
+read_run(FILE* fp, Run_Trace* run)
+{
+  APEX_Retired record;
+  while (fread(&record, sizeof(record), 1, fp) == 1 && record.cycle >= 0) {
+    if (run->count == run->capacity) {
+      long capacity = run->capacity ? run->capacity * 2 : 4096;
+      APEX_Retired* grown = realloc(run->records, sizeof(*grown) * capacity);
+      if (!grown) {
+        return -1;
+      }
+      run->records = grown;
+      run->capacity = capacity;
+    }
+    run->records[run->count++] = record;
+  }
+  return 0;
+}
+
+/* Links every node to its producers, counting the edges of each kind */
+static void
+build_graph(const Run_Trace* run, Ddg_Node* nodes, long* edges)
+{
+  long last_writer[16];
+  long last_store[DATA_MEMORY_SIZE];
+  long last_zero = -1;
+  long last_control = -1;
+  for (int r = 0; r < 16; ++r) {
+    last_writer[r] = -1;
+  }
+  for (int a = 0; a < DATA_MEMORY_SIZE; ++a) {
+    last_store[a] = -1;
+  }
+
+  for (long i = 0; i < run->count; ++i) {
+    const APEX_Retired* record = &run->records[i];
+    Ddg_Node* node = &nodes[i];
+    int in_memory = record->address >= 0 && record->address < DATA_MEMORY_SIZE;
+    node->producers[EDGE_RS1] = record->rs1 >= 0 && record->rs1 < 16 ? last_writer[record->rs1] : -1;
+    node->producers[EDGE_RS2] = record->rs2 >= 0 && record->rs2 < 16 ? last_writer[record->rs2] : -1;
+    node->producers[EDGE_ZERO] = record->flags & RETIRE_READS_ZERO ? last_zero : -1;
+    node->producers[EDGE_MEMORY] =
+        record->flags & RETIRE_LOAD && in_memory ? last_store[record->address] : -1;
+    node->producers[EDGE_CONTROL] = last_control;
+    for (int e = 0; e < NUM_EDGES; ++e) {
+      edges[e] += node->producers[e] >= 0;
+    }
+
+    if (record->rd >= 0 && record->rd < 16) {
+      last_writer[record->rd] = i;
+    }
+    if (record->flags & RETIRE_SETS_ZERO) {
+      last_zero = i;
+    }
+    if (record->flags & RETIRE_STORE && in_memory) {
+      last_store[record->address] = i;
+    }
+    if (record->flags & RETIRE_CONTROL) {
+      last_control = i;
+    }
+  }
+}
+
+/* Earliest finish of every node, following edges up to last. Returns the longest */
+static long
+schedule(const Run_Trace* run, Ddg_Node* nodes, int last)
+{
+  long length = 0;
+  for (long i = 0; i < run->count; ++i) {
+    Ddg_Node* node = &nodes[i];
+    long start = 0;
+    for (int e = 0; e <= last; ++e) {
+      int p = node->producers[e];
+      if (p >= 0 && nodes[p].earliest > start) {
+        start = nodes[p].earliest;
+      }
+    }
+    node->earliest = start + run->records[i].latency;
+    if (node->earliest > length) {
+      length = node->earliest;
+    }
+  }
+  return length;
+}
+
+/* Latest finish of every node keeping the critical path at length */
+static void
+schedule_late(const Run_Trace* run, Ddg_Node* nodes, long length)
+{
+  for (long i = 0; i < run->count; ++i) {
+    nodes[i].latest = length;
+  }
+  /* Consumers come after their producers, so theirs are final first */
+  for (long i = run->count - 1; i >= 0; --i) {
+    long start = nodes[i].latest - run->records[i].latency;
+    for (int e = 0; e < NUM_EDGES; ++e) {
+      int p = nodes[i].producers[e];
+      if (p >= 0 && nodes[p].latest > start) {
+        nodes[p].latest = start;
+      }
+    }
+  }
+}
+
+/* Counts the edges along one critical path, walked back from its end */
+static void
+walk_critical_path(const Run_Trace* run, const Ddg_Node* nodes, long length, long* edges)
+{
+  long i = run->count - 1;
+  while (i >= 0 && nodes[i].earliest != length) {
+    i--;
+  }
+  while (i >= 0) {
+    long start = nodes[i].earliest - run->records[i].latency;
+    long next = -1;
+    for (int e = 0; e < NUM_EDGES && next < 0; ++e) {
+      int p = nodes[i].producers[e];
+      if (p >= 0 && nodes[p].earliest == start) {
+        edges[e]++;
+        next = p;
+      }
+    }
+    i = next;
+  }
+}
+
+static int
+compare_critical(const void* a, const void* b)
+{
+  const Pc_Slack* x = a;
+  const Pc_Slack* y = b;
+  if (x->critical != y->critical) {
+    return x->critical > y->critical ? -1 : 1;
+  }
+  return x->pc - y->pc;
+}
+
+static int
+report_slack(const Run_Trace* run, const Ddg_Node* nodes, int top)
+{
+  /* By code index, sized to the highest pc seen */
+  Pc_Slack* pcs = NULL;
+  int size = 0;
+  for (long i = 0; i < run->count; ++i) {
+    const APEX_Retired* record = &run->records[i];
+    int index = get_code_index(record->pc);
+    if (record->pc < 4000) {
+      continue;
+    }
+    if (index >= size) {
+      int grown_size = size ? size : 64;
+      while (grown_size <= index) {
+        grown_size *= 2;
+      }
+      Pc_Slack* grown = realloc(pcs, sizeof(*grown) * grown_size);
+      if (!grown) {
+        free(pcs);
+        return -1;
+      }
+      memset(grown + size, 0, sizeof(*grown) * (grown_size - size));
+      pcs = grown;
+      size = grown_size;
+    }
+    Pc_Slack* pc = &pcs[index];
+    long slack = nodes[i].latest - nodes[i].earliest;
+    pc->pc = record->pc;
+    pc->opcode = record->opcode;
+    pc->executions++;
+    pc->critical += slack == 0;
+    pc->slack += slack;
+  }
+
+  qsort(pcs, size, sizeof(*pcs), compare_critical);
+  printf("Instructions most often on a critical path\n");
+  printf("  %6s %-9s %10s %10s %10s\n", "pc", "opcode", "executed", "critical", "mean slack");
+  for (int i = 0; i < size && i < top && pcs[i].executions; ++i) {
+    const Pc_Slack* pc = &pcs[i];
+    printf("  %6d %-9s %10ld %10ld %10.1f\n", pc->pc, APEX_opcode_name(pc->opcode), pc->executions,
+           pc->critical, (double)pc->slack / pc->executions);
+  }
+  free(pcs);
+  return 0;
+}
+
+static void
+print_share(const char* name, long cycles, long observed)
+{
+  printf("  %-34s %10ld  %5.1f%%\n", name, cycles, observed ? 100.0 * cycles / observed : 0);
+}
+
+static int
+analyze(const char* input, const Run_Trace* run, int top)
+{
+  Ddg_Node* nodes = calloc(run->count ? run->count : 1, sizeof(*nodes));
+  if (!nodes) {
+    return -1;
+  }
+  long edges[NUM_EDGES] = { 0 };
+  build_graph(run, nodes, edges);
+
+  long dataflow = schedule(run, nodes, EDGE_MEMORY);
+  long length = schedule(run, nodes, EDGE_CONTROL);
+  schedule_late(run, nodes, length);
+
+  /* Retirement of the first instruction to that of the last */
+  long observed = run->count ? run->records[run->count - 1].cycle - run->records[0].cycle + 1 : 0;
+  long issue = run->count > length ? run->count : length;
+
+  printf("Dependence graph of %s: %ld instructions retired over %ld cycles\n", input, run->count,
+         observed);
+  printf("  edges: %ld register, %ld zero flag, %ld memory, %ld control\n",
+         edges[EDGE_RS1] + edges[EDGE_RS2], edges[EDGE_ZERO], edges[EDGE_MEMORY], edges[EDGE_CONTROL]);
+  printf("  critical path, data dependences only   %10ld cycles, parallelism %.2f\n", dataflow,
+         dataflow ? (double)run->count / dataflow : 0);
+  printf("  critical path, data and control        %10ld cycles, parallelism %.2f\n", length,
+         length ? (double)run->count / length : 0);
+
+  printf("Observed cycles explained by\n");
+  print_share("true dependences", length, observed);
+  print_share("one instruction per cycle", issue - length, observed);
+  print_share("pipeline stalls and flushes", observed - issue, observed);
+
+  long path[NUM_EDGES] = { 0 };
+  walk_critical_path(run, nodes, length, path);
+  printf("Edges along a critical path: %ld register, %ld zero flag, %ld memory, %ld control\n",
+         path[EDGE_RS1] + path[EDGE_RS2], path[EDGE_ZERO], path[EDGE_MEMORY], path[EDGE_CONTROL]);
+
+  int failed = report_slack(run, nodes, top);
+  free(nodes);
+  return failed;
+}
+
+int
+main(int argc, char const* argv[])
+{
+  if (argc != 2 && argc != 3) {
+    fprintf(stderr, "APEX_Help : Usage %s <retire_trace> [instructions]\n", argv[0]);
+    exit(1);
+  }
+  int top = argc == 3 ? atoi(argv[2]) : DEFAULT_INSTRUCTIONS;
+  if (top <= 0) {
+    fprintf(stderr, "APEX_Error : The number of instructions must be positive\n");
+    exit(1);
+  }
+  FILE* fp = fopen(argv[1], "rb");
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to open retire trace %s\n", argv[1]);
+    exit(1);
+  }
+
+  int failed = 0;
+  char* input;
+  int status;
+  while (!failed && (status = APEX_trace_read_header(fp, RETIRE_TRACE_MAGIC, RETIRE_TRACE_VERSION,
+                                                     sizeof(APEX_Retired), &input)) == 1) {
+    Run_Trace run;
+    memset(&run, 0, sizeof(run));
+    failed = read_run(fp, &run) || analyze(input, &run, top);
+    if (failed) {
+      fprintf(stderr, "APEX_Error : Out of memory analyzing %s\n", input);
+    }
+    printf("\n");
+    free(run.records);
+    free(input);
+  }
+  if (!failed && status < 0) {
+    fprintf(stderr, "APEX_Error : %s is not a retire trace of this build\n", argv[1]);
+    failed = 1;
+  }
+  fclose(fp);
+  return failed;
+}
@@ -0,0 +1,355 @@
+/*
+ *  apex_memtrace.c
+ *  Contains the analyzer of data memory access traces
+ *
+ *  For every run in the trace, prints:
+ *  - the reuse distance histogram: distinct lines accessed between two
+ *    accesses to the same line, with the hit ratio a fully associative
+ *    LRU cache of each size would get,
+ *  - the working set, distinct lines accessed, of every window of cycles,
+ *  - the stride pattern of every LOAD and STORE, for a prefetcher.
+ *  A line is line_words consecutive words of data memory.
+ *
+ *  Usage : apex_memtrace <mem_trace> [window_cycles] [line_words]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "mem_trace.h"
+#include "trace.h"
+
+#define DEFAULT_WINDOW 1000
+
+/* Distance 0, then [2^(i-1), 2^i) up to the size of data memory */
+#define REUSE_BUCKETS 13
+
+/* Strides counted exactly per instruction, the rest are other */
+#define STRIDE_SLOTS 4
+
+typedef struct Pc_Strides
+{
+    int pc;
+    long accesses;
+    long writes;
+    int last_address;
+    int strides[STRIDE_SLOTS];
+    long counts[STRIDE_SLOTS];
+    int used;
+    long other;
+} Pc_Strides;
+
+/* Records of one run */
+typedef struct Run_Trace
+{
+    APEX_Mem_Access* accesses;
+    long count;
+    long capacity;
+} Run_Trace;
+
+static int
+read_run(FILE* fp, Run_Trace* run)
+{
+  APEX_Mem_Access access;
+  while (fread(&access, sizeof(access), 1, fp) == 1 && access.cycle >= 0) {
+    if (run->count == run->capacity) {
+      long capacity = run->capacity ? run->capacity * 2 : 4096;
+      APEX_Mem_Access* grown = realloc(run->accesses, sizeof(*grown) * capacity);
+      if (!grown) {
+        return -1;
+      }
+      run->accesses = grown;
+      run->capacity = capacity;
+    }
+    run->accesses[run->count++] = access;
+  }
+  return 0;
+}
+
+static int
+address_of(const APEX_Mem_Access* access)
+{
+  return (int)((unsigned)access->access >> 1);
+}
+
+/* Fenwick tree over access positions, marking the last access to each line */
+static void
+mark(int* tree, long size, long position, int delta)
+{
+  for (long i = position + 1; i <= size; i += i & -i) {
+    tree[i] += delta;
+  }
+}
+
+static long
+marks_before(const int* tree, long position)
+{
+  long sum = 0;
+  for (long i = position; i > 0; i -= i & -i) {
+    sum += tree[i];
+  }
+  return sum;
+}
+
+static int
+reuse_bucket(long distance)
+{
+  int bucket = 0;
+  while (distance > 0 && bucket < REUSE_BUCKETS - 1) {
+    distance >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+static int
+report_reuse(const Run_Trace* run, int line_words)
+{
+  int lines = (DATA_MEMORY_SIZE + line_words - 1) / line_words;
+  long* last = malloc(sizeof(*last) * lines);
+  int* tree = calloc(run->count + 1, sizeof(*tree));
+  if (!last || !tree) {
+    free(last);
+    free(tree);
+    return -1;
+  }
+  for (int i = 0; i < lines; ++i) {
+    last[i] = -1;
+  }
+
+  long buckets[REUSE_BUCKETS] = { 0 };
+  long cold = 0;
+  long outside = 0;
+  for (long i = 0; i < run->count; ++i) {
+    int address = address_of(&run->accesses[i]);
+    if (address < 0 || address >= DATA_MEMORY_SIZE) {
+      outside++;
+      continue;
+    }
+    int line = address / line_words;
+    if (last[line] < 0) {
+      cold++;
+    } else {
+      /* Lines whose last access falls between the two accesses to this one */
+      long distance = marks_before(tree, i) - marks_before(tree, last[line] + 1);
+      buckets[reuse_bucket(distance)]++;
+      mark(tree, run->count, last[line], -1);
+    }
+    mark(tree, run->count, i, 1);
+    last[line] = i;
+  }
+  free(last);
+  free(tree);
+
+  long total = run->count - outside;
+  printf("Reuse distance, in distinct %d-word lines between accesses to a line\n", line_words);
+  printf("  %-12s %10s  %s\n", "distance", "accesses", "hits of an LRU cache of that many lines");
+  printf("  %-12s %10ld\n", "cold", cold);
+  long hits = 0;
+  for (int b = 0; b < REUSE_BUCKETS; ++b) {
+    char range[32];
+    long low = b ? 1L << (b - 1) : 0;
+    long high = b ? (1L << b) - 1 : 0;
+    if (low == high) {
+      snprintf(range, sizeof(range), "%ld", low);
+    } else {
+      snprintf(range, sizeof(range), "%ld-%ld", low, high);
+    }
+    hits += buckets[b];
+    printf("  %-12s %10ld  %5ld lines: %5.1f%%\n", range, buckets[b], high + 1,
+           total ? 100.0 * hits / total : 0);
+  }
+  if (outside) {
+    printf("  %ld accesses outside data memory left out\n", outside);
+  }
+  return 0;
+}
+
+static int
+report_working_set(const Run_Trace* run, int window, int line_words)
+{
+  int lines = (DATA_MEMORY_SIZE + line_words - 1) / line_words;
+  long* seen = malloc(sizeof(*seen) * lines);
+  if (!seen) {
+    return -1;
+  }
+  for (int i = 0; i < lines; ++i) {
+    seen[i] = -1;
+  }
+
+  printf("Working set per %d-cycle window\n", window);
+  printf("  %10s %10s %10s %10s %10s\n", "start", "accesses", "loads", "stores", "lines");
+  long i = 0;
+  long windows = 0;
+  long largest = 0;
+  long sum = 0;
+  while (i < run->count) {
+    long id = run->accesses[i].cycle / window;
+    long accesses = 0;
+    long stores = 0;
+    long distinct = 0;
+    for (; i < run->count && run->accesses[i].cycle / window == id; ++i) {
+      const APEX_Mem_Access* access = &run->accesses[i];
+      int address = address_of(access);
+      accesses++;
+      stores += access->access & 1;
+      if (address >= 0 && address < DATA_MEMORY_SIZE && seen[address / line_words] != id) {
+        seen[address / line_words] = id;
+        distinct++;
+      }
+    }
+    printf("  %10ld %10ld %10ld %10ld %10ld\n", id * window, accesses, accesses - stores, stores,
+           distinct);
+    windows++;
+    sum += distinct;
+    if (distinct > largest) {
+      largest = distinct;
+    }
+  }
+  if (windows) {
+    printf("  %ld windows with accesses, working set mean %.1f, max %ld lines\n", windows,
+           (double)sum / windows, largest);
+  }
+  free(seen);
+  return 0;
+}
+
+static void
+count_stride(Pc_Strides* entry, int stride)
+{
+  for (int i = 0; i < entry->used; ++i) {
+    if (entry->strides[i] == stride) {
+      entry->counts[i]++;
+      return;
+    }
+  }
+  if (entry->used < STRIDE_SLOTS) {
+    entry->strides[entry->used] = stride;
+    entry->counts[entry->used++] = 1;
+  } else {
+    entry->other++;
+  }
+}
+
+static int
+compare_accesses(const void* a, const void* b)
+{
+  const Pc_Strides* x = a;
+  const Pc_Strides* y = b;
+  if (x->accesses != y->accesses) {
+    return x->accesses > y->accesses ? -1 : 1;
+  }
+  return x->pc - y->pc;
+}
+
+static int
+report_strides(const Run_Trace* run)
+{
+  /* By code index, sized to the highest pc seen */
+  Pc_Strides* entries = NULL;
+  int size = 0;
+  for (long i = 0; i < run->count; ++i) {
+    const APEX_Mem_Access* access = &run->accesses[i];
+    int index = get_code_index(access->pc);
+    if (access->pc < 4000) {
+      continue;
+    }
+    if (index >= size) {
+      int grown_size = size ? size : 64;
+      while (grown_size <= index) {
+        grown_size *= 2;
+      }
+      Pc_Strides* grown = realloc(entries, sizeof(*grown) * grown_size);
+      if (!grown) {
+        free(entries);
+        return -1;
+      }
+      memset(grown + size, 0, sizeof(*grown) * (grown_size - size));
+      entries = grown;
+      size = grown_size;
+    }
+    Pc_Strides* entry = &entries[index];
+    int address = address_of(access);
+    if (entry->accesses) {
+      count_stride(entry, address - entry->last_address);
+    }
+    entry->pc = access->pc;
+    entry->accesses++;
+    entry->writes += access->access & 1;
+    entry->last_address = address;
+  }
+
+  qsort(entries, size, sizeof(*entries), compare_accesses);
+  printf("Strides per instruction, in words between its consecutive accesses\n");
+  printf("  %6s %-5s %10s %10s %7s  %s\n", "pc", "kind", "accesses", "stride", "share", "pattern");
+  for (int i = 0; i < size && entries[i].accesses; ++i) {
+    const Pc_Strides* entry = &entries[i];
+    int top = 0;
+    for (int s = 1; s < entry->used; ++s) {
+      if (entry->counts[s] > entry->counts[top]) {
+        top = s;
+      }
+    }
+    long strides = entry->accesses - 1;
+    const char* kind = entry->writes == entry->accesses ? "STORE" : entry->writes ? "both" : "LOAD";
+    if (!strides) {
+      printf("  %6d %-5s %10ld %10s %7s  %s\n", entry->pc, kind, entry->accesses, "-", "-", "single");
+      continue;
+    }
+    double share = (double)entry->counts[top] / strides;
+    const char* pattern = share < 0.9 ? "irregular" : entry->strides[top] ? "strided" : "constant";
+    printf("  %6d %-5s %10ld %10d %6.1f%%  %s\n", entry->pc, kind, entry->accesses,
+           entry->strides[top], 100.0 * share, pattern);
+  }
+  free(entries);
+  return 0;
+}
+
+int
+main(int argc, char const* argv[])
+{
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr, "APEX_Help : Usage %s <mem_trace> [window_cycles] [line_words]\n", argv[0]);
+    exit(1);
+  }
+  int window = argc > 2 ? atoi(argv[2]) : DEFAULT_WINDOW;
+  int line_words = argc > 3 ? atoi(argv[3]) : 1;
+  if (window <= 0 || line_words <= 0 || line_words > DATA_MEMORY_SIZE) {
+    fprintf(stderr, "APEX_Error : The window and the line size must be positive\n");
+    exit(1);
+  }
+  FILE* fp = fopen(argv[1], "rb");
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to open memory trace %s\n", argv[1]);
+    exit(1);
+  }
+
+  int failed = 0;
+  char* input;
+  int status;
+  while (!failed && (status = APEX_trace_read_header(fp, MEM_TRACE_MAGIC, MEM_TRACE_VERSION,
+                                                     sizeof(APEX_Mem_Access), &input)) == 1) {
+    Run_Trace run;
+    memset(&run, 0, sizeof(run));
+    if (read_run(fp, &run)) {
+      failed = 1;
+    } else {
+      printf("Memory trace of %s: %ld accesses\n", input, run.count);
+      failed = report_reuse(&run, line_words) || report_working_set(&run, window, line_words) ||
+               report_strides(&run);
+      printf("\n");
+    }
+    if (failed) {
+      fprintf(stderr, "APEX_Error : Out of memory analyzing %s\n", input);
+    }
+    free(run.accesses);
+    free(input);
+  }
+  if (!failed && status < 0) {
+    fprintf(stderr, "APEX_Error : %s is not a memory trace of this build\n", argv[1]);
+    failed = 1;
+  }
+  fclose(fp);
+  return failed;
+}
@@ -0,0 +1,255 @@
+/*
+ *  apex_stalls.c
+ *  Contains the summarizer of stall event logs
+ *
+ *  For every run in the log, prints the stall cycles by cause and the
+ *  producer -> consumer pairs that stalled the longest, which are the
+ *  instructions to schedule further apart. Instructions are shown with
+ *  their line of the input when it can still be read as text.
+ *
+ *  Usage : apex_stalls <stall_log> [pairs]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "cpi.h"
+#include "object.h"
+#include "stall_log.h"
+#include "trace.h"
+
+#define PAIR_BUCKETS 4096
+#define DEFAULT_PAIRS 10
+
+typedef struct Stall_Pair
+{
+    int producer_pc;
+    int pc;
+    int cause;
+    int reg;
+    long cycles;
+    int next;			// In its bucket, -1 ends
+} Stall_Pair;
+
+typedef struct Pair_Table
+{
+    int buckets[PAIR_BUCKETS];
+    Stall_Pair* pairs;
+    int count;
+    int capacity;
+} Pair_Table;
+
+/* Lines of the input, NULL where it cannot be read as text */
+typedef struct Source_Lines
+{
+    char** lines;
+    int count;
+} Source_Lines;
+
+static int
+add_event(Pair_Table* table, const APEX_Stall_Event* event)
+{
+  unsigned hash = (unsigned)event->producer_pc * 31u + (unsigned)event->pc * 7u +
+                  event->cause * 3u + (unsigned)(event->reg + 1);
+  int* link = &table->buckets[hash % PAIR_BUCKETS];
+  for (int i = *link; i >= 0; i = table->pairs[i].next) {
+    Stall_Pair* pair = &table->pairs[i];
+    if (pair->producer_pc == event->producer_pc && pair->pc == event->pc &&
+        pair->cause == event->cause && pair->reg == event->reg) {
+      pair->cycles++;
+      return 0;
+    }
+  }
+  if (table->count == table->capacity) {
+    int capacity = table->capacity ? table->capacity * 2 : 256;
+    Stall_Pair* grown = realloc(table->pairs, sizeof(*grown) * capacity);
+    if (!grown) {
+      return -1;
+    }
+    table->pairs = grown;
+    table->capacity = capacity;
+  }
+  Stall_Pair* pair = &table->pairs[table->count];
+  pair->producer_pc = event->producer_pc;
+  pair->pc = event->pc;
+  pair->cause = event->cause;
+  pair->reg = event->reg;
+  pair->cycles = 1;
+  pair->next = *link;
+  *link = table->count++;
+  return 0;
+}
+
+static int
+compare_pairs(const void* a, const void* b)
+{
+  const Stall_Pair* x = a;
+  const Stall_Pair* y = b;
+  if (x->cycles != y->cycles) {
+    return x->cycles > y->cycles ? -1 : 1;
+  }
+  return x->pc - y->pc;
+}
+
+static void
+load_source(const char* input, Source_Lines* source)
+{
+  memset(source, 0, sizeof(*source));
+  FILE* fp = APEX_object_is_file(input) ? NULL : fopen(input, "r");
+  if (!fp) {
+    return;
+  }
+  char* line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+  int allocated = 0;
+  while ((length = getline(&line, &capacity, fp)) >= 0) {
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+      line[--length] = '\0';
+    }
+    if (source->count == allocated) {
+      allocated = allocated ? allocated * 2 : 256;
+      char** grown = realloc(source->lines, sizeof(*grown) * allocated);
+      if (!grown) {
+        break;
+      }
+      source->lines = grown;
+    }
+    source->lines[source->count++] = strdup(line);
+  }
+  free(line);
+  fclose(fp);
+}
+
+static void
+free_source(Source_Lines* source)
+{
+  for (int i = 0; i < source->count; ++i) {
+    free(source->lines[i]);
+  }
+  free(source->lines);
+}
+
+/* pc and its line, in a column of width characters */
+static void
+print_instruction(const Source_Lines* source, int pc, int width)
+{
+  char text[128];
+  int index = get_code_index(pc);
+  if (pc < 0) {
+    snprintf(text, sizeof(text), "-");
+  } else if (pc >= 4000 && index < source->count && source->lines[index]) {
+    snprintf(text, sizeof(text), "%d %s", pc, source->lines[index]);
+  } else {
+    snprintf(text, sizeof(text), "%d", pc);
+  }
+  printf("%-*s", width, text);
+}
+
+static void
+print_register(int reg)
+{
+  if (reg == STALL_REG_ZERO) {
+    printf("Z");
+  } else if (reg == STALL_REG_NONE) {
+    printf("-");
+  } else {
+    printf("R%d", reg);
+  }
+}
+
+static void
+summarize(const char* input, Pair_Table* table, const long* causes, int top)
+{
+  long total = 0;
+  for (int i = 0; i < CPI_NUM_CAUSES; ++i) {
+    total += causes[i];
+  }
+  printf("Stall log of %s: %ld stall cycles\n", input, total);
+  for (int i = 0; i < CPI_NUM_CAUSES; ++i) {
+    if (causes[i]) {
+      printf("  %-10s %10ld  %5.1f%%\n", APEX_cpi_cause_name(i), causes[i], 100.0 * causes[i] / total);
+    }
+  }
+
+  qsort(table->pairs, table->count, sizeof(*table->pairs), compare_pairs);
+  Source_Lines source;
+  load_source(input, &source);
+  printf("Top producer -> consumer pairs\n");
+  printf("  %10s %6s  %-28s    %-28s %-10s %s\n", "cycles", "share", "producer", "consumer", "cause",
+         "register");
+  for (int i = 0; i < table->count && i < top; ++i) {
+    const Stall_Pair* pair = &table->pairs[i];
+    printf("  %10ld %5.1f%%  ", pair->cycles, 100.0 * pair->cycles / total);
+    print_instruction(&source, pair->producer_pc, 28);
+    printf(" -> ");
+    print_instruction(&source, pair->pc, 28);
+    printf(" %-10s ", APEX_cpi_cause_name(pair->cause));
+    print_register(pair->reg);
+    printf("\n");
+  }
+  printf("\n");
+  free_source(&source);
+}
+
+int
+main(int argc, char const* argv[])
+{
+  if (argc != 2 && argc != 3) {
+    fprintf(stderr, "APEX_Help : Usage %s <stall_log> [pairs]\n", argv[0]);
+    exit(1);
+  }
+  int top = argc == 3 ? atoi(argv[2]) : DEFAULT_PAIRS;
+  if (top <= 0) {
+    fprintf(stderr, "APEX_Error : The number of pairs must be positive\n");
+    exit(1);
+  }
+  FILE* fp = fopen(argv[1], "rb");
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to open stall log %s\n", argv[1]);
+    exit(1);
+  }
+
+  int failed = 0;
+  char* input;
+  int status;
+  while ((status = APEX_trace_read_header(fp, STALL_LOG_MAGIC, STALL_LOG_VERSION,
+                                           sizeof(APEX_Stall_Event), &input)) == 1) {
+    Pair_Table table;
+    memset(&table, 0, sizeof(table));
+    memset(table.buckets, -1, sizeof(table.buckets));
+    long causes[CPI_NUM_CAUSES] = { 0 };
+
+    /* A run cut short has no end record, its events so far still count */
+    APEX_Stall_Event event;
+    while (fread(&event, sizeof(event), 1, fp) == 1 && event.cycle >= 0) {
+      if (event.cause >= CPI_NUM_CAUSES) {
+        fprintf(stderr, "APEX_Error : Invalid cause %d at cycle %d of %s\n", event.cause,
+                event.cycle, input);
+        failed = 1;
+        break;
+      }
+      causes[event.cause]++;
+      if (add_event(&table, &event)) {
+        fprintf(stderr, "APEX_Error : Out of memory summarizing %s\n", input);
+        failed = 1;
+        break;
+      }
+    }
+    if (!failed) {
+      summarize(input, &table, causes, top);
+    }
+    free(table.pairs);
+    free(input);
+    if (failed) {
+      break;
+    }
+  }
+  if (status < 0) {
+    fprintf(stderr, "APEX_Error : %s is not a stall log of this build\n", argv[1]);
+    failed = 1;
+  }
+  fclose(fp);
+  return failed;
+}
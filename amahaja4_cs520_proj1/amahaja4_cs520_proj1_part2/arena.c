@@ -0,0 +1,169 @@
+/*
+ *  arena.c
+ *  Contains the per-run allocation arena and the allocator of the simulator
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_HUGE_PAGE (2UL << 20)
+
+/* Size of an allocation, kept in front of it for APEX_realloc */
+typedef struct Arena_Header
+{
+    size_t size;
+    size_t pad;
+} Arena_Header;
+
+static APEX_Arena* current_arena;
+
+/*
+ * Reserves capacity bytes, from huge pages if the host has enough of them
+ * set aside, otherwise from ordinary pages hinted to be backed by
+ * transparent huge pages. Pages are only populated once handed out.
+ */
+APEX_Arena*
+APEX_arena_create(size_t capacity)
+{
+  APEX_Arena* arena = calloc(1, sizeof(*arena));
+  if (!arena || !capacity) {
+    free(arena);
+    return NULL;
+  }
+  capacity = (capacity + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+
+  void* base = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  base = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+              -1, 0);
+  arena->huge_pages = base != MAP_FAILED;
+#endif
+  if (base == MAP_FAILED) {
+    base = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+      free(arena);
+      return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(base, capacity, MADV_HUGEPAGE);
+#endif
+  }
+  arena->base = base;
+  arena->capacity = capacity;
+  return arena;
+}
+
+/* Empties the arena. Everything allocated from it is gone */
+void
+APEX_arena_reset(APEX_Arena* arena)
+{
+  size_t used = arena->used < arena->capacity ? arena->used : arena->capacity;
+  if (used > arena->high_water) {
+    arena->high_water = used;
+  }
+  arena->used = 0;
+}
+
+void
+APEX_arena_free(APEX_Arena* arena)
+{
+  if (!arena) {
+    return;
+  }
+  if (current_arena == arena) {
+    current_arena = NULL;
+  }
+  munmap(arena->base, arena->capacity);
+  free(arena);
+}
+
+/* Makes arena, or malloc if NULL, back the allocations that follow */
+void
+APEX_arena_use(APEX_Arena* arena)
+{
+  current_arena = arena;
+}
+
+static int
+in_arena(APEX_Arena* arena, void* ptr)
+{
+  return arena && (char*)ptr >= arena->base && (char*)ptr < arena->base + arena->capacity;
+}
+
+/* NULL once the arena is full, the caller then falls back to malloc */
+static void*
+arena_alloc(APEX_Arena* arena, size_t size)
+{
+  size_t need = sizeof(Arena_Header) + ((size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1));
+  if (need < size || need > arena->capacity) {
+    return NULL;
+  }
+  size_t offset = __atomic_fetch_add(&arena->used, need, __ATOMIC_RELAXED);
+  if (offset > arena->capacity - need) {
+    return NULL;
+  }
+  Arena_Header* header = (Arena_Header*)(arena->base + offset);
+  header->size = size;
+  return header + 1;
+}
+
+void*
+APEX_malloc(size_t size)
+{
+  void* ptr = current_arena ? arena_alloc(current_arena, size) : NULL;
+  return ptr ? ptr : malloc(size);
+}
+
+/*
+ * Memory past the high water mark of the arena has never been touched and
+ * is still zero, only what earlier runs used is cleared. Large tables
+ * filled in lazily keep their untouched pages unpopulated.
+ */
+void*
+APEX_calloc(size_t count, size_t size)
+{
+  if (size && count > (size_t)-1 / size) {
+    return NULL;
+  }
+  APEX_Arena* arena = current_arena;
+  char* ptr = arena ? arena_alloc(arena, count * size) : NULL;
+  if (!ptr) {
+    return calloc(count, size);
+  }
+  char* dirty_end = arena->base + arena->high_water;
+  if (ptr < dirty_end) {
+    size_t dirty = (size_t)(dirty_end - ptr);
+    memset(ptr, 0, dirty < count * size ? dirty : count * size);
+  }
+  return ptr;
+}
+
+void*
+APEX_realloc(void* ptr, size_t size)
+{
+  if (!in_arena(current_arena, ptr)) {
+    return ptr ? realloc(ptr, size) : APEX_malloc(size);
+  }
+  Arena_Header* header = (Arena_Header*)ptr - 1;
+  if (size <= header->size) {
+    return ptr;
+  }
+  void* grown = APEX_malloc(size);
+  if (grown) {
+    memcpy(grown, ptr, header->size);
+  }
+  return grown;
+}
+
+/* Frees ptr unless it lives in the current arena */
+void
+APEX_free(void* ptr)
+{
+  if (!in_arena(current_arena, ptr)) {
+    free(ptr);
+  }
+}
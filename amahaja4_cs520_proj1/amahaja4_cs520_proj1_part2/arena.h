@@ -0,0 +1,52 @@
+#ifndef _APEX_ARENA_H_
+#define _APEX_ARENA_H_
+/**
+ *  arena.h
+ *  Contains the per-run allocation arena
+ *
+ *  An arena is one reserved mapping handed out front to back. Freeing
+ *  single allocations is a no-op, the whole arena is emptied in O(1)
+ *  between runs instead. Where the host has huge pages the mapping is
+ *  made of them.
+ *
+ *  The simulator allocates through APEX_malloc and friends. They use the
+ *  arena made current with APEX_arena_use, and malloc when there is none
+ *  or it is full, so APEX_free takes either kind of pointer.
+ */
+
+#include <stddef.h>
+
+typedef struct APEX_Arena
+{
+    char* base;
+    size_t capacity;
+    size_t used;		// Bumped atomically, workers allocate concurrently
+    size_t high_water;		// Bytes touched since creation, zero beyond
+    int huge_pages;		// Mapped from the huge page pool
+} APEX_Arena;
+
+APEX_Arena*
+APEX_arena_create(size_t capacity);
+
+void
+APEX_arena_reset(APEX_Arena* arena);
+
+void
+APEX_arena_free(APEX_Arena* arena);
+
+void
+APEX_arena_use(APEX_Arena* arena);
+
+void*
+APEX_malloc(size_t size);
+
+void*
+APEX_calloc(size_t count, size_t size);
+
+void*
+APEX_realloc(void* ptr, size_t size);
+
+void
+APEX_free(void* ptr);
+
+#endif
@@ -0,0 +1,358 @@
+/*
+ *  bbcache.c
+ *  Contains the decoding of basic blocks into superinstructions and the
+ *  threaded interpreter running them
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bbcache.h"
+#include "arena.h"
+
+enum
+{
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_AND,
+    OP_OR,
+    OP_EXOR,
+    OP_MOVC,
+    OP_LOAD,
+    OP_STORE,
+    OP_BZ,
+    OP_BNZ,
+    OP_JUMP,
+    OP_EXIT,		// Leave for the interpreter at pc
+    OP_NEXT,		// Block length limit, continue with not_taken
+
+    /* Fused pairs */
+    OP_MOVC_ADD,
+    OP_LOAD_ADD,
+    OP_SUB_BZ,
+    OP_SUB_BNZ
+};
+
+static int
+valid_register(int r)
+{
+  return r >= 0 && r < 16;
+}
+
+static int
+valid_data_address(int address)
+{
+  return address >= 0 && address < DATA_MEMORY_SIZE;
+}
+
+/* Handler of a single instruction, OP_EXIT if it has none */
+static int
+classify(const APEX_Instruction* ins)
+{
+  static const char* opcodes[] = { "ADD", "SUB", "MUL", "AND", "OR", "EX-OR",
+                                   "MOVC", "LOAD", "STORE", "BZ", "BNZ", "JUMP" };
+  int op = OP_EXIT;
+  for (int i = 0; i < OP_EXIT; ++i) {
+    if (strcmp(ins->opcode, opcodes[i]) == 0) {
+      op = i;
+      break;
+    }
+  }
+
+  /* Register numbers index the register file, leave bad ones to the interpreter */
+  int rd = op <= OP_MOVC || op == OP_LOAD;
+  int rs1 = op <= OP_EXOR || op == OP_LOAD || op == OP_STORE || op == OP_JUMP;
+  int rs2 = op <= OP_EXOR || op == OP_STORE;
+  if ((rd && !valid_register(ins->rd)) || (rs1 && !valid_register(ins->rs1)) ||
+      (rs2 && !valid_register(ins->rs2))) {
+    return OP_EXIT;
+  }
+  return op;
+}
+
+/* Fused handler of a pair, -1 if there is none */
+static int
+fuse(int first, int second)
+{
+  if (first == OP_MOVC && second == OP_ADD) {
+    return OP_MOVC_ADD;
+  }
+  if (first == OP_LOAD && second == OP_ADD) {
+    return OP_LOAD_ADD;
+  }
+  if (first == OP_SUB && second == OP_BZ) {
+    return OP_SUB_BZ;
+  }
+  if (first == OP_SUB && second == OP_BNZ) {
+    return OP_SUB_BNZ;
+  }
+  return -1;
+}
+
+static void
+set_fields(APEX_Superop* op, const APEX_Instruction* ins, int pc)
+{
+  op->pc = pc;
+  op->rd = ins->rd;
+  op->rs1 = ins->rs1;
+  op->rs2 = ins->rs2;
+  op->imm = ins->imm;
+  op->count = 1;
+}
+
+/* Decodes the block starting at code index start */
+static APEX_Decoded_Block*
+decode_block(APEX_Block_Cache* cache, APEX_CPU* cpu, int start)
+{
+  APEX_Decoded_Block* block =
+      APEX_calloc(1, sizeof(*block) + (BBCACHE_MAX_BLOCK + 1) * sizeof(APEX_Superop));
+  if (!block) {
+    return NULL;
+  }
+  block->pc = 4000 + 4 * start;
+
+  int index = start;
+  while (1) {
+    APEX_Superop* op = &block->ops[block->length++];
+    int pc = 4000 + 4 * index;
+    if (index >= cpu->code_memory_size) {
+      op->handler = OP_EXIT;
+      op->pc = pc;
+      break;
+    }
+    if (index - start >= BBCACHE_MAX_BLOCK) {
+      op->handler = OP_NEXT;
+      op->pc = pc;
+      break;
+    }
+
+    const APEX_Instruction* ins = APEX_code_at(cpu, index);
+    int handler = classify(ins);
+    set_fields(op, ins, pc);
+    op->handler = handler;
+    index++;
+
+    if (index < cpu->code_memory_size && handler != OP_EXIT && handler < OP_BZ) {
+      const APEX_Instruction* second = APEX_code_at(cpu, index);
+      int fused = fuse(handler, classify(second));
+      if (fused >= 0) {
+        op->handler = fused;
+        op->count = 2;
+        op->rd2 = second->rd;
+        op->rs1_2 = second->rs1;
+        op->rs2_2 = second->rs2;
+        op->imm2 = second->imm;
+        cache->fused++;
+        index++;
+      }
+    }
+
+    if (op->handler == OP_BZ || op->handler == OP_BNZ) {
+      op->taken_pc = pc + op->imm;
+      break;
+    }
+    if (op->handler == OP_SUB_BZ || op->handler == OP_SUB_BNZ) {
+      op->taken_pc = pc + 4 + op->imm2;
+      break;
+    }
+    if (op->handler == OP_JUMP || op->handler == OP_EXIT) {
+      break;
+    }
+  }
+
+  APEX_Decoded_Block* fitted =
+      APEX_realloc(block, sizeof(*block) + block->length * sizeof(APEX_Superop));
+  cache->blocks_decoded++;
+  return fitted ? fitted : block;
+}
+
+/* Decoded block starting at pc, decoded now if needed, NULL if pc is not in the code */
+static APEX_Decoded_Block*
+lookup(APEX_Block_Cache* cache, APEX_CPU* cpu, int pc)
+{
+  if (pc < 4000 || (pc - 4000) % 4 != 0) {
+    return NULL;
+  }
+  int index = get_code_index(pc);
+  if (index >= cache->code_memory_size) {
+    return NULL;
+  }
+  if (!cache->blocks[index]) {
+    cache->blocks[index] = decode_block(cache, cpu, index);
+  }
+  return cache->blocks[index];
+}
+
+APEX_Block_Cache*
+APEX_bbcache_create(APEX_CPU* cpu)
+{
+  APEX_Block_Cache* cache = APEX_calloc(1, sizeof(*cache));
+  if (!cache) {
+    return NULL;
+  }
+  cache->code_memory_size = cpu->code_memory_size;
+  cache->blocks = APEX_calloc(cpu->code_memory_size + 1, sizeof(*cache->blocks));
+  if (!cache->blocks) {
+    APEX_free(cache);
+    return NULL;
+  }
+  return cache;
+}
+
+/*
+ * Drops every decoded block. Needed after cpu->code_memory changes, the
+ * cache then follows the new code.
+ */
+void
+APEX_bbcache_invalidate(APEX_Block_Cache* cache)
+{
+  for (int i = 0; i < cache->code_memory_size; ++i) {
+    APEX_free(cache->blocks[i]);
+    cache->blocks[i] = NULL;
+  }
+  cache->invalidations++;
+}
+
+void
+APEX_bbcache_free(APEX_Block_Cache* cache)
+{
+  if (!cache) {
+    return;
+  }
+  APEX_bbcache_invalidate(cache);
+  APEX_free(cache->blocks);
+  APEX_free(cache);
+}
+
+/*
+ * Executes from cpu->pc, at most max_instructions of them, with the same
+ * effect as APEX_functional_step. Stops at the first instruction the
+ * interpreter has to execute and leaves cpu->pc pointing to it. Returns
+ * the number of instructions executed.
+ */
+int
+APEX_bbcache_run(APEX_Block_Cache* cache, APEX_CPU* cpu, int max_instructions)
+{
+  int* regs = cpu->regs;
+  int budget = max_instructions;
+  APEX_Decoded_Block* block = lookup(cache, cpu, cpu->pc);
+  APEX_Decoded_Block** successor = NULL;
+  int next_pc = cpu->pc;
+
+  while (block) {
+    APEX_Superop* op = block->ops;
+    for (;;) {
+      if (budget < op->count) {
+        next_pc = op->pc;
+        goto done;
+      }
+      switch (op->handler) {
+        case OP_ADD:
+          regs[op->rd] = regs[op->rs1] + regs[op->rs2];
+          cpu->zero_flag = regs[op->rd] == 0;
+          break;
+        case OP_SUB:
+          regs[op->rd] = regs[op->rs1] - regs[op->rs2];
+          cpu->zero_flag = regs[op->rd] == 0;
+          break;
+        case OP_MUL:
+          regs[op->rd] = regs[op->rs1] * regs[op->rs2];
+          cpu->zero_flag = regs[op->rd] == 0;
+          break;
+        case OP_AND:
+          regs[op->rd] = regs[op->rs1] & regs[op->rs2];
+          break;
+        case OP_OR:
+          regs[op->rd] = regs[op->rs1] | regs[op->rs2];
+          break;
+        case OP_EXOR:
+          regs[op->rd] = regs[op->rs1] ^ regs[op->rs2];
+          break;
+        case OP_MOVC:
+          regs[op->rd] = op->imm;
+          break;
+        case OP_LOAD: {
+          int address = regs[op->rs1] + op->imm;
+          if (!valid_data_address(address)) {
+            next_pc = op->pc;
+            goto done;
+          }
+          regs[op->rd] = cpu->data_memory[address];
+          break;
+        }
+        case OP_STORE: {
+          int address = regs[op->rs2] + op->imm;
+          if (!valid_data_address(address)) {
+            next_pc = op->pc;
+            goto done;
+          }
+          cpu->data_memory[address] = regs[op->rs1];
+          cpu->dirty_pages[address / DATA_PAGE_SIZE] = 1;
+          break;
+        }
+        case OP_MOVC_ADD:
+          regs[op->rd] = op->imm;
+          regs[op->rd2] = regs[op->rs1_2] + regs[op->rs2_2];
+          cpu->zero_flag = regs[op->rd2] == 0;
+          break;
+        case OP_LOAD_ADD: {
+          int address = regs[op->rs1] + op->imm;
+          if (!valid_data_address(address)) {
+            next_pc = op->pc;
+            goto done;
+          }
+          regs[op->rd] = cpu->data_memory[address];
+          regs[op->rd2] = regs[op->rs1_2] + regs[op->rs2_2];
+          cpu->zero_flag = regs[op->rd2] == 0;
+          break;
+        }
+        case OP_SUB_BZ:
+        case OP_SUB_BNZ:
+          regs[op->rd] = regs[op->rs1] - regs[op->rs2];
+          cpu->zero_flag = regs[op->rd] == 0;
+          /* Fall through to the branch */
+        case OP_BZ:
+        case OP_BNZ: {
+          int zero_taken = op->handler == OP_BZ || op->handler == OP_SUB_BZ;
+          budget -= op->count;
+          if (cpu->zero_flag == zero_taken) {
+            next_pc = op->taken_pc;
+            successor = &op->taken;
+          } else {
+            next_pc = op->pc + 4 * op->count;
+            successor = &op->not_taken;
+          }
+          goto follow;
+        }
+        case OP_JUMP:
+          budget -= 1;
+          next_pc = regs[op->rs1] + op->imm;
+          block = lookup(cache, cpu, next_pc);
+          goto next_block;
+        case OP_NEXT:
+          next_pc = op->pc;
+          successor = &op->not_taken;
+          goto follow;
+        case OP_EXIT:
+          next_pc = op->pc;
+          goto done;
+      }
+      budget -= op->count;
+      op++;
+    }
+
+  follow:
+    /* Pre-resolved after the first time */
+    if (!*successor) {
+      *successor = lookup(cache, cpu, next_pc);
+    }
+    block = *successor;
+  next_block:
+    ;
+  }
+
+done:
+  cpu->pc = next_pc;
+  return max_instructions - budget;
+}
@@ -0,0 +1,74 @@
+#ifndef _APEX_BBCACHE_H_
+#define _APEX_BBCACHE_H_
+/**
+ *  bbcache.h
+ *  Contains data structures for the decoded basic block cache of the
+ *  functional executor
+ *
+ *  A block is decoded once into superinstructions: register numbers and
+ *  immediates are extracted, the opcode string becomes a handler number
+ *  and common pairs (MOVC+ADD, LOAD+ADD, SUB+BZ, SUB+BNZ) become a single
+ *  handler. BZ/BNZ keep pointers to the blocks they lead to once those are
+ *  decoded, so following a branch costs no PC lookup. Instructions without
+ *  a handler (HALT, ROI markers, ...) and out of range data accesses stop
+ *  the run just before them, for APEX_functional_step to execute.
+ *
+ *  Decoded blocks mirror cpu->code_memory. Whoever changes the code must
+ *  call APEX_bbcache_invalidate.
+ */
+
+#include "cpu.h"
+
+/* Instructions decoded into one block at most */
+#define BBCACHE_MAX_BLOCK 64
+
+typedef struct APEX_Superop
+{
+    int handler;
+    int count;		    // APEX instructions it executes
+    int pc;		        // Of the first of them
+    int rd;
+    int rs1;
+    int rs2;
+    int imm;
+    /* Second instruction of a fused pair */
+    int rd2;
+    int rs1_2;
+    int rs2_2;
+    int imm2;
+    /* Successors of a block ending branch, decoded on first use */
+    struct APEX_Decoded_Block* taken;
+    struct APEX_Decoded_Block* not_taken;
+    int taken_pc;
+} APEX_Superop;
+
+typedef struct APEX_Decoded_Block
+{
+    int pc;
+    int length;		// Superops, the last one ends the block
+    APEX_Superop ops[];
+} APEX_Decoded_Block;
+
+typedef struct APEX_Block_Cache
+{
+    APEX_Decoded_Block** blocks;	// Starting at each code index
+    int code_memory_size;
+
+    long blocks_decoded;
+    long fused;			// Pairs turned into one superop
+    long invalidations;
+} APEX_Block_Cache;
+
+APEX_Block_Cache*
+APEX_bbcache_create(APEX_CPU* cpu);
+
+void
+APEX_bbcache_invalidate(APEX_Block_Cache* cache);
+
+void
+APEX_bbcache_free(APEX_Block_Cache* cache);
+
+int
+APEX_bbcache_run(APEX_Block_Cache* cache, APEX_CPU* cpu, int max_instructions);
+
+#endif
@@ -0,0 +1,373 @@
+/*
+ *  checkpoint.c
+ *  Contains functions to take, restore, compact and persist incremental
+ *  checkpoints of the APEX cpu
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "arena.h"
+
+#define CHECKPOINT_MAGIC "APEXCKPT"
+#define CHECKPOINT_VERSION 5
+
+/* Header written once at the start of a checkpoint file */
+typedef struct Checkpoint_File_Header
+{
+    char magic[8];
+    int version;
+    int code_memory_size;
+    int page_size;
+    int num_pages;
+} Checkpoint_File_Header;
+
+static void
+save_core(APEX_Core_State* core, APEX_CPU* cpu)
+{
+  core->clock = cpu->clock;
+  core->pc = cpu->pc;
+  core->zero_flag = cpu->zero_flag;
+  core->ins_completed = cpu->ins_completed;
+  core->in_roi = cpu->in_roi;
+  core->pipeline_drained = cpu->pipeline_drained;
+  memcpy(core->regs, cpu->regs, sizeof(core->regs));
+  memcpy(core->regs_valid, cpu->regs_valid, sizeof(core->regs_valid));
+  memcpy(core->regs_forwarding, cpu->regs_forwarding, sizeof(core->regs_forwarding));
+  memcpy(core->stage, cpu->stage, sizeof(core->stage));
+  memcpy(core->cpi_cycles, cpu->cpi_cycles, sizeof(core->cpi_cycles));
+}
+
+static void
+load_core(APEX_CPU* cpu, APEX_Core_State* core)
+{
+  cpu->clock = core->clock;
+  cpu->pc = core->pc;
+  cpu->zero_flag = core->zero_flag;
+  cpu->ins_completed = core->ins_completed;
+  cpu->in_roi = core->in_roi;
+  cpu->pipeline_drained = core->pipeline_drained;
+  memcpy(cpu->regs, core->regs, sizeof(core->regs));
+  memcpy(cpu->regs_valid, core->regs_valid, sizeof(core->regs_valid));
+  memcpy(cpu->regs_forwarding, core->regs_forwarding, sizeof(core->regs_forwarding));
+  memcpy(cpu->stage, core->stage, sizeof(core->stage));
+  memcpy(cpu->cpi_cycles, core->cpi_cycles, sizeof(core->cpi_cycles));
+}
+
+static void
+free_checkpoint(APEX_Checkpoint* ckpt)
+{
+  APEX_free(ckpt->pages);
+  APEX_free(ckpt);
+}
+
+static void
+append_checkpoint(APEX_Checkpoint_Series* series, APEX_Checkpoint* ckpt)
+{
+  ckpt->next = NULL;
+  if (series->tail) {
+    series->tail->next = ckpt;
+  } else {
+    series->head = ckpt;
+  }
+  series->tail = ckpt;
+  series->count++;
+  series->next_index = ckpt->core.index + 1;
+}
+
+static int
+write_header(FILE* fp, int code_memory_size)
+{
+  Checkpoint_File_Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = CHECKPOINT_VERSION;
+  header.code_memory_size = code_memory_size;
+  header.page_size = DATA_PAGE_SIZE;
+  header.num_pages = DATA_NUM_PAGES;
+  return fwrite(&header, sizeof(header), 1, fp) == 1 ? 0 : -1;
+}
+
+static int
+write_checkpoint(FILE* fp, APEX_Checkpoint* ckpt)
+{
+  if (fwrite(&ckpt->core, sizeof(ckpt->core), 1, fp) != 1) {
+    return -1;
+  }
+  if (ckpt->core.num_pages &&
+      fwrite(ckpt->pages, sizeof(*ckpt->pages), ckpt->core.num_pages, fp) !=
+          (size_t)ckpt->core.num_pages) {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Creates an empty series. If autosave_file is given, every checkpoint
+ * taken is also appended to that file as soon as it is taken.
+ */
+APEX_Checkpoint_Series*
+APEX_checkpoint_series_create(const char* autosave_file, int code_memory_size)
+{
+  APEX_Checkpoint_Series* series = APEX_calloc(1, sizeof(*series));
+  if (!series) {
+    return NULL;
+  }
+  series->code_memory_size = code_memory_size;
+
+  if (autosave_file) {
+    series->autosave = fopen(autosave_file, "wb");
+    if (!series->autosave || write_header(series->autosave, code_memory_size)) {
+      APEX_checkpoint_series_free(series);
+      return NULL;
+    }
+  }
+  return series;
+}
+
+/*
+ * Reads back a series written by autosave or APEX_checkpoint_series_save.
+ * The code memory size must match the program being simulated.
+ */
+APEX_Checkpoint_Series*
+APEX_checkpoint_series_load(const char* filename, int code_memory_size)
+{
+  FILE* fp = fopen(filename, "rb");
+  if (!fp) {
+    return NULL;
+  }
+
+  Checkpoint_File_Header header;
+  if (fread(&header, sizeof(header), 1, fp) != 1 ||
+      memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != CHECKPOINT_VERSION || header.page_size != DATA_PAGE_SIZE ||
+      header.num_pages != DATA_NUM_PAGES || header.code_memory_size != code_memory_size) {
+    fclose(fp);
+    return NULL;
+  }
+
+  APEX_Checkpoint_Series* series = APEX_checkpoint_series_create(NULL, code_memory_size);
+  if (!series) {
+    fclose(fp);
+    return NULL;
+  }
+
+  APEX_Core_State core;
+  while (fread(&core, sizeof(core), 1, fp) == 1) {
+    if (core.num_pages < 0 || core.num_pages > DATA_NUM_PAGES) {
+      break;
+    }
+    APEX_Checkpoint* ckpt = APEX_calloc(1, sizeof(*ckpt));
+    if (!ckpt) {
+      break;
+    }
+    ckpt->core = core;
+    if (core.num_pages) {
+      ckpt->pages = APEX_malloc(sizeof(*ckpt->pages) * core.num_pages);
+      if (!ckpt->pages ||
+          fread(ckpt->pages, sizeof(*ckpt->pages), core.num_pages, fp) !=
+              (size_t)core.num_pages) {
+        /* Truncated tail, e.g. the run was killed while autosaving */
+        free_checkpoint(ckpt);
+        break;
+      }
+    }
+    /* Page ids index data memory on restore, a corrupt one ends the series */
+    int bad_page = 0;
+    for (int i = 0; i < core.num_pages; ++i) {
+      bad_page |= ckpt->pages[i].id < 0 || ckpt->pages[i].id >= DATA_NUM_PAGES;
+    }
+    if (bad_page) {
+      free_checkpoint(ckpt);
+      break;
+    }
+    append_checkpoint(series, ckpt);
+  }
+
+  fclose(fp);
+  if (!series->head || !series->head->core.is_base) {
+    APEX_checkpoint_series_free(series);
+    return NULL;
+  }
+  return series;
+}
+
+/*
+ * Writes the whole series to a file, e.g. after compacting it.
+ */
+int
+APEX_checkpoint_series_save(APEX_Checkpoint_Series* series, const char* filename)
+{
+  FILE* fp = fopen(filename, "wb");
+  if (!fp) {
+    return -1;
+  }
+
+  int ret = write_header(fp, series->code_memory_size);
+  for (APEX_Checkpoint* ckpt = series->head; ckpt && !ret; ckpt = ckpt->next) {
+    ret = write_checkpoint(fp, ckpt);
+  }
+
+  if (fclose(fp)) {
+    ret = -1;
+  }
+  return ret;
+}
+
+void
+APEX_checkpoint_series_free(APEX_Checkpoint_Series* series)
+{
+  if (!series) {
+    return;
+  }
+  APEX_Checkpoint* ckpt = series->head;
+  while (ckpt) {
+    APEX_Checkpoint* next = ckpt->next;
+    free_checkpoint(ckpt);
+    ckpt = next;
+  }
+  if (series->autosave) {
+    fclose(series->autosave);
+  }
+  APEX_free(series);
+}
+
+/*
+ * Takes a checkpoint of the cpu. The first checkpoint of a series is a base
+ * holding every page of data memory, the following ones only hold the pages
+ * written since the previous checkpoint.
+ */
+APEX_Checkpoint*
+APEX_checkpoint_take(APEX_Checkpoint_Series* series, APEX_CPU* cpu)
+{
+  APEX_Checkpoint* ckpt = APEX_calloc(1, sizeof(*ckpt));
+  if (!ckpt) {
+    return NULL;
+  }
+
+  int is_base = series->head == NULL;
+  int num_pages = 0;
+  for (int i = 0; i < DATA_NUM_PAGES; ++i) {
+    if (is_base || cpu->dirty_pages[i]) {
+      num_pages++;
+    }
+  }
+
+  if (num_pages) {
+    ckpt->pages = APEX_malloc(sizeof(*ckpt->pages) * num_pages);
+    if (!ckpt->pages) {
+      APEX_free(ckpt);
+      return NULL;
+    }
+  }
+
+  int n = 0;
+  for (int i = 0; i < DATA_NUM_PAGES; ++i) {
+    if (is_base || cpu->dirty_pages[i]) {
+      ckpt->pages[n].id = i;
+      memcpy(ckpt->pages[n].data, &cpu->data_memory[i * DATA_PAGE_SIZE],
+             sizeof(ckpt->pages[n].data));
+      n++;
+    }
+  }
+  memset(cpu->dirty_pages, 0, sizeof(cpu->dirty_pages));
+
+  save_core(&ckpt->core, cpu);
+  ckpt->core.index = series->next_index;
+  ckpt->core.is_base = is_base;
+  ckpt->core.num_pages = num_pages;
+  append_checkpoint(series, ckpt);
+
+  if (series->autosave) {
+    if (write_checkpoint(series->autosave, ckpt) || fflush(series->autosave)) {
+      fprintf(stderr, "APEX_Error : Unable to autosave checkpoint %d\n", ckpt->core.index);
+    }
+  }
+
+  if (ENABLE_DEBUG_MESSAGES) {
+    printf("Checkpoint %d taken at cycle %d (%d pages)\n",
+           ckpt->core.index, ckpt->core.clock, num_pages);
+  }
+  return ckpt;
+}
+
+/*
+ * Restores the cpu to the checkpoint with the given index by loading the
+ * base and applying every delta up to and including that checkpoint.
+ */
+int
+APEX_checkpoint_restore(APEX_Checkpoint_Series* series, int index, APEX_CPU* cpu)
+{
+  APEX_Checkpoint* target = NULL;
+  for (APEX_Checkpoint* ckpt = series->head; ckpt; ckpt = ckpt->next) {
+    if (ckpt->core.index == index) {
+      target = ckpt;
+      break;
+    }
+  }
+  if (!target) {
+    return -1;
+  }
+
+  for (APEX_Checkpoint* ckpt = series->head; ckpt; ckpt = ckpt->next) {
+    for (int i = 0; i < ckpt->core.num_pages; ++i) {
+      memcpy(&cpu->data_memory[ckpt->pages[i].id * DATA_PAGE_SIZE], ckpt->pages[i].data,
+             sizeof(ckpt->pages[i].data));
+    }
+    if (ckpt == target) {
+      break;
+    }
+  }
+
+  load_core(cpu, &target->core);
+  memset(cpu->dirty_pages, 0, sizeof(cpu->dirty_pages));
+  return 0;
+}
+
+/*
+ * Folds every checkpoint up to and including the given index into a new
+ * base. Checkpoints older than index can no longer be restored afterwards.
+ */
+int
+APEX_checkpoint_compact(APEX_Checkpoint_Series* series, int index)
+{
+  APEX_Checkpoint* target = NULL;
+  for (APEX_Checkpoint* ckpt = series->head; ckpt; ckpt = ckpt->next) {
+    if (ckpt->core.index == index) {
+      target = ckpt;
+      break;
+    }
+  }
+  if (!target) {
+    return -1;
+  }
+  if (target == series->head) {
+    return 0;
+  }
+
+  APEX_Checkpoint_Page* pages = APEX_malloc(sizeof(*pages) * DATA_NUM_PAGES);
+  if (!pages) {
+    return -1;
+  }
+  for (APEX_Checkpoint* ckpt = series->head; ckpt != target->next; ckpt = ckpt->next) {
+    for (int i = 0; i < ckpt->core.num_pages; ++i) {
+      pages[ckpt->pages[i].id] = ckpt->pages[i];
+    }
+  }
+
+  APEX_Checkpoint* ckpt = series->head;
+  while (ckpt != target) {
+    APEX_Checkpoint* next = ckpt->next;
+    free_checkpoint(ckpt);
+    series->count--;
+    ckpt = next;
+  }
+
+  APEX_free(target->pages);
+  target->pages = pages;
+  target->core.is_base = 1;
+  target->core.num_pages = DATA_NUM_PAGES;
+  series->head = target;
+  return 0;
+}
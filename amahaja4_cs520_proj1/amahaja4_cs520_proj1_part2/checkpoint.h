@@ -0,0 +1,83 @@
+#ifndef _APEX_CHECKPOINT_H_
+#define _APEX_CHECKPOINT_H_
+/**
+ *  checkpoint.h
+ *  Contains incremental (base + delta) checkpoint data structures
+ *
+ *  A series starts with a base checkpoint holding every data memory page.
+ *  Every following checkpoint only holds the pages written since the
+ *  previous one, tracked through APEX_CPU.dirty_pages on the STORE path.
+ */
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+/* Register file, flags and pipeline latches at the time of a checkpoint */
+typedef struct APEX_Core_State
+{
+    int index;		    // Position of the checkpoint in its series
+    int is_base;		// 1 if the checkpoint holds all data memory pages
+    int num_pages;		// Number of data memory pages that follow
+    int clock;
+    int pc;
+    int zero_flag;
+    int ins_completed;
+    int in_roi;
+    int pipeline_drained;
+    int regs[16];
+    int regs_valid[16];
+    int regs_forwarding[16];
+    CPU_Stage stage[NUM_STAGES];
+    long cpi_cycles[CPI_NUM_CAUSES];	// So that the CPI stack of a resumed run adds up
+} APEX_Core_State;
+
+/* One saved page of data memory */
+typedef struct APEX_Checkpoint_Page
+{
+    int id;		        // Page number in data memory
+    int data[DATA_PAGE_SIZE];
+} APEX_Checkpoint_Page;
+
+typedef struct APEX_Checkpoint
+{
+    APEX_Core_State core;
+    APEX_Checkpoint_Page* pages;
+    struct APEX_Checkpoint* next;
+} APEX_Checkpoint;
+
+/* Chain of checkpoints, oldest (the base) first */
+typedef struct APEX_Checkpoint_Series
+{
+    APEX_Checkpoint* head;
+    APEX_Checkpoint* tail;
+    int count;
+    int next_index;
+    int code_memory_size;
+
+    /* Every checkpoint taken is appended here as well, if set */
+    FILE* autosave;
+} APEX_Checkpoint_Series;
+
+APEX_Checkpoint_Series*
+APEX_checkpoint_series_create(const char* autosave_file, int code_memory_size);
+
+APEX_Checkpoint_Series*
+APEX_checkpoint_series_load(const char* filename, int code_memory_size);
+
+int
+APEX_checkpoint_series_save(APEX_Checkpoint_Series* series, const char* filename);
+
+void
+APEX_checkpoint_series_free(APEX_Checkpoint_Series* series);
+
+APEX_Checkpoint*
+APEX_checkpoint_take(APEX_Checkpoint_Series* series, APEX_CPU* cpu);
+
+int
+APEX_checkpoint_restore(APEX_Checkpoint_Series* series, int index, APEX_CPU* cpu);
+
+int
+APEX_checkpoint_compact(APEX_Checkpoint_Series* series, int index);
+
+#endif
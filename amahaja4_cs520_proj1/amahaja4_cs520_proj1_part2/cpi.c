@@ -0,0 +1,151 @@
+/*
+ *  cpi.c
+ *  Contains the CPI stack accounting of regions of interest and its report
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpi.h"
+#include "stats.h"
+#include "arena.h"
+
+static const char* cause_names[CPI_NUM_CAUSES] = {
+  "fill", "base", "raw", "load_use", "mul", "branch_z", "flush", "drain", "nop", "replayed"
+};
+
+const char*
+APEX_cpi_cause_name(int cause)
+{
+  return cause_names[cause];
+}
+
+static int
+register_region(APEX_Stats* stats, APEX_Cpi_Region* region)
+{
+  char name[STATS_MAX_NAME];
+  snprintf(name, sizeof(name), "cpi.region.%d.entries", region->pc);
+  int ok = APEX_stats_bind_int(stats, name, &region->entries) != NULL;
+  snprintf(name, sizeof(name), "cpi.region.%d.instructions", region->pc);
+  ok = ok && APEX_stats_bind(stats, name, &region->instructions);
+  for (int i = 0; ok && i < CPI_NUM_CAUSES; ++i) {
+    snprintf(name, sizeof(name), "cpi.region.%d.%s", region->pc, cause_names[i]);
+    ok = APEX_stats_bind(stats, name, &region->cycles[i]) != NULL;
+  }
+  return ok ? 0 : -1;
+}
+
+/* Starts charging cycles to the region of the ROI_BEGIN at pc */
+void
+APEX_cpi_region_enter(APEX_CPU* cpu, int pc)
+{
+  APEX_Cpi_Region* region = cpu->cpi_regions;
+  while (region && region->pc != pc) {
+    region = region->next;
+  }
+  if (!region) {
+    region = APEX_calloc(1, sizeof(*region));
+    if (!region) {
+      cpu->cpi_region = NULL;
+      return;
+    }
+    region->pc = pc;
+    region->next = cpu->cpi_regions;
+    cpu->cpi_regions = region;
+    if (cpu->stats && register_region(cpu->stats->registry, region)) {
+      fprintf(stderr, "APEX_Error : Unable to register statistics of the region at pc %d\n", pc);
+    }
+  }
+  region->entries++;
+  memcpy(region->start_cycles, cpu->cpi_cycles, sizeof(region->start_cycles));
+  region->start_instructions = cpu->ins_completed;
+  cpu->cpi_region = region;
+}
+
+/* Adds the cycles since the region was entered to it */
+void
+APEX_cpi_region_exit(APEX_CPU* cpu)
+{
+  APEX_Cpi_Region* region = cpu->cpi_region;
+  if (!region) {
+    return;
+  }
+  for (int i = 0; i < CPI_NUM_CAUSES; ++i) {
+    region->cycles[i] += cpu->cpi_cycles[i] - region->start_cycles[i];
+  }
+  region->instructions += cpu->ins_completed - region->start_instructions;
+  cpu->cpi_region = NULL;
+}
+
+static void
+print_stack(const long* cycles, long instructions)
+{
+  long total = 0;
+  for (int i = 0; i < CPI_NUM_CAUSES; ++i) {
+    total += cycles[i];
+  }
+  printf("%ld cycles, %ld instructions, CPI %.3f \n", total, instructions,
+         instructions ? (double)total / instructions : 0);
+  for (int i = 0; i < CPI_NUM_CAUSES; ++i) {
+    printf("  %-10s %10ld cycles  CPI %.3f  %5.1f%% \n", cause_names[i], cycles[i],
+           instructions ? (double)cycles[i] / instructions : 0,
+           total ? 100.0 * cycles[i] / total : 0);
+  }
+}
+
+/*
+ * Prints the CPI stack of the run and of every region, oldest first. A
+ * region the run ended in is closed first.
+ */
+void
+APEX_cpi_report(APEX_CPU* cpu)
+{
+  APEX_cpi_region_exit(cpu);
+  printf("CPI stack: ");
+  print_stack(cpu->cpi_cycles, cpu->ins_completed);
+
+  int count = 0;
+  for (APEX_Cpi_Region* region = cpu->cpi_regions; region; region = region->next) {
+    count++;
+  }
+  for (int n = count; n > 0; --n) {
+    APEX_Cpi_Region* region = cpu->cpi_regions;
+    for (int i = 1; i < n; ++i) {
+      region = region->next;
+    }
+    printf("CPI stack of the region at pc %d, entered %d times: ", region->pc, region->entries);
+    print_stack(region->cycles, region->instructions);
+  }
+}
+
+void
+APEX_cpi_free(APEX_CPU* cpu)
+{
+  APEX_Cpi_Region* region = cpu->cpi_regions;
+  while (region) {
+    APEX_Cpi_Region* next = region->next;
+    APEX_free(region);
+    region = next;
+  }
+  cpu->cpi_regions = NULL;
+  cpu->cpi_region = NULL;
+}
+
+/* Registers the CPI stack of the run under "cpi", regions as they are entered */
+int
+APEX_cpi_register_stats(APEX_CPU* cpu, APEX_Stats* stats)
+{
+  char name[STATS_MAX_NAME];
+  for (int i = 0; i < CPI_NUM_CAUSES; ++i) {
+    snprintf(name, sizeof(name), "cpi.%s", cause_names[i]);
+    if (!APEX_stats_bind(stats, name, &cpu->cpi_cycles[i])) {
+      return -1;
+    }
+  }
+  for (APEX_Cpi_Region* region = cpu->cpi_regions; region; region = region->next) {
+    if (register_region(stats, region)) {
+      return -1;
+    }
+  }
+  return 0;
+}
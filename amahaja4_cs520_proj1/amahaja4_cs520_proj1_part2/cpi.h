@@ -0,0 +1,46 @@
+#ifndef _APEX_CPI_H_
+#define _APEX_CPI_H_
+/**
+ *  cpi.h
+ *  Contains the CPI stack of a run and of its regions of interest
+ *
+ *  Every stepped cycle is charged to exactly one CPI_ cause (see cpu.h):
+ *  the retirement of an instruction, or the reason the bubble writeback
+ *  takes was inserted, which the stage inserting it records in the latch.
+ *  The causes add up to the clock. Cycles of a region are charged to it
+ *  from ROI_BEGIN to the retirement of its ROI_END, summed over entries.
+ */
+
+#include "cpu.h"
+
+typedef struct APEX_Cpi_Region
+{
+    int pc;			// Of its ROI_BEGIN
+    int entries;
+    long cycles[CPI_NUM_CAUSES];
+    long instructions;
+    /* Counters of the cpu when last entered */
+    long start_cycles[CPI_NUM_CAUSES];
+    int start_instructions;
+    struct APEX_Cpi_Region* next;
+} APEX_Cpi_Region;
+
+void
+APEX_cpi_region_enter(APEX_CPU* cpu, int pc);
+
+void
+APEX_cpi_region_exit(APEX_CPU* cpu);
+
+void
+APEX_cpi_report(APEX_CPU* cpu);
+
+const char*
+APEX_cpi_cause_name(int cause);
+
+void
+APEX_cpi_free(APEX_CPU* cpu);
+
+int
+APEX_cpi_register_stats(APEX_CPU* cpu, struct APEX_Stats* stats);
+
+#endif
@@ -12,12 +12,39 @@
 #include <string.h>
 
 #include "cpu.h"
-
-/* Set this flag to 1 to enable debug messages */
+#include "checkpoint.h"
+#include "explore.h"
+#include "memo.h"
+#include "loop.h"
+#include "jit.h"
+#include "bbcache.h"
+#include "program.h"
+#include "arena.h"
+#include "stats.h"
+#include "cpi.h"
+#include "profile.h"
+#include "stall_log.h"
+#include "latency.h"
+#include "window.h"
+#include "mem_trace.h"
+#include "retire_trace.h"
+
+/* Default timing configuration, copied into each cpu at init */
 #define ENABLE_DATA_FORWARDING 1
+#define MUL_LATENCY 2
 
 int ENABLE_DEBUG_MESSAGES=1;
 
+/* Decode each line of the program on first fetch instead of at load */
+int LAZY_CODE_MEMORY=0;
+
+/* Names of the stages and of the opcodes in the instruction mix, by index */
+static const char* stage_names[NUM_STAGES] = { "fetch", "decode", "execute", "memory", "writeback" };
+static const char* stat_opcodes[STATS_NUM_OPCODES - 1] = {
+  "ADD", "SUB", "MUL", "AND", "OR", "EX-OR", "MOVC", "LOAD", "STORE", "BZ", "BNZ", "JUMP",
+  "HALT", "ROI_BEGIN", "ROI_END"
+};
+
 /*
  * This function creates and initializes APEX cpu.
  *
@@ -27,11 +54,23 @@ int ENABLE_DEBUG_MESSAGES=1;
 APEX_CPU*
 APEX_cpu_init(const char* filename,const char* function_code,const char* function_cycles)
 {
-  if (!filename) {
+  APEX_Program* program = APEX_program_load(filename, LAZY_CODE_MEMORY);
+  if (!program) {
     return NULL;
   }
+  APEX_CPU* cpu = APEX_cpu_create(program, function_code, function_cycles);
+  APEX_program_release(program);
+  return cpu;
+}
 
-  APEX_CPU* cpu = malloc(sizeof(*cpu));
+/*
+ * Creates a cpu running program, which it holds a reference to. Any
+ * number of cpus can run the same program.
+ */
+APEX_CPU*
+APEX_cpu_create(APEX_Program* program, const char* function_code, const char* function_cycles)
+{
+  APEX_CPU* cpu = APEX_malloc(sizeof(*cpu));
   if (!cpu) {
     return NULL;
   }
@@ -40,7 +79,29 @@ APEX_cpu_init(const char* filename,const char* function_code,const char* functio
 
 
   cpu->pc = 4000;
+  cpu->clock = 0;
+  cpu->zero_flag = 0;
+  cpu->ins_completed = 0;
   cpu->function_cycles=atoi(function_cycles);
+  cpu->enable_data_forwarding = ENABLE_DATA_FORWARDING;
+  cpu->mul_latency = MUL_LATENCY;
+  cpu->explore = NULL;
+  cpu->memo = NULL;
+  cpu->loops = NULL;
+  cpu->jit = NULL;
+  cpu->bbcache = NULL;
+  cpu->stats = NULL;
+  cpu->redirects = 0;
+  memset(cpu->cpi_cycles, 0, sizeof(cpu->cpi_cycles));
+  cpu->cpi_regions = NULL;
+  cpu->cpi_region = NULL;
+  cpu->cpi_report = 0;
+  cpu->profile = NULL;
+  cpu->stall_log = NULL;
+  cpu->mem_trace = NULL;
+  cpu->retire_trace = NULL;
+  cpu->latency = NULL;
+  cpu->window = NULL;
 
   if(strcmp(function_code , "simulate")==0){
     ENABLE_DEBUG_MESSAGES=0;
@@ -58,14 +119,23 @@ APEX_cpu_init(const char* filename,const char* function_code,const char* functio
   memset(cpu->regs_valid, 1, sizeof(int) * 32);
   memset(cpu->stage, 0, sizeof(CPU_Stage) * NUM_STAGES);
   memset(cpu->data_memory, 0, sizeof(int) * 4000);
+  memset(cpu->dirty_pages, 0, sizeof(cpu->dirty_pages));
 
-  /* Parse input file and create code memory */
-  cpu->code_memory = create_code_memory(filename, &cpu->code_memory_size);
+  cpu->checkpoint_interval = 0;
+  cpu->checkpoints = NULL;
+  cpu->pipeline_drained = 0;
+  cpu->in_roi = 0;
+  cpu->roi_entries = 0;
+  cpu->roi_skipped = 0;
 
-  if (!cpu->code_memory) {
-    free(cpu);
-    return NULL;
-  }
+  /* Code memory and initial data come from the program */
+  cpu->program = APEX_program_retain(program);
+  cpu->code_memory = program->code_memory;
+  cpu->code_memory_size = program->code_memory_size;
+  memcpy(cpu->data_memory, program->initial_data, sizeof(cpu->data_memory));
+
+  /* Only programs with a region of interest start out fast-forwarding */
+  cpu->roi_mode = program->has_roi;
 
   if (ENABLE_DEBUG_MESSAGES) {
     fprintf(stderr,
@@ -75,12 +145,13 @@ APEX_cpu_init(const char* filename,const char* function_code,const char* functio
     printf("%-9s %-9s %-9s %-9s %-9s\n", "opcode", "rd", "rs1", "rs2", "imm");
 
     for (int i = 0; i < cpu->code_memory_size; ++i) {
+      const APEX_Instruction* ins = APEX_code_at(cpu, i);
       printf("%-9s %-9d %-9d %-9d %-9d\n",
-             cpu->code_memory[i].opcode,
-             cpu->code_memory[i].rd,
-             cpu->code_memory[i].rs1,
-             cpu->code_memory[i].rs2,
-             cpu->code_memory[i].imm);
+             ins->opcode,
+             ins->rd,
+             ins->rs1,
+             ins->rs2,
+             ins->imm);
     }
   }
 
@@ -101,8 +172,131 @@ APEX_cpu_init(const char* filename,const char* function_code,const char* functio
 void
 APEX_cpu_stop(APEX_CPU* cpu)
 {
-  free(cpu->code_memory);
-  free(cpu);
+  APEX_checkpoint_series_free(cpu->checkpoints);
+  APEX_explore_free(cpu->explore);
+  APEX_memo_free(cpu->memo);
+  APEX_loops_free(cpu->loops);
+  APEX_jit_free(cpu->jit);
+  APEX_bbcache_free(cpu->bbcache);
+  APEX_cpi_free(cpu);
+  APEX_profile_free(cpu->profile);
+  APEX_latency_free(cpu->latency);
+  APEX_window_free(cpu->window);
+  if (APEX_stall_log_close(cpu->stall_log)) {
+    fprintf(stderr, "APEX_Error : Unable to write the stall log\n");
+  }
+  if (APEX_mem_trace_close(cpu->mem_trace)) {
+    fprintf(stderr, "APEX_Error : Unable to write the memory trace\n");
+  }
+  if (APEX_retire_trace_close(cpu->retire_trace)) {
+    fprintf(stderr, "APEX_Error : Unable to write the retire trace\n");
+  }
+  if (cpu->stats) {
+    APEX_stats_free(cpu->stats->registry);
+    APEX_free(cpu->stats);
+  }
+  APEX_program_release(cpu->program);
+  APEX_free(cpu);
+}
+
+/*
+ * Makes a private copy of the cpu for another simulation. The copy borrows
+ * the program of the original and is released with APEX_free().
+ */
+APEX_CPU*
+APEX_cpu_clone(APEX_CPU* cpu)
+{
+  APEX_CPU* copy = APEX_malloc(sizeof(*copy));
+  if (!copy) {
+    return NULL;
+  }
+  memcpy(copy, cpu, sizeof(*copy));
+  copy->checkpoints = NULL;
+  copy->checkpoint_interval = 0;
+  copy->explore = NULL;
+  copy->memo = NULL;
+  copy->loops = NULL;
+  copy->jit = NULL;
+  copy->bbcache = NULL;
+  copy->stats = NULL;
+  copy->cpi_regions = NULL;
+  copy->cpi_region = NULL;
+  copy->profile = NULL;
+  copy->stall_log = NULL;
+  copy->mem_trace = NULL;
+  copy->retire_trace = NULL;
+  copy->latency = NULL;
+  copy->window = NULL;
+  return copy;
+}
+
+/*
+ * Empties the pipeline so that detailed simulation restarts at cpu->pc from
+ * the architectural state alone, e.g. one produced by the functional
+ * executor.
+ */
+void
+APEX_cpu_reset_pipeline(APEX_CPU* cpu)
+{
+  memset(cpu->stage, 0, sizeof(CPU_Stage) * NUM_STAGES);
+  for (int i = 1; i < NUM_STAGES; ++i) {
+    cpu->stage[i].busy = 1;
+  }
+  cpu->pipeline_drained = 0;
+  for (int i = 0; i < 16; ++i) {
+    cpu->regs_valid[i] = 1;
+    cpu->regs_forwarding[i] = cpu->regs[i];
+  }
+}
+
+/*
+ * Registers the statistics of the run and of the pipeline with registry,
+ * which the cpu then owns. Cycles replayed by --memo or --loops only count
+ * in the run totals. Returns 0 on success.
+ */
+int
+APEX_cpu_enable_stats(APEX_CPU* cpu, APEX_Stats* registry)
+{
+  APEX_Pipeline_Stats* stats = APEX_calloc(1, sizeof(*stats));
+  if (!stats) {
+    APEX_stats_free(registry);
+    return -1;
+  }
+  stats->registry = registry;
+  cpu->stats = stats;
+
+  int ok = APEX_stats_bind_int(registry, "run.cycles", &cpu->clock) &&
+           APEX_stats_bind_int(registry, "run.instructions", &cpu->ins_completed) &&
+           APEX_stats_bind_int(registry, "run.cycle_limit", &cpu->function_cycles) &&
+           APEX_stats_bind_int(registry, "run.code_size", &cpu->code_memory_size) &&
+           APEX_stats_bind_int(registry, "pipeline.flushes", &cpu->redirects);
+  if (cpu->roi_mode) {
+    ok = ok && APEX_stats_bind_int(registry, "run.roi.entries", &cpu->roi_entries) &&
+         APEX_stats_bind_int(registry, "run.roi.fast_forwarded", &cpu->roi_skipped);
+  }
+
+  char name[STATS_MAX_NAME];
+  for (int i = 0; ok && i < NUM_STAGES; ++i) {
+    snprintf(name, sizeof(name), "pipeline.%s.busy", stage_names[i]);
+    stats->busy[i] = APEX_stats_counter(registry, name);
+    snprintf(name, sizeof(name), "pipeline.%s.stalled", stage_names[i]);
+    stats->stalled[i] = APEX_stats_counter(registry, name);
+    snprintf(name, sizeof(name), "pipeline.%s.bubble", stage_names[i]);
+    stats->bubble[i] = APEX_stats_counter(registry, name);
+    ok = stats->busy[i] && stats->stalled[i] && stats->bubble[i];
+  }
+  for (int i = 0; ok && i < STATS_NUM_OPCODES; ++i) {
+    snprintf(name, sizeof(name), "pipeline.retired.%s", APEX_opcode_name(i));
+    stats->retired[i] = APEX_stats_counter(registry, name);
+    ok = stats->retired[i] != NULL;
+  }
+  stats->forwarded = ok ? APEX_stats_counter(registry, "pipeline.forwarded_operands") : NULL;
+  stats->decode_stall_length =
+      ok ? APEX_stats_histogram(registry, "pipeline.decode.stall_length", 1, 16) : NULL;
+  if (!stats->forwarded || !stats->decode_stall_length) {
+    return -1;
+  }
+  return APEX_cpi_register_stats(cpu, registry);
 }
 
 /* Converts the PC(4000 series) into
@@ -117,6 +311,16 @@ get_code_index(int pc)
   return (pc - 4000) / 4;
 }
 
+/* Instruction at a code index, decoded now if the program is lazy */
+const APEX_Instruction*
+APEX_code_at(APEX_CPU* cpu, int index)
+{
+  if (cpu->program) {
+    return APEX_program_at(cpu->program, index);
+  }
+  return &cpu->code_memory[index];
+}
+
 static void
 print_instruction(CPU_Stage* stage)
 {
@@ -162,6 +366,9 @@ print_instruction(CPU_Stage* stage)
   else if(strcmp(stage->opcode,"HALT")==0){
     printf("%s", stage->opcode);
   }
+  else if(strcmp(stage->opcode,"ROI_BEGIN")==0 || strcmp(stage->opcode,"ROI_END")==0){
+    printf("%s", stage->opcode);
+  }
 
 
 
@@ -182,6 +389,232 @@ print_stage_content(char* name, CPU_Stage* stage)
   printf("\n");
 }
 
+static inline void
+count_forwarded(APEX_CPU* cpu)
+{
+  if (cpu->stats) {
+    APEX_stat_inc(cpu->stats->forwarded);
+  }
+}
+
+/* Index of opcode in stat_opcodes, told apart by its first characters */
+int
+APEX_opcode_index(const char* opcode)
+{
+  int i;
+  switch (opcode[0]) {
+    case 'A': i = opcode[1] == 'D' ? 0 : 3; break;
+    case 'S': i = opcode[1] == 'U' ? 1 : 8; break;
+    case 'M': i = opcode[1] == 'U' ? 2 : 6; break;
+    case 'O': i = 4; break;
+    case 'E': i = 5; break;
+    case 'L': i = 7; break;
+    case 'B': i = opcode[1] == 'Z' ? 9 : 10; break;
+    case 'J': i = 11; break;
+    case 'H': i = 12; break;
+    case 'R': i = opcode[4] == 'B' ? 13 : 14; break;
+    default: return STATS_NUM_OPCODES - 1;
+  }
+  return strcmp(opcode, stat_opcodes[i]) == 0 ? i : STATS_NUM_OPCODES - 1;
+}
+
+const char*
+APEX_opcode_name(int index)
+{
+  return index < STATS_NUM_OPCODES - 1 ? stat_opcodes[index] : "other";
+}
+
+static void
+count_retired(APEX_Pipeline_Stats* stats, const char* opcode)
+{
+  APEX_stat_inc(stats->retired[APEX_opcode_index(opcode)]);
+}
+
+static int
+writes_register(const char* opcode)
+{
+  return strcmp(opcode, "ADD") == 0 || strcmp(opcode, "SUB") == 0 || strcmp(opcode, "MUL") == 0 ||
+         strcmp(opcode, "AND") == 0 || strcmp(opcode, "OR") == 0 ||
+         strcmp(opcode, "EX-OR") == 0 || strcmp(opcode, "LOAD") == 0 ||
+         strcmp(opcode, "MOVC") == 0;
+}
+
+/*
+ * Youngest instruction past decode writing reg, or the zero flag for
+ * STALL_REG_ZERO, NULL if none. Called from decode: the stages after it
+ * have moved on this cycle, so execute only holds its own instruction
+ * while stalled.
+ */
+static CPU_Stage*
+in_flight_producer(APEX_CPU* cpu, int reg)
+{
+  for (int i = cpu->stage[EX].stalled ? EX : MEM; i <= WB; ++i) {
+    CPU_Stage* stage = &cpu->stage[i];
+    if (reg == STALL_REG_ZERO ? strcmp(stage->opcode, "ADD") == 0 ||
+                                    strcmp(stage->opcode, "SUB") == 0 ||
+                                    strcmp(stage->opcode, "MUL") == 0
+                              : stage->rd == reg && writes_register(stage->opcode)) {
+      return stage;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Logs the cycle the instruction in decode stalls for cause, with the
+ * operand it waits for. Of two in-flight producers a LOAD is the one
+ * forwarding cannot cover.
+ */
+static void
+log_decode_stall(APEX_CPU* cpu, CPU_Stage* stage, int cause)
+{
+  int reg = STALL_REG_NONE;
+  CPU_Stage* producer = NULL;
+  if (cause == CPI_BRANCH_Z) {
+    reg = STALL_REG_ZERO;
+    producer = in_flight_producer(cpu, reg);
+  } else {
+    int sources[2] = { -1, -1 };
+    if (strcmp(stage->opcode, "LOAD") == 0 || strcmp(stage->opcode, "JUMP") == 0) {
+      sources[0] = stage->rs1;
+    } else if (strcmp(stage->opcode, "MOVC") != 0) {
+      sources[0] = stage->rs1;
+      sources[1] = stage->rs2;
+    }
+    for (int i = 0; i < 2; ++i) {
+      CPU_Stage* found = sources[i] < 0 ? NULL : in_flight_producer(cpu, sources[i]);
+      if (found && (!producer || (cpu->enable_data_forwarding && strcmp(found->opcode, "LOAD") == 0 &&
+                                  strcmp(producer->opcode, "LOAD") != 0))) {
+        reg = sources[i];
+        producer = found;
+      }
+    }
+  }
+  APEX_stall_log_event(cpu->stall_log, cpu->clock, stage->pc, cause, reg,
+                       producer ? producer->pc : -1);
+}
+
+/* Logs the cycle the instruction in decode waits behind the MUL in execute */
+static void
+log_mul_stall(APEX_CPU* cpu, CPU_Stage* mul)
+{
+  CPU_Stage* stage = &cpu->stage[DRF];
+  if (!stage->busy && stage->opcode[0] != '\0' && stage->opcode[0] != 'N') {
+    APEX_stall_log_event(cpu->stall_log, cpu->clock, stage->pc, CPI_MUL, STALL_REG_NONE, mul->pc);
+  }
+}
+
+/* Traces the instruction writeback retires, with what it depends on */
+static void
+trace_retired(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  int flags = APEX_opcode_flags(stage->opcode);
+  int load = strcmp(stage->opcode, "LOAD") == 0;
+  int store = strcmp(stage->opcode, "STORE") == 0;
+  int branch = strcmp(stage->opcode, "BZ") == 0 || strcmp(stage->opcode, "BNZ") == 0;
+  APEX_Retired retired;
+  retired.cycle = cpu->clock;
+  retired.pc = stage->pc;
+  retired.address = load || store ? stage->mem_address : -1;
+  retired.opcode = APEX_opcode_index(stage->opcode);
+  retired.flags = (flags & SETS_ZERO ? RETIRE_SETS_ZERO : 0) |
+                  (branch ? RETIRE_READS_ZERO | RETIRE_CONTROL : 0) |
+                  (strcmp(stage->opcode, "JUMP") == 0 ? RETIRE_CONTROL : 0) |
+                  (load ? RETIRE_LOAD : 0) | (store ? RETIRE_STORE : 0);
+  /* A LOAD reads memory after execute, a MUL holds it for mul_latency */
+  retired.latency = load ? 2 : strcmp(stage->opcode, "MUL") == 0 ? cpu->mul_latency : 1;
+  retired.rd = flags & WRITES_RD ? stage->rd : -1;
+  retired.rs1 = flags & READS_RS1 ? stage->rs1 : -1;
+  retired.rs2 = flags & READS_RS2 ? stage->rs2 : -1;
+  retired.pad = 0;
+  APEX_retire_trace_write(cpu->retire_trace, &retired);
+}
+
+/*
+ * Sends a bubble from decode to execute for the instruction stalled in
+ * decode. With forwarding only a LOAD in execute or the zero flag stall it.
+ */
+static void
+insert_decode_bubble(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  CPU_Stage nop;
+  Create_NOP(cpu, &nop);
+  if (strcmp(stage->opcode, "BZ") == 0 || strcmp(stage->opcode, "BNZ") == 0) {
+    nop.bubble = CPI_BRANCH_Z;
+  } else {
+    nop.bubble = cpu->enable_data_forwarding ? CPI_LOAD_USE : CPI_RAW;
+  }
+  nop.bubble_pc = stage->pc;
+  cpu->stage[EX] = nop;
+  if (cpu->stall_log) {
+    log_decode_stall(cpu, stage, nop.bubble);
+  }
+}
+
+/*
+ * Counts the cycle for the instructions in decode and writeback when
+ * profiling: one retiring, or the one the bubble in writeback was
+ * inserted for. Every cycle, so plain index checks.
+ */
+static void
+profile_cycle(APEX_CPU* cpu, CPU_Stage* stage)
+{
+  APEX_Profile* profile = cpu->profile;
+  CPU_Stage* decoding = &cpu->stage[DRF];
+  unsigned index = (unsigned)(decoding->pc - 4000) >> 2;
+  if (!decoding->busy && decoding->opcode[0] != '\0' && decoding->opcode[0] != 'N' &&
+      index < (unsigned)profile->size) {
+    profile->pcs[index].decode_cycles++;
+  }
+
+  if (!stage->busy && !stage->stalled && stage->opcode[0] != 'N') {
+    index = (unsigned)(stage->pc - 4000) >> 2;
+    if (index < (unsigned)profile->size) {
+      profile->pcs[index].executions++;
+    }
+  } else if (stage->bubble != CPI_FILL) {
+    index = (unsigned)(stage->bubble_pc - 4000) >> 2;
+    if (index < (unsigned)profile->size) {
+      profile->pcs[index].stalls[stage->bubble]++;
+    }
+  }
+}
+
+/* The branch or JUMP at pc squashes the instructions fetched after it */
+static void
+profile_flush(APEX_CPU* cpu, int pc)
+{
+  APEX_Pc_Profile* counters = APEX_profile_at(cpu->profile, pc);
+  if (counters) {
+    counters->flushes++;
+  }
+}
+
+/* Classifies the latch each stage works on this cycle */
+static void
+count_stages(APEX_CPU* cpu)
+{
+  APEX_Pipeline_Stats* stats = cpu->stats;
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    /* Every cycle, so plain increments. Only NOP starts with N */
+    CPU_Stage* stage = &cpu->stage[i];
+    if (stage->stalled) {
+      stats->stalled[i]->count++;
+    } else if (stage->busy || (i != F && (stage->opcode[0] == '\0' || stage->opcode[0] == 'N'))) {
+      stats->bubble[i]->count++;
+    } else {
+      stats->busy[i]->count++;
+    }
+  }
+  if (cpu->stage[DRF].stalled) {
+    stats->decode_stall_run++;
+  } else if (stats->decode_stall_run) {
+    APEX_stat_sample(stats->decode_stall_length, stats->decode_stall_run);
+    stats->decode_stall_run = 0;
+  }
+}
+
+
 /*
  *  Fetch Stage of APEX Pipeline
  *
@@ -201,7 +634,7 @@ fetch(APEX_CPU* cpu)
     /* Index into code memory using this pc and copy all instruction fields into
      * fetch latch
      */
-    APEX_Instruction* current_ins = &cpu->code_memory[get_code_index(cpu->pc)];
+    const APEX_Instruction* current_ins = APEX_code_at(cpu, get_code_index(cpu->pc));
 
     strcpy(stage->opcode, current_ins->opcode);
     stage->rd = current_ins->rd;
@@ -209,6 +642,15 @@ fetch(APEX_CPU* cpu)
     stage->rs2 = current_ins->rs2;
     stage->imm = current_ins->imm;
     stage->rd = current_ins->rd;
+    stage->dep_rs1 = current_ins->dep_rs1;
+    stage->dep_rs2 = current_ins->dep_rs2;
+    stage->dep_z = current_ins->dep_z;
+    stage->bubble = CPI_NOP;
+    stage->bubble_pc = stage->pc;
+    stage->stage_cycle[F] = cpu->clock;
+    for (int i = DRF; i < NUM_STAGES; ++i) {
+      stage->stage_cycle[i] = -1;
+    }
 
     /* Update PC for next instruction */
     cpu->pc += 4;
@@ -251,6 +693,8 @@ decode(APEX_CPU* cpu)
   CPU_Stage *stage = &cpu->stage[DRF];
 
   if (!stage->busy && !stage->stalled) {
+    /* Destination status before this instruction claims it, restored if it cannot leave decode */
+    int rd_valid = stage->rd >= 0 ? cpu->regs_valid[stage->rd] : 1;
 
     /* Read data from register file for store */
 
@@ -263,9 +707,10 @@ decode(APEX_CPU* cpu)
         stage->rs1_value = cpu->regs[stage->rs1];
         stage->rs2_value = cpu->regs[stage->rs2];
         cpu->regs_valid[stage->rd] = 0;
-      } else if(ENABLE_DATA_FORWARDING){
+      } else if(cpu->enable_data_forwarding){
         //check if load is in the ex. Wait for it to go to memory in that case.
-        if(strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1 || cpu->stage[EX].rd == stage->rs2)){
+        //Only the instruction right before can be in ex, skip the opcode test unless it produces a source.
+        if((stage->dep_rs1 == 1 || stage->dep_rs2 == 1) && strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1 || cpu->stage[EX].rd == stage->rs2)){
           stage->stalled=1;
         } else {
 
@@ -274,9 +719,11 @@ decode(APEX_CPU* cpu)
 
           if (!cpu->regs_valid[stage->rs1]) {
             stage->rs1_value = cpu->regs_forwarding[stage->rs1];
+            count_forwarded(cpu);
           }
           if (!cpu->regs_valid[stage->rs2]) {
             stage->rs2_value = cpu->regs_forwarding[stage->rs2];
+            count_forwarded(cpu);
           }
           cpu->regs_valid[stage->rd] = 0;
         }
@@ -288,15 +735,16 @@ decode(APEX_CPU* cpu)
       if (cpu->regs_valid[stage->rs1]) {
         stage->rs1_value = cpu->regs[stage->rs1];
         cpu->regs_valid[stage->rd] = 0;
-      } else if(ENABLE_DATA_FORWARDING){
+      } else if(cpu->enable_data_forwarding){
         //check if load is in the ex. Wait for it to go to memory in that case.
-        if(strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1)){
+        if(stage->dep_rs1 == 1 && strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1)){
           stage->stalled=1;
         } else {
           stage->rs1_value = cpu->regs[stage->rs1];
 
           if (!cpu->regs_valid[stage->rs1]) {
             stage->rs1_value = cpu->regs_forwarding[stage->rs1];
+            count_forwarded(cpu);
           }
           cpu->regs_valid[stage->rd] = 0;
         }
@@ -307,9 +755,9 @@ decode(APEX_CPU* cpu)
       if (cpu->regs_valid[stage->rs1] && cpu->regs_valid[stage->rs2]) {
         stage->rs1_value = cpu->regs[stage->rs1];
         stage->rs2_value = cpu->regs[stage->rs2];
-      }  else if(ENABLE_DATA_FORWARDING){
+      }  else if(cpu->enable_data_forwarding){
         //check if load is in the ex. Wait for it to go to memory in that case.
-        if(strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1 || cpu->stage[EX].rd == stage->rs2)){
+        if((stage->dep_rs1 == 1 || stage->dep_rs2 == 1) && strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1 || cpu->stage[EX].rd == stage->rs2)){
           stage->stalled=1;
         } else {
 
@@ -318,14 +766,16 @@ decode(APEX_CPU* cpu)
 
           if (!cpu->regs_valid[stage->rs1]) {
             stage->rs1_value = cpu->regs_forwarding[stage->rs1];
+            count_forwarded(cpu);
           }
           if (!cpu->regs_valid[stage->rs2]) {
             stage->rs2_value = cpu->regs_forwarding[stage->rs2];
+            count_forwarded(cpu);
           }
           cpu->regs_valid[stage->rd] = 0;
         }
       }
-//      else if(ENABLE_DATA_FORWARDING){
+//      else if(cpu->enable_data_forwarding){
 //        //check if load is in the ex and the second source(address) of store is same as destination of load. stall in that case.
 //        if(strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs2)){
 //          stage->stalled=1;
@@ -349,24 +799,25 @@ decode(APEX_CPU* cpu)
     else if (strcmp(stage->opcode, "MOVC") == 0) {
       cpu->regs_valid[stage->rd] = 0;
     } else if (strcmp(stage->opcode, "BZ") == 0) {
-      if(!ENABLE_DATA_FORWARDING){
+      if(!cpu->enable_data_forwarding){
         stage->stalled = 1;
       }
     } else if (strcmp(stage->opcode, "BNZ") == 0) {
-      if(!ENABLE_DATA_FORWARDING){
+      if(!cpu->enable_data_forwarding){
         stage->stalled = 1;
       }
     } else if (strcmp(stage->opcode, "JUMP") == 0) {
       if (cpu->regs_valid[stage->rs1]) {
         stage->rs1_value = cpu->regs[stage->rs1];
-      }else if(ENABLE_DATA_FORWARDING){
+      }else if(cpu->enable_data_forwarding){
         //check if load is in the ex
-        if(strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1)){
+        if(stage->dep_rs1 == 1 && strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1)){
           stage->stalled=1;
         } else {
           stage->rs1_value = cpu->regs[stage->rs1];
           if (!cpu->regs_valid[stage->rs1]) {
             stage->rs1_value = cpu->regs_forwarding[stage->rs1];
+            count_forwarded(cpu);
           }
         }
       } else {
@@ -374,6 +825,7 @@ decode(APEX_CPU* cpu)
       }
 
     } else if (strcmp(stage->opcode, "HALT") == 0) {
+    } else if (strcmp(stage->opcode, "ROI_BEGIN") == 0 || strcmp(stage->opcode, "ROI_END") == 0) {
     } else if (strcmp(stage->opcode, "NOP") == 0) {
     } else if (strcmp(stage->opcode, "") == 0) {
 
@@ -382,11 +834,14 @@ decode(APEX_CPU* cpu)
     /* Copy data from decode latch to execute latch*/
 
     if (cpu->stage[EX].stalled) {
+      /* Decode is retried once execute frees up. Don't leave the destination
+       * claimed meanwhile, an instruction like SUB R1,R1,R2 would wait on itself */
+      if (stage->rd >= 0) {
+        cpu->regs_valid[stage->rd] = rd_valid;
+      }
       stage->stalled = 1;
     } else if (stage->stalled) {
-      CPU_Stage nop;
-      Create_NOP(cpu, &nop);
-      cpu->stage[EX] = nop;
+      insert_decode_bubble(cpu, stage);
     } else {
       cpu->stage[EX] = cpu->stage[DRF];
     }
@@ -405,23 +860,23 @@ decode(APEX_CPU* cpu)
           stage->rs2_value = cpu->regs[stage->rs2];
           cpu->regs_valid[stage->rd] = 0;
           cpu->stage[EX] = cpu->stage[DRF];
-        }else if(ENABLE_DATA_FORWARDING){
+        }else if(cpu->enable_data_forwarding){
 
           stage->stalled = 0;
           stage->rs1_value = cpu->regs[stage->rs1];
           stage->rs2_value = cpu->regs[stage->rs2];
           if(!cpu->regs_valid[stage->rs1]){
             stage->rs1_value=cpu->regs_forwarding[stage->rs1];
+            count_forwarded(cpu);
           }
           if(!cpu->regs_valid[stage->rs2]){
             stage->rs2_value=cpu->regs_forwarding[stage->rs2];
+            count_forwarded(cpu);
           }
           cpu->regs_valid[stage->rd] = 0;
           cpu->stage[EX] = cpu->stage[DRF];
         }else {
-          CPU_Stage nop;
-          Create_NOP(cpu, &nop);
-          cpu->stage[EX] = nop;
+          insert_decode_bubble(cpu, stage);
         }
       } else if (strcmp(stage->opcode, "LOAD") == 0) {
         /* Check if Source is valid. If not check if forwrding possible. if not stall.*/
@@ -430,13 +885,11 @@ decode(APEX_CPU* cpu)
           cpu->regs_valid[stage->rd] = 0;
           stage->rs1_value = cpu->regs[stage->rs1];
           cpu->stage[EX] = cpu->stage[DRF];
-        }else if(ENABLE_DATA_FORWARDING){
+        }else if(cpu->enable_data_forwarding){
           //check if load is in the ex. Wait for it to go to memory in that case.
-          if(strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1)){
+          if(stage->dep_rs1 == 1 && strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1)){
             stage->stalled=1;
-            CPU_Stage nop;
-            Create_NOP(cpu, &nop);
-            cpu->stage[EX] = nop;
+            insert_decode_bubble(cpu, stage);
           } else {
             /*Fetch the source from forwarding logic*/
             stage->stalled = 0;
@@ -444,14 +897,13 @@ decode(APEX_CPU* cpu)
 
             if (!cpu->regs_valid[stage->rs1]) {
               stage->rs1_value = cpu->regs_forwarding[stage->rs1];
+              count_forwarded(cpu);
             }
             cpu->regs_valid[stage->rd] = 0;
             cpu->stage[EX] = cpu->stage[DRF];
           }
         }else {
-          CPU_Stage nop;
-          Create_NOP(cpu, &nop);
-          cpu->stage[EX] = nop;
+          insert_decode_bubble(cpu, stage);
         }
       } else if (strcmp(stage->opcode, "STORE") == 0) {
         /* Check if Sources are valid. If not check if forwrding possible. if not stall.*/
@@ -461,13 +913,11 @@ decode(APEX_CPU* cpu)
           stage->rs2_value = cpu->regs[stage->rs2];
           cpu->stage[EX] = cpu->stage[DRF];
         }
-        else if(ENABLE_DATA_FORWARDING){
+        else if(cpu->enable_data_forwarding){
           //check if load is in the ex. Wait for it to go to memory in that case.
-          if(strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1 || cpu->stage[EX].rd == stage->rs2)){
+          if((stage->dep_rs1 == 1 || stage->dep_rs2 == 1) && strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1 || cpu->stage[EX].rd == stage->rs2)){
             stage->stalled=1;
-            CPU_Stage nop;
-            Create_NOP(cpu, &nop);
-            cpu->stage[EX] = nop;
+            insert_decode_bubble(cpu, stage);
           } else {
             /*Fetch the sources from forwarding logic*/
             stage->stalled = 0;
@@ -476,14 +926,16 @@ decode(APEX_CPU* cpu)
 
             if (!cpu->regs_valid[stage->rs1]) {
               stage->rs1_value = cpu->regs_forwarding[stage->rs1];
+              count_forwarded(cpu);
             }
             if (!cpu->regs_valid[stage->rs2]) {
               stage->rs2_value = cpu->regs_forwarding[stage->rs2];
+              count_forwarded(cpu);
             }
             cpu->stage[EX] = cpu->stage[DRF];
           }
         }
-//        else if(ENABLE_DATA_FORWARDING){
+//        else if(cpu->enable_data_forwarding){
 //          //check if load is in the ex and the second source(address) of store is same as destination of load. stall in that case.
 //          if(strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs2)){
 //            stage->stalled=1;
@@ -506,9 +958,7 @@ decode(APEX_CPU* cpu)
 //          }
 //        }
         else {
-          CPU_Stage nop;
-          Create_NOP(cpu, &nop);
-          cpu->stage[EX] = nop;
+          insert_decode_bubble(cpu, stage);
         }
       } else if (strcmp(stage->opcode, "MOVC") == 0) {
         /*No Source. No overhead*/
@@ -517,31 +967,29 @@ decode(APEX_CPU* cpu)
         cpu->stage[EX] = cpu->stage[DRF];
       } else if (strcmp(stage->opcode, "BZ") == 0) {
         /* Check for nearest Arithmetic instruction. This will ignore any other instructions. e.g And,Load*/
-        if (strcmp(cpu->stage[EX].opcode, "ADD") == 0 || strcmp(cpu->stage[EX].opcode, "SUB") == 0 ||
+        /* None within the last DEP_WINDOW instructions means none in EX/MEM/WB */
+        if (stage->dep_z && (strcmp(cpu->stage[EX].opcode, "ADD") == 0 || strcmp(cpu->stage[EX].opcode, "SUB") == 0 ||
             strcmp(cpu->stage[EX].opcode, "MUL") == 0 || strcmp(cpu->stage[MEM].opcode, "ADD") == 0 ||
             strcmp(cpu->stage[MEM].opcode, "SUB") == 0 || strcmp(cpu->stage[MEM].opcode, "MUL") == 0 ||
             strcmp(cpu->stage[WB].opcode, "ADD") == 0 || strcmp(cpu->stage[WB].opcode, "SUB") == 0 ||
-            strcmp(cpu->stage[WB].opcode, "MUL") == 0)
+            strcmp(cpu->stage[WB].opcode, "MUL") == 0))
         {
           stage->stalled = 1;
-          CPU_Stage nop;
-          Create_NOP(cpu, &nop);
-          cpu->stage[EX] = nop;
+          insert_decode_bubble(cpu, stage);
         } else {
           stage->stalled = 0;
           cpu->stage[EX] = cpu->stage[DRF];
         }
       } else if (strcmp(stage->opcode, "BNZ") == 0) {
         /* Check for nearest Arithmetic instruction. This will ignore any other instructions. e.g And,Load*/
-        if (strcmp(cpu->stage[EX].opcode, "ADD") == 0 || strcmp(cpu->stage[EX].opcode, "SUB") == 0 ||
+        /* None within the last DEP_WINDOW instructions means none in EX/MEM/WB */
+        if (stage->dep_z && (strcmp(cpu->stage[EX].opcode, "ADD") == 0 || strcmp(cpu->stage[EX].opcode, "SUB") == 0 ||
             strcmp(cpu->stage[EX].opcode, "MUL") == 0 || strcmp(cpu->stage[MEM].opcode, "ADD") == 0 ||
             strcmp(cpu->stage[MEM].opcode, "SUB") == 0 || strcmp(cpu->stage[MEM].opcode, "MUL") == 0 ||
             strcmp(cpu->stage[WB].opcode, "ADD") == 0 || strcmp(cpu->stage[WB].opcode, "SUB") == 0 ||
-            strcmp(cpu->stage[WB].opcode, "MUL") == 0) {
+            strcmp(cpu->stage[WB].opcode, "MUL") == 0)) {
           stage->stalled = 1;
-          CPU_Stage nop;
-          Create_NOP(cpu, &nop);
-          cpu->stage[EX] = nop;
+          insert_decode_bubble(cpu, stage);
         } else {
           stage->stalled = 0;
           cpu->stage[EX] = cpu->stage[DRF];
@@ -552,29 +1000,27 @@ decode(APEX_CPU* cpu)
           stage->rs1_value = cpu->regs[stage->rs1];
           cpu->stage[EX] = cpu->stage[DRF];
 
-        } else if(ENABLE_DATA_FORWARDING){
+        } else if(cpu->enable_data_forwarding){
           /*check if load is in the ex and has a dependency on source. Stall in that case. Else read the value for forwarding mechanism*/
-          if(strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1)){
+          if(stage->dep_rs1 == 1 && strcmp(cpu->stage[EX].opcode,"LOAD")==0 && ( cpu->stage[EX].rd == stage->rs1)){
             stage->stalled = 1;
-            CPU_Stage nop;
-            Create_NOP(cpu, &nop);
-            cpu->stage[EX] = nop;
+            insert_decode_bubble(cpu, stage);
           } else {
             stage->stalled = 0;
             stage->rs1_value = cpu->regs[stage->rs1];
             if (!cpu->regs_valid[stage->rs1]) {
               stage->rs1_value = cpu->regs_forwarding[stage->rs1];
+              count_forwarded(cpu);
             }
             cpu->stage[EX] = cpu->stage[DRF];
           }
         } else {
           stage->stalled = 1;
-          CPU_Stage nop;
-          Create_NOP(cpu, &nop);
-          cpu->stage[EX] = nop;
+          insert_decode_bubble(cpu, stage);
 
         }
-      } else if (strcmp(stage->opcode, "HALT") == 0) {
+      } else if (strcmp(stage->opcode, "HALT") == 0 || strcmp(stage->opcode, "ROI_BEGIN") == 0 ||
+                 strcmp(stage->opcode, "ROI_END") == 0) {
         stage->stalled = 0;
         cpu->stage[EX] = cpu->stage[DRF];
       }else if (strcmp(stage->opcode, "") == 0) {
@@ -604,7 +1050,7 @@ execute(APEX_CPU* cpu)
     /* Calculate. Update zero flag. Update forwarding value*/
     if (strcmp(stage->opcode, "ADD") == 0) {
       stage->buffer=stage->rs1_value+stage->rs2_value;
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
         cpu->zero_flag = stage->buffer == 0 ? 1 : 0;
       }
@@ -612,7 +1058,7 @@ execute(APEX_CPU* cpu)
       /* Calculate. Update zero flag. Update forwarding value*/
     else if (strcmp(stage->opcode, "SUB") == 0) {
       stage->buffer=stage->rs1_value-stage->rs2_value;
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
         cpu->zero_flag = stage->buffer == 0 ? 1 : 0;
       }
@@ -623,22 +1069,28 @@ execute(APEX_CPU* cpu)
       /* Store. Check if next instruction is load and if it's source 1(value to be added) is potential forwarding candidate */
     else if (strcmp(stage->opcode, "STORE") == 0) {
       stage->mem_address=stage->rs2_value+stage->imm;
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         if(strcmp(cpu->stage[MEM].opcode,"LOAD")==0 && cpu->stage[MEM].rd == stage->rs1){
           stage->rs1_value=cpu->regs_forwarding[stage->rs1];
+          count_forwarded(cpu);
         }
       }
     }
-      /* Calculate. Stall for this cycle. Will take care of it in next.*/
+      /* Calculate. Stall for the remaining cycles of the multiply. Will take care of it in next.*/
     else if(strcmp(stage->opcode,"MUL")==0){
       stage->buffer=stage->rs1_value*stage->rs2_value;
-      stage->stalled=1;
-
+      if(cpu->mul_latency > 1){
+        stage->stalled=1;
+        stage->cycles_left=cpu->mul_latency - 1;
+      } else if(cpu->enable_data_forwarding){
+        cpu->regs_forwarding[stage->rd]=stage->buffer;
+        cpu->zero_flag = stage->buffer == 0 ? 1 : 0;
+      }
     }
       /* Calculate. Update forwarding value*/
     else if (strcmp(stage->opcode, "MOVC") == 0) {
       stage->buffer=stage->imm + 0;
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
 
@@ -646,7 +1098,7 @@ execute(APEX_CPU* cpu)
       /* Calculate. Update forwarding value*/
     else if (strcmp(stage->opcode, "AND") == 0) {
       stage->buffer=stage->rs1_value & stage->rs2_value;
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
 
@@ -654,14 +1106,14 @@ execute(APEX_CPU* cpu)
       /* Calculate. Update forwarding value*/
     else if (strcmp(stage->opcode, "OR") == 0) {
       stage->buffer=stage->rs1_value | stage->rs2_value;
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
       /* Calculate. Update forwarding value*/
     else if (strcmp(stage->opcode, "EX-OR") == 0) {
       stage->buffer=stage->rs1_value ^ stage->rs2_value;
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
@@ -675,10 +1127,12 @@ execute(APEX_CPU* cpu)
     else if(strcmp(stage->opcode,"JUMP")==0){
       stage->buffer=stage->rs1_value+stage->imm;
     }
-    /*Make all previous instructions nop.*/
-    else if(strcmp(stage->opcode,"HALT")==0){
+    /*Make all previous instructions nop. ROI_END drains the pipeline the same way*/
+    else if(strcmp(stage->opcode,"HALT")==0 || strcmp(stage->opcode,"ROI_END")==0){
       CPU_Stage nopStage;
       Create_NOP(cpu,&nopStage);
+      nopStage.bubble=CPI_DRAIN;
+      nopStage.bubble_pc=stage->pc;
       cpu->stage[DRF] = nopStage;
       cpu->stage[F] = nopStage;
       cpu->stage[F].stalled=1;
@@ -692,7 +1146,12 @@ execute(APEX_CPU* cpu)
     } else {
       CPU_Stage nopStage;
       Create_NOP(cpu,&nopStage);
+      nopStage.bubble=CPI_MUL;
+      nopStage.bubble_pc=stage->pc;
       cpu->stage[MEM] = nopStage;
+      if (cpu->stall_log) {
+        log_mul_stall(cpu, stage);
+      }
     }
 
     if (ENABLE_DEBUG_MESSAGES) {
@@ -700,10 +1159,25 @@ execute(APEX_CPU* cpu)
     }
 
   }
+  else if(stage->stalled && --stage->cycles_left > 0){
+    /* Multiplication still occupies the stage. Keep sending Nop to memory*/
+    CPU_Stage nopStage;
+    Create_NOP(cpu,&nopStage);
+    nopStage.bubble=CPI_MUL;
+    nopStage.bubble_pc=stage->pc;
+    cpu->stage[MEM] = nopStage;
+    if (cpu->stall_log) {
+      log_mul_stall(cpu, stage);
+    }
+    if (ENABLE_DEBUG_MESSAGES) {
+      print_stage_content("Execute", stage);
+    }
+  }
   else if(stage->stalled){
     /* Will only come here in case of Multiplication instruction. Update forwarding value. Update Zero flag*/
     stage->stalled=0;
-    if(ENABLE_DATA_FORWARDING){
+    /* A NOP held by a drain ends up here too, it has no destination */
+    if(cpu->enable_data_forwarding && stage->rd >= 0){
       cpu->regs_forwarding[stage->rd]=stage->buffer;
       cpu->zero_flag = stage->buffer == 0 ? 1 : 0;
     }
@@ -730,21 +1204,24 @@ memory(APEX_CPU* cpu)
 
     /* Update forwarding value.*/
     if (strcmp(stage->opcode, "ADD") == 0) {
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
       /* Update forwarding value.*/
     else if (strcmp(stage->opcode, "SUB") == 0) {
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
       /* Load the data in buffer from memory. Update forwarding value.*/
     else if(strcmp(stage->opcode,"LOAD")==0){
       stage->buffer=cpu->data_memory[stage->mem_address];
+      if (cpu->mem_trace) {
+        APEX_mem_trace_access(cpu->mem_trace, cpu->clock, stage->pc, stage->mem_address, 0);
+      }
 
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
 
@@ -752,34 +1229,38 @@ memory(APEX_CPU* cpu)
       /* Store. Insert Source 1 into the Memory. */
     else if (strcmp(stage->opcode, "STORE") == 0) {
       cpu->data_memory[stage->mem_address]=stage->rs1_value;
+      cpu->dirty_pages[stage->mem_address / DATA_PAGE_SIZE] = 1;
+      if (cpu->mem_trace) {
+        APEX_mem_trace_access(cpu->mem_trace, cpu->clock, stage->pc, stage->mem_address, 1);
+      }
     }
       /* Update forwarding value.*/
     else if (strcmp(stage->opcode, "MUL") == 0) {
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
       /* Update forwarding value.*/
     else if (strcmp(stage->opcode, "MOVC") == 0) {
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
       /* Update forwarding value.*/
     else if (strcmp(stage->opcode, "AND") == 0) {
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
       /* Update forwarding value.*/
     else if (strcmp(stage->opcode, "OR") == 0) {
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
       /* Update forwarding value.*/
     else if (strcmp(stage->opcode, "EX-OR") == 0) {
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
@@ -789,10 +1270,18 @@ memory(APEX_CPU* cpu)
       if(cpu->zero_flag){
         //Branch taken when zero-flag is reset.
         cpu->pc=stage->pc + stage->imm;
+        cpu->redirects++;
+        if (cpu->profile) {
+          profile_flush(cpu, stage->pc);
+        }
         CPU_Stage nopStage;
         Create_NOP(cpu,&nopStage);
+        nopStage.bubble=CPI_FLUSH;
+        nopStage.bubble_pc=stage->pc;
         cpu->stage[DRF] = nopStage;
-        cpu->regs_valid[cpu->stage[EX].rd]=1;
+        if(cpu->stage[EX].rd >= 0){
+          cpu->regs_valid[cpu->stage[EX].rd]=1;
+        }
         cpu->stage[EX]=nopStage;
       } else{
         //Branch Not Taken. Continue with execution;
@@ -802,10 +1291,18 @@ memory(APEX_CPU* cpu)
       if(!cpu->zero_flag){
         //branch taken when zero-flag is set.
         cpu->pc=stage->pc + stage->imm;
+        cpu->redirects++;
+        if (cpu->profile) {
+          profile_flush(cpu, stage->pc);
+        }
         CPU_Stage nopStage;
         Create_NOP(cpu,&nopStage);
+        nopStage.bubble=CPI_FLUSH;
+        nopStage.bubble_pc=stage->pc;
         cpu->stage[DRF] = nopStage;
-        cpu->regs_valid[cpu->stage[EX].rd]=1;
+        if(cpu->stage[EX].rd >= 0){
+          cpu->regs_valid[cpu->stage[EX].rd]=1;
+        }
         cpu->stage[EX]=nopStage;
       } else{
         //Branch Not Taken. Continue with execution;
@@ -814,20 +1311,32 @@ memory(APEX_CPU* cpu)
       /* Free up destinations of DRF and EX. Set counter to new PC. Insert nop in previous 2.*/
     else if(strcmp(stage->opcode,"JUMP")==0){
       cpu->pc=stage->buffer;
+      cpu->redirects++;
+      if (cpu->profile) {
+        profile_flush(cpu, stage->pc);
+      }
 
-      cpu->regs_valid[cpu->stage[DRF].rd]=1;
-      cpu->regs_valid[cpu->stage[EX].rd]=1;
+      if(cpu->stage[DRF].rd >= 0){
+        cpu->regs_valid[cpu->stage[DRF].rd]=1;
+      }
+      if(cpu->stage[EX].rd >= 0){
+        cpu->regs_valid[cpu->stage[EX].rd]=1;
+      }
 
       CPU_Stage nopStage;
       Create_NOP(cpu,&nopStage);
+      nopStage.bubble=CPI_FLUSH;
+      nopStage.bubble_pc=stage->pc;
       cpu->stage[DRF] = nopStage;
       cpu->stage[F] = nopStage;
       cpu->stage[EX] = nopStage;
     }
       /*Insert NOP in previous stage and stall it.*/
-    else if(strcmp(stage->opcode,"HALT")==0){
+    else if(strcmp(stage->opcode,"HALT")==0 || strcmp(stage->opcode,"ROI_END")==0){
       CPU_Stage nopStage;
       Create_NOP(cpu,&nopStage);
+      nopStage.bubble=CPI_DRAIN;
+      nopStage.bubble_pc=stage->pc;
       cpu->stage[EX] = nopStage;
       cpu->stage[EX].stalled=1;
     }
@@ -863,7 +1372,7 @@ writeback(APEX_CPU* cpu)
       //cpu->regs_valid[stage->rd]=1;
       cpu->zero_flag = stage->buffer == 0 ? 1 : 0;
 
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
@@ -874,7 +1383,7 @@ writeback(APEX_CPU* cpu)
 
       //cpu->regs_valid[stage->rd]=1;
 
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
@@ -885,7 +1394,7 @@ writeback(APEX_CPU* cpu)
 
       //cpu->regs_valid[stage->rd]=1;
 
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
@@ -900,7 +1409,7 @@ writeback(APEX_CPU* cpu)
       Free_Destination_After_CheckingApe(cpu);
 
       //cpu->regs_valid[stage->rd]=1;
-      if(ENABLE_DATA_FORWARDING){
+      if(cpu->enable_data_forwarding){
         cpu->regs_forwarding[stage->rd]=stage->buffer;
       }
     }
@@ -911,18 +1420,118 @@ writeback(APEX_CPU* cpu)
       cpu->pc=cpu->pc+12000;
       CPU_Stage nopStage;
       Create_NOP(cpu,&nopStage);
+      nopStage.bubble=CPI_DRAIN;
+      nopStage.bubble_pc=stage->pc;
       cpu->stage[MEM] = nopStage;
       cpu->stage[MEM].stalled=1;
     }
     else if(strcmp(stage->opcode,"JUMP")==0){
+    }
+      /* Everything older has retired. Leave the region and continue after the marker*/
+    else if(strcmp(stage->opcode,"ROI_END")==0){
+      cpu->pc=stage->pc+4;
+      cpu->in_roi=0;
+      cpu->pipeline_drained=1;
+      CPU_Stage nopStage;
+      Create_NOP(cpu,&nopStage);
+      nopStage.bubble=CPI_DRAIN;
+      nopStage.bubble_pc=stage->pc;
+      cpu->stage[MEM] = nopStage;
+      cpu->stage[MEM].stalled=1;
     }
 
-    if(strcmp(stage->opcode,"NOP")!=0)
+    if(strcmp(stage->opcode,"NOP")!=0) {
       cpu->ins_completed++;
+      cpu->cpi_cycles[CPI_BASE]++;
+      if (cpu->stats) {
+        count_retired(cpu->stats, stage->opcode);
+      }
+      if (cpu->window) {
+        APEX_window_retired(cpu->window, stage->opcode);
+      }
+      if (cpu->retire_trace) {
+        trace_retired(cpu, stage);
+      }
+    } else {
+      cpu->cpi_cycles[stage->bubble]++;
+    }
+    if (cpu->cpi_region && !cpu->in_roi) {
+      APEX_cpi_region_exit(cpu);
+    }
 
     if (ENABLE_DEBUG_MESSAGES) {
       print_stage_content("Writeback", stage);
     }
+  } else {
+    /* Still filling, or held by a drain */
+    cpu->cpi_cycles[stage->bubble]++;
+  }
+  return 0;
+}
+
+/* Moves the PC past the end of the code so that APEX_cpu_halted holds */
+static void
+roi_end_program(APEX_CPU* cpu)
+{
+  cpu->pc = cpu->code_memory_size * 4 + 4000 + 16;
+}
+
+/*
+ * Executes functionally from cpu->pc up to the next ROI_BEGIN, consumes it
+ * and empties the pipeline to simulate the region in detail. Stops early
+ * when the program ends or the cycle limit's worth of instructions has been
+ * skipped. Returns 1 if a region was entered.
+ */
+static int
+roi_fast_forward(APEX_CPU* cpu)
+{
+  int skipped = cpu->roi_skipped;
+  while (cpu->roi_skipped < cpu->function_cycles) {
+    /* Natively or from decoded blocks as far as possible, the interpreter
+     * takes the instruction they stopped at */
+    if (!cpu->jit && !cpu->bbcache) {
+      cpu->bbcache = APEX_bbcache_create(cpu);
+    }
+    if (cpu->jit) {
+      cpu->roi_skipped += APEX_jit_run(cpu->jit, cpu, cpu->function_cycles - cpu->roi_skipped);
+    } else if (cpu->bbcache) {
+      cpu->roi_skipped += APEX_bbcache_run(cpu->bbcache, cpu, cpu->function_cycles - cpu->roi_skipped);
+    }
+    if (cpu->roi_skipped >= cpu->function_cycles) {
+      break;
+    }
+
+    int index = get_code_index(cpu->pc);
+    if (index >= 0 && index < cpu->code_memory_size &&
+        strcmp(APEX_code_at(cpu, index)->opcode, "ROI_BEGIN") == 0) {
+      cpu->pc += 4;
+      cpu->in_roi = 1;
+      cpu->roi_entries++;
+      APEX_cpi_region_enter(cpu, cpu->pc - 4);
+      APEX_cpu_reset_pipeline(cpu);
+      if (ENABLE_DEBUG_MESSAGES) {
+        printf("(apex) >> Fast-forwarded %d instructions, entering region of interest at pc %d\n",
+               cpu->roi_skipped - skipped, cpu->pc);
+      }
+      return 1;
+    }
+
+    int status = APEX_functional_step(cpu);
+    if (status == FUNCTIONAL_OK) {
+      cpu->roi_skipped++;
+    } else {
+      if (status == FUNCTIONAL_HALT) {
+        cpu->roi_skipped++;
+      } else if (status == FUNCTIONAL_ERROR) {
+        fprintf(stderr, "APEX_Error : Data memory access out of range at pc %d\n", cpu->pc);
+      }
+      roi_end_program(cpu);
+      break;
+    }
+  }
+  if (ENABLE_DEBUG_MESSAGES) {
+    printf("(apex) >> Fast-forwarded %d instructions, no further region of interest\n",
+           cpu->roi_skipped - skipped);
   }
   return 0;
 }
@@ -936,7 +1545,6 @@ writeback(APEX_CPU* cpu)
 int
 APEX_cpu_run(APEX_CPU* cpu)
 {
-  int initial_PC_Value=cpu->pc;
   while (1) {
     /* All the instructions committed, so exit */
     /*Initial Completion logic*/
@@ -947,8 +1555,18 @@ APEX_cpu_run(APEX_CPU* cpu)
 //    }
 
     /* All the instructions committed, so exit */
+    /* Outside a region of interest, skip ahead functionally to the next one */
+    if (cpu->roi_mode && !cpu->in_roi && !APEX_cpu_halted(cpu)) {
+      roi_fast_forward(cpu);
+    }
+
     /*New Completion logic*/
-    if(cpu->pc >= ((cpu->code_memory_size * 4)+initial_PC_Value +16) || cpu->clock ==cpu->function_cycles ){
+    if(APEX_cpu_halted(cpu) || cpu->clock ==cpu->function_cycles || (cpu->roi_mode && !cpu->in_roi)){
+
+      /* Exploration children report to their parent and exit here */
+      if (cpu->explore) {
+        APEX_explore_finish(cpu);
+      }
 
       if (ENABLE_DEBUG_MESSAGES) {
         printf("--------------------------------\n");
@@ -956,30 +1574,133 @@ APEX_cpu_run(APEX_CPU* cpu)
         printf("--------------------------------\n");
       }
 
+      /* A region the run ends in is charged up to here */
+      APEX_cpi_region_exit(cpu);
+
       printf("(apex) >> Simulation Complete \n");
       printf("Total Instructions Present: %d, Total instructions processed: %d \n",cpu->code_memory_size,cpu->ins_completed);
       printf("Total clock cycles taken: %d \n",cpu->clock);
+      if (cpu->memo) {
+        APEX_memo_report(cpu->memo);
+      }
+      if (cpu->loops) {
+        APEX_loops_report(cpu->loops);
+      }
+      if (cpu->roi_mode) {
+        printf("Regions of interest simulated: %d, instructions fast-forwarded outside them: %d \n",
+               cpu->roi_entries, cpu->roi_skipped);
+      }
+      if (cpu->jit) {
+        APEX_jit_report(cpu->jit);
+      }
+      if (cpu->program->lazy) {
+        APEX_lazy_report(cpu->program->lazy);
+      }
+      if (cpu->cpi_report) {
+        APEX_cpi_report(cpu);
+      }
+      if (cpu->latency) {
+        APEX_latency_report(cpu->latency);
+      }
+      if (cpu->stats && APEX_stats_dump(cpu->stats->registry, cpu->clock)) {
+        fprintf(stderr, "APEX_Error : Unable to write statistics\n");
+      }
+      if (cpu->window && APEX_window_write(cpu->window, cpu)) {
+        fprintf(stderr, "APEX_Error : Unable to write the last window\n");
+      }
+      if (cpu->profile && APEX_profile_write(cpu->profile, cpu)) {
+        fprintf(stderr, "APEX_Error : Unable to write the profile\n");
+      }
       Print_regs_content(cpu);//this will print the data of all the regs
       break;
     }
 
+    if (cpu->explore) {
+      APEX_explore_check(cpu);
+    }
+
     if (ENABLE_DEBUG_MESSAGES) {
       printf("--------------------------------\n");
       printf("Clock Cycle #: %d\n", cpu->clock);
       printf("--------------------------------\n");
     }
 
-    writeback(cpu);
-    memory(cpu);
-    execute(cpu);
-    decode(cpu);
-    fetch(cpu);
-    cpu->clock++;
+    if (cpu->stats) {
+      APEX_stats_tick(cpu->stats->registry, cpu->clock);
+    }
+    if (cpu->window) {
+      APEX_window_tick(cpu->window, cpu);
+    }
+
+    /* Periodic checkpoint, taken before the stages of this cycle run */
+    if (cpu->checkpoints && cpu->clock % cpu->checkpoint_interval == 0) {
+      APEX_checkpoint_take(cpu->checkpoints, cpu);
+    }
+
+    /* Skip the iterations of a loop in steady state */
+    int clock = cpu->clock;
+    if (cpu->loops && APEX_loops_apply(cpu)) {
+      cpu->cpi_cycles[CPI_REPLAYED] += cpu->clock - clock;
+      if (cpu->latency) {
+        APEX_latency_forget(cpu);
+      }
+      continue;
+    }
+
+    /* Replay a cached basic block instead of stepping through it */
+    if (cpu->memo && APEX_memo_apply(cpu)) {
+      cpu->cpi_cycles[CPI_REPLAYED] += cpu->clock - clock;
+      if (cpu->latency) {
+        APEX_latency_forget(cpu);
+      }
+      continue;
+    }
+
+    APEX_cpu_step(cpu);
   }
 
   return 0;
 }
 
+/*
+ *  Simulates one clock cycle of the pipeline
+ */
+void
+APEX_cpu_step(APEX_CPU* cpu)
+{
+  if (cpu->pipeline_drained) {
+    APEX_cpu_reset_pipeline(cpu);
+  }
+  if (cpu->stats) {
+    count_stages(cpu);
+  }
+  if (cpu->profile) {
+    /* Before writeback, which takes the latches of the cycle with it */
+    profile_cycle(cpu, &cpu->stage[WB]);
+  }
+  if (cpu->latency) {
+    APEX_latency_cycle(cpu);
+  }
+  writeback(cpu);
+  memory(cpu);
+  execute(cpu);
+  decode(cpu);
+  fetch(cpu);
+  cpu->clock++;
+}
+
+/*
+ * Fetch has moved past the end of code memory and the pipeline has drained,
+ * or HALT has retired and moved the PC out of the code.
+ */
+int
+APEX_cpu_halted(APEX_CPU* cpu)
+{
+  /* Code always starts at 4000, even when resuming from a checkpoint */
+  int initial_PC_Value=4000;
+  return cpu->pc >= ((cpu->code_memory_size * 4)+initial_PC_Value +16);
+}
+
 /*Output printing function*/
 void Print_regs_content(APEX_CPU* cpu){
   printf("\n\n=============== STATE OF ARCHITECTURAL REGISTER FILE ==========\n\n");
@@ -1001,9 +1722,16 @@ void Print_regs_content(APEX_CPU* cpu){
 
 /* function to create a NOP with default values*/
 void Create_NOP(APEX_CPU* cpu,CPU_Stage* nopStage){
+  /* Clear every field, a NOP must not carry stale register numbers. Its
+   * registers match none, so it never looks like an in-flight write */
+  memset(nopStage, 0, sizeof(*nopStage));
   strcpy(nopStage->opcode,"NOP");
+  nopStage->rd=-1;
+  nopStage->rs1=-1;
+  nopStage->rs2=-1;
   nopStage->busy=0;
   nopStage->stalled=0;
+  nopStage->cycles_left=0;
   nopStage->pc=cpu->stage[EX].pc;
 }
 
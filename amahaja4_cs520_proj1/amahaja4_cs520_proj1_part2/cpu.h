@@ -9,6 +9,12 @@
  *  State University of New York, Binghamton
  */
 
+/* Data memory size in words, and the page granularity at which writes are
+ * tracked for incremental checkpoints */
+#define DATA_MEMORY_SIZE 4096
+#define DATA_PAGE_SIZE 256
+#define DATA_NUM_PAGES (DATA_MEMORY_SIZE / DATA_PAGE_SIZE)
+
 enum
 {
     F,
@@ -19,14 +25,48 @@ enum
     NUM_STAGES
 };
 
+/* Outcome of executing one instruction with APEX_functional_step */
+enum
+{
+    FUNCTIONAL_OK,		// Instruction executed, continue at cpu->pc
+    FUNCTIONAL_HALT,	// HALT executed
+    FUNCTIONAL_END,		// PC is outside code memory, nothing executed
+    FUNCTIONAL_ERROR	// Data memory access out of range, nothing executed
+};
+
+/* What writeback did in a cycle: retire an instruction, or take a bubble
+ * inserted for one of the other causes. Cleared latches are pipeline fill */
+enum
+{
+    CPI_FILL,		// Pipeline filling at the start or after a region restart
+    CPI_BASE,		// An instruction retired
+    CPI_RAW,		// Decode waiting for a register, no forwarding
+    CPI_LOAD_USE,	// Decode waiting for a LOAD in execute, with forwarding
+    CPI_MUL,		// MUL occupying execute
+    CPI_BRANCH_Z,	// BZ/BNZ waiting for the zero flag producer
+    CPI_FLUSH,		// Taken branch or JUMP squashing younger instructions
+    CPI_DRAIN,		// HALT or ROI_END draining the pipeline
+    CPI_NOP,		// NOP instruction of the program
+    CPI_REPLAYED,	// Replayed by --memo or --loops, not stepped
+    CPI_NUM_CAUSES
+};
+
+/* Instructions between decode and writeback, the ones a decoding
+ * instruction can depend on */
+#define DEP_WINDOW 3
+
 /* Format of an APEX instruction  */
 typedef struct APEX_Instruction
 {
-    char opcode[128];	// Operation Code
+    char opcode[16];	// Operation Code, longer words are cut
     int rd;		    // Destination Register Address
     int rs1;		    // Source-1 Register Address
     int rs2;		    // Source-2 Register Address
     int imm;		    // Literal Value
+    /* Static dependences, see APEX_annotate_dependences */
+    int dep_rs1;		// Instructions back to the producer of rs1, 0 if none in the window
+    int dep_rs2;		// Same for rs2
+    int dep_z;		    // Instructions back to the nearest ADD/SUB/MUL, 0 if none in the window
 } APEX_Instruction;
 
 /* Model of CPU stage latch */
@@ -38,12 +78,19 @@ typedef struct CPU_Stage
     int rs2;		    // Source-2 Register Address
     int rd;		    // Destination Register Address
     int imm;		    // Literal Value
+    int dep_rs1;		// Static dependences copied from the instruction
+    int dep_rs2;
+    int dep_z;
     int rs1_value;	// Source-1 Register Value
     int rs2_value;	// Source-2 Register Value
     int buffer;		// Latch to hold some value
     int mem_address;	// Computed Memory Address
     int busy;		    // Flag to indicate, stage is performing some action
     int stalled;		// Flag to indicate, stage is stalled
+    int cycles_left;	// Remaining cycles of a multi-cycle operation
+    int bubble;		    // CPI_ cause a NOP in this latch is charged to
+    int bubble_pc;		// Instruction it is charged to, see profile.h
+    int stage_cycle[NUM_STAGES];	// Cycle it entered each stage, -1 until then, see latency.h
 } CPU_Stage;
 
 /* Model of APEX CPU */
@@ -51,6 +98,11 @@ typedef struct APEX_CPU
 {
 
     int zero_flag;
+
+    /* Timing configuration */
+    int enable_data_forwarding;
+    int mul_latency;
+
     /* Clock cycles elasped */
     int clock;
 
@@ -66,14 +118,74 @@ typedef struct APEX_CPU
     /* Array of 5 CPU_stage */
     CPU_Stage stage[5];
 
-    /* Code Memory where instructions are stored */
-    APEX_Instruction* code_memory;
+    /* ROI_END has drained the pipeline, it restarts empty on the next cycle */
+    int pipeline_drained;
+
+    /* Taken branches and JUMPs resolved so far */
+    int redirects;
+
+    /* Program image, shared with other simulations, see program.h */
+    struct APEX_Program* program;
+
+    /* Code Memory where instructions are stored, read through APEX_code_at */
+    const APEX_Instruction* code_memory;
     int code_memory_size;
 
     /* Data Memory */
-    int data_memory[4096];
+    int data_memory[DATA_MEMORY_SIZE];
+
+    /* Pages of data memory written since the last checkpoint */
+    unsigned char dirty_pages[DATA_NUM_PAGES];
 
+    /* Periodic checkpointing, disabled when interval is 0 */
+    int checkpoint_interval;
+    struct APEX_Checkpoint_Series* checkpoints;
 
+    /* Forked what-if exploration of other timing configurations */
+    struct APEX_Explore* explore;
+
+    /* Memoized basic block timing, disabled when NULL */
+    struct APEX_Memo* memo;
+
+    /* Steady-state loop extrapolation, disabled when NULL */
+    struct APEX_Loops* loops;
+
+    /* Native translation of functional execution, disabled when NULL */
+    struct APEX_Jit* jit;
+
+    /* Decoded blocks for functional execution, made on first fast-forward */
+    struct APEX_Block_Cache* bbcache;
+
+    /* Registered statistics, disabled when NULL */
+    struct APEX_Pipeline_Stats* stats;
+
+    /* Region of interest. In a program containing ROI_BEGIN, code outside
+     * ROI_BEGIN/ROI_END runs functionally and the stats below only count
+     * cycles and instructions inside the regions */
+    int roi_mode;
+    int in_roi;
+    int roi_entries;		// Regions entered so far
+    int roi_skipped;		// Instructions executed functionally outside the regions
+
+    /* Cycles by CPI_ cause, and per region of interest, see cpi.h */
+    long cpi_cycles[CPI_NUM_CAUSES];
+    struct APEX_Cpi_Region* cpi_regions;	// Most recently entered first
+    struct APEX_Cpi_Region* cpi_region;	// Being simulated, if any
+    int cpi_report;			// Print the CPI stack at the end
+
+    /* Per-instruction counters, if profiling */
+    struct APEX_Profile* profile;
+
+    /* Stall events, data memory accesses and retired instructions are written here, if set */
+    struct APEX_Stall_Log* stall_log;
+    struct APEX_Mem_Trace* mem_trace;
+    struct APEX_Retire_Trace* retire_trace;
+
+    /* Per-opcode latency histograms, if kept */
+    struct APEX_Latency* latency;
+
+    /* Windowed time series, if written */
+    struct APEX_Window* window;
 
     /* Some stats */
     int ins_completed;
@@ -86,15 +198,78 @@ typedef struct APEX_CPU
 APEX_Instruction*
 create_code_memory(const char* filename, int* size);
 
+/* Code memory decoded on demand, defined in file_parser.c */
+struct APEX_Lazy_Code;
+
+APEX_Instruction*
+create_lazy_code_memory(const char* filename, int* size, struct APEX_Lazy_Code** lazy);
+
+APEX_Instruction*
+create_object_code_memory(const char* filename, int* size, struct APEX_Lazy_Code** lazy,
+                          int* data_memory);
+
+APEX_Instruction*
+APEX_lazy_decode(struct APEX_Lazy_Code* lazy, int index);
+
+int
+APEX_lazy_has_roi(struct APEX_Lazy_Code* lazy);
+
+void
+APEX_lazy_report(struct APEX_Lazy_Code* lazy);
+
+void
+APEX_lazy_free(struct APEX_Lazy_Code* lazy);
+
+void
+APEX_annotate_dependences(APEX_Instruction* code_memory, int size);
+
+/* What an opcode does with registers, see APEX_opcode_flags */
+#define READS_RS1 1
+#define READS_RS2 2
+#define WRITES_RD 4
+#define SETS_ZERO 8
+
+int
+APEX_opcode_flags(const char* opcode);
+
 APEX_CPU*
 APEX_cpu_init(const char* filename,const char* function_name,const char* function_cycles);
 
+APEX_CPU*
+APEX_cpu_create(struct APEX_Program* program, const char* function_code, const char* function_cycles);
+
 int
 APEX_cpu_run(APEX_CPU* cpu);
 
+void
+APEX_cpu_step(APEX_CPU* cpu);
+
+int
+APEX_cpu_halted(APEX_CPU* cpu);
+
 void
 APEX_cpu_stop(APEX_CPU* cpu);
 
+APEX_CPU*
+APEX_cpu_clone(APEX_CPU* cpu);
+
+void
+APEX_cpu_reset_pipeline(APEX_CPU* cpu);
+
+struct APEX_Stats;
+
+int
+APEX_cpu_enable_stats(APEX_CPU* cpu, struct APEX_Stats* registry);
+
+int
+get_code_index(int pc);
+
+const APEX_Instruction*
+APEX_code_at(APEX_CPU* cpu, int index);
+
+int
+APEX_functional_step(APEX_CPU* cpu);
+
 int
 fetch(APEX_CPU* cpu);
 
@@ -127,4 +302,7 @@ Free_Destination_After_CheckingApe(APEX_CPU* cpu);
 
 
 
+extern int ENABLE_DEBUG_MESSAGES;
+extern int LAZY_CODE_MEMORY;
+
 #endif
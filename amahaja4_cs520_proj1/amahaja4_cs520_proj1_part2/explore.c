@@ -0,0 +1,297 @@
+/*
+ *  explore.c
+ *  Contains functions to fork the live cpu into children that finish the
+ *  run under other timing configurations, and to gather their results
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "explore.h"
+#include "arena.h"
+
+/*
+ * Parses one configuration such as "fwd=0,mul=3". Knobs that are not
+ * mentioned are left at -1 and keep the parent's value.
+ */
+static int
+parse_config(APEX_Timing_Config* config, char* text)
+{
+  config->enable_data_forwarding = -1;
+  config->mul_latency = -1;
+
+  char* saveptr = NULL;
+  for (char* knob = strtok_r(text, ",", &saveptr); knob; knob = strtok_r(NULL, ",", &saveptr)) {
+    int value;
+    if (sscanf(knob, " fwd=%d", &value) == 1 && (value == 0 || value == 1)) {
+      config->enable_data_forwarding = value;
+    } else if (sscanf(knob, " mul=%d", &value) == 1 && value >= 1) {
+      config->mul_latency = value;
+    } else {
+      fprintf(stderr, "APEX_Error : Invalid timing knob '%s'\n", knob);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static void
+print_config(APEX_CPU* cpu, APEX_Timing_Config* config)
+{
+  int fwd = config->enable_data_forwarding >= 0 ? config->enable_data_forwarding
+                                                : cpu->enable_data_forwarding;
+  int mul = config->mul_latency >= 0 ? config->mul_latency : cpu->mul_latency;
+  printf("fwd=%d,mul=%-6d", fwd, mul);
+}
+
+/*
+ * Creates an exploration fired at a cycle ("cycle") or when fetch reaches a
+ * PC ("pc"). Configurations are separated by ';'.
+ */
+APEX_Explore*
+APEX_explore_create(const char* trigger, const char* value, const char* configs)
+{
+  APEX_Explore* explore = APEX_calloc(1, sizeof(*explore));
+  if (!explore) {
+    return NULL;
+  }
+  explore->result_fd = -1;
+  explore->child_config = -1;
+  explore->trigger_value = atoi(value);
+
+  if (strcmp(trigger, "cycle") == 0) {
+    explore->trigger = EXPLORE_AT_CYCLE;
+  } else if (strcmp(trigger, "pc") == 0) {
+    explore->trigger = EXPLORE_AT_PC;
+  } else {
+    fprintf(stderr, "APEX_Error : Exploration trigger must be 'cycle' or 'pc'\n");
+    APEX_free(explore);
+    return NULL;
+  }
+
+  char* text = APEX_malloc(strlen(configs) + 1);
+  if (!text) {
+    APEX_free(explore);
+    return NULL;
+  }
+
+  strcpy(text, configs);
+  int capacity = 1;
+  for (const char* c = configs; *c; ++c) {
+    if (*c == ';') {
+      capacity++;
+    }
+  }
+  explore->configs = APEX_malloc(sizeof(*explore->configs) * capacity);
+
+  char* saveptr = NULL;
+  for (char* item = strtok_r(text, ";", &saveptr); item && explore->configs;
+       item = strtok_r(NULL, ";", &saveptr)) {
+    if (parse_config(&explore->configs[explore->num_configs], item)) {
+      explore->num_configs = 0;
+      break;
+    }
+    explore->num_configs++;
+  }
+  APEX_free(text);
+
+  if (!explore->num_configs) {
+    APEX_explore_free(explore);
+    return NULL;
+  }
+  return explore;
+}
+
+void
+APEX_explore_free(APEX_Explore* explore)
+{
+  if (!explore) {
+    return;
+  }
+  APEX_free(explore->configs);
+  APEX_free(explore);
+}
+
+/*
+ * Runs in a freshly forked child: switch to the child's configuration and
+ * let APEX_cpu_run continue from the shared warm state.
+ */
+static void
+become_child(APEX_CPU* cpu, int config, int result_fd)
+{
+  APEX_Explore* explore = cpu->explore;
+  APEX_Timing_Config* timing = &explore->configs[config];
+
+  if (timing->enable_data_forwarding >= 0) {
+    cpu->enable_data_forwarding = timing->enable_data_forwarding;
+  }
+  if (timing->mul_latency >= 0) {
+    cpu->mul_latency = timing->mul_latency;
+  }
+
+  explore->child_config = config;
+  explore->result_fd = result_fd;
+
+  /* The parent owns the autosave file, and children run quietly */
+  cpu->checkpoints = NULL;
+  ENABLE_DEBUG_MESSAGES = 0;
+}
+
+/* Reads the result of the child running config, which fails unless it names that config */
+static void
+collect_result(APEX_Explore_Result* results, int* received, int config, int fd)
+{
+  APEX_Explore_Result result;
+  if (read(fd, &result, sizeof(result)) == sizeof(result) && result.config == config) {
+    results[config] = result;
+    received[config] = 1;
+  }
+  close(fd);
+}
+
+/*
+ * Forks one child per configuration, at most one per online core at a time,
+ * and prints a comparison once all of them have reported back.
+ */
+static void
+fork_children(APEX_CPU* cpu)
+{
+  APEX_Explore* explore = cpu->explore;
+  int n = explore->num_configs;
+  long max_running = sysconf(_SC_NPROCESSORS_ONLN);
+  if (max_running < 1) {
+    max_running = 1;
+  }
+
+  APEX_Explore_Result* results = APEX_calloc(n, sizeof(*results));
+  int* received = APEX_calloc(n, sizeof(*received));
+  pid_t* pids = APEX_calloc(n, sizeof(*pids));
+  int* fds = APEX_calloc(n, sizeof(*fds));
+  if (!results || !received || !pids || !fds) {
+    fprintf(stderr, "APEX_Error : Unable to allocate exploration state\n");
+    APEX_free(results);
+    APEX_free(received);
+    APEX_free(pids);
+    APEX_free(fds);
+    return;
+  }
+
+  int start_clock = cpu->clock;
+  int start_pc = cpu->pc;
+  int running = 0;
+
+  /* Nothing buffered may be duplicated into the children */
+  fflush(NULL);
+
+  for (int i = 0; i <= n; ++i) {
+    while (running && (running >= max_running || i == n)) {
+      int status;
+      pid_t pid = wait(&status);
+      if (pid < 0) {
+        running = 0;
+        break;
+      }
+      for (int j = 0; j < i; ++j) {
+        if (pids[j] == pid) {
+          collect_result(results, received, j, fds[j]);
+          pids[j] = 0;
+          running--;
+        }
+      }
+    }
+    if (i == n) {
+      break;
+    }
+
+    int pipe_fds[2];
+    if (pipe(pipe_fds)) {
+      perror("APEX_Error : pipe");
+      continue;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("APEX_Error : fork");
+      close(pipe_fds[0]);
+      close(pipe_fds[1]);
+      continue;
+    }
+    if (pid == 0) {
+      close(pipe_fds[0]);
+      for (int j = 0; j < i; ++j) {
+        if (pids[j]) {
+          close(fds[j]);
+        }
+      }
+      APEX_free(results);
+      APEX_free(received);
+      APEX_free(pids);
+      APEX_free(fds);
+      become_child(cpu, i, pipe_fds[1]);
+      return;
+    }
+    close(pipe_fds[1]);
+    pids[i] = pid;
+    fds[i] = pipe_fds[0];
+    running++;
+  }
+
+  printf("(apex) >> Exploration from cycle %d (pc %d)\n", start_clock, start_pc);
+  printf("%-22s %-12s %-14s %s\n", "configuration", "cycles", "instructions", "CPI");
+  for (int i = 0; i < n; ++i) {
+    print_config(cpu, &explore->configs[i]);
+    if (!received[i]) {
+      printf("      failed\n");
+      continue;
+    }
+    printf("      %-12d %-14d %.3f\n", results[i].clock, results[i].ins_completed,
+           results[i].ins_completed ? (double)results[i].clock / results[i].ins_completed : 0.0);
+  }
+  fflush(stdout);
+
+  APEX_free(results);
+  APEX_free(received);
+  APEX_free(pids);
+  APEX_free(fds);
+}
+
+/*
+ * Called at the start of every cycle. Forks the children once the trigger
+ * cycle or PC is reached; only the parent returns with fired set.
+ */
+void
+APEX_explore_check(APEX_CPU* cpu)
+{
+  APEX_Explore* explore = cpu->explore;
+  if (explore->fired) {
+    return;
+  }
+  if ((explore->trigger == EXPLORE_AT_CYCLE && cpu->clock == explore->trigger_value) ||
+      (explore->trigger == EXPLORE_AT_PC && cpu->pc == explore->trigger_value)) {
+    explore->fired = 1;
+    fork_children(cpu);
+  }
+}
+
+/*
+ * Called when a run completes. In a child, report the result to the parent
+ * and exit without running any of the parent's cleanup.
+ */
+void
+APEX_explore_finish(APEX_CPU* cpu)
+{
+  APEX_Explore* explore = cpu->explore;
+  if (explore->result_fd < 0) {
+    return;
+  }
+
+  APEX_Explore_Result result;
+  memset(&result, 0, sizeof(result));
+  result.config = explore->child_config;
+  result.clock = cpu->clock;
+  result.ins_completed = cpu->ins_completed;
+
+  int ret = write(explore->result_fd, &result, sizeof(result)) == sizeof(result) ? 0 : 1;
+  _exit(ret);
+}
@@ -0,0 +1,62 @@
+#ifndef _APEX_EXPLORE_H_
+#define _APEX_EXPLORE_H_
+/**
+ *  explore.h
+ *  Contains data structures for forked what-if exploration
+ *
+ *  At a chosen cycle or PC the live cpu is forked once per timing
+ *  configuration. Each child finishes the run under its configuration and
+ *  reports back over a pipe, while untouched state stays shared
+ *  copy-on-write with the parent.
+ */
+
+#include "cpu.h"
+
+enum
+{
+    EXPLORE_AT_CYCLE,
+    EXPLORE_AT_PC
+};
+
+/* Timing knobs a child can change */
+typedef struct APEX_Timing_Config
+{
+    int enable_data_forwarding;
+    int mul_latency;
+} APEX_Timing_Config;
+
+/* Sent by each child to the parent when its run completes */
+typedef struct APEX_Explore_Result
+{
+    int config;		    // Index of the configuration
+    int clock;
+    int ins_completed;
+} APEX_Explore_Result;
+
+typedef struct APEX_Explore
+{
+    int trigger;		// EXPLORE_AT_CYCLE or EXPLORE_AT_PC
+    int trigger_value;
+    int fired;
+
+    APEX_Timing_Config* configs;
+    int num_configs;
+
+    /* Set in a child only: index of its configuration and its result pipe */
+    int child_config;
+    int result_fd;
+} APEX_Explore;
+
+APEX_Explore*
+APEX_explore_create(const char* trigger, const char* value, const char* configs);
+
+void
+APEX_explore_free(APEX_Explore* explore);
+
+void
+APEX_explore_check(APEX_CPU* cpu);
+
+void
+APEX_explore_finish(APEX_CPU* cpu);
+
+#endif
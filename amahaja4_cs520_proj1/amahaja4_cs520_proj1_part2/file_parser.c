@@ -10,157 +10,722 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cpu.h"
+#include "object.h"
+#include "arena.h"
+
+/* Operand fields of a line, bounded by the end of the line instead of a '\0' */
+typedef struct Line_Tokens
+{
+    const char* start[6];
+    const char* end[6];
+    int count;
+} Line_Tokens;
 
 /*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
+ * Splits [p, end) at ',' dropping empty fields, like strtok. Fields past
+ * the sixth are ignored.
  */
+static void
+split_line(const char* p, const char* end, Line_Tokens* tokens)
+{
+  tokens->count = 0;
+  while (p < end && tokens->count < 6) {
+    while (p < end && *p == ',') {
+      p++;
+    }
+    if (p == end) {
+      break;
+    }
+    tokens->start[tokens->count] = p;
+    while (p < end && *p != ',') {
+      p++;
+    }
+    tokens->end[tokens->count++] = p;
+  }
+}
+
+static int
+is_space(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+/* Value of an operand: its first character (R, #) is skipped, the rest read as atoi does */
 static int
-get_num_from_string(char* buffer)
+operand_value(const char* p, const char* end)
 {
-  char str[16];
-  int j = 0;
-  for (int i = 1; buffer[i] != '\0'; ++i) {
-    str[j] = buffer[i];
-    j++;
+  p++;
+  while (p < end && is_space(*p)) {
+    p++;
+  }
+  int negative = 0;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
   }
-  str[j] = '\0';
-  return atoi(str);
+  unsigned int value = 0;
+  while (p < end && *p >= '0' && *p <= '9') {
+    value = value * 10 + (unsigned int)(*p - '0');
+    p++;
+  }
+  return (int)(negative ? 0u - value : value);
 }
 
 /*
- * This function is related to parsing input file
+ * Operands of each opcode, in the order they are written, and what it
+ * does with registers. 'd' is rd, '1' rs1, '2' rs2 and 'i' the literal.
  *
- * Note : you can edit this function to add new instructions
+ * Note : you can add new instructions here
  */
-static void
-create_APEX_instruction(APEX_Instruction* ins, char* buffer)
+static const struct
 {
-  char* token = strtok(buffer, ",");
-  int token_num = 0;
-  char tokens[6][128];
+    const char* name;
+    const char* operands;
+    int flags;
+} opcode_table[] = {
+  { "ADD", "d12", READS_RS1 | READS_RS2 | WRITES_RD | SETS_ZERO },
+  { "SUB", "d12", READS_RS1 | READS_RS2 | WRITES_RD | SETS_ZERO },
+  { "MUL", "d12", READS_RS1 | READS_RS2 | WRITES_RD | SETS_ZERO },
+  { "AND", "d12", READS_RS1 | READS_RS2 | WRITES_RD },
+  { "OR", "d12", READS_RS1 | READS_RS2 | WRITES_RD },
+  { "EX-OR", "d12", READS_RS1 | READS_RS2 | WRITES_RD },
+  { "MOVC", "di", WRITES_RD },
+  { "LOAD", "d1i", READS_RS1 | WRITES_RD },
+  { "STORE", "12i", READS_RS1 | READS_RS2 },
+  { "BZ", "i", 0 },
+  { "BNZ", "i", 0 },
+  { "JUMP", "1i", READS_RS1 },
+  { "HALT", "", 0 },
+  { "ROI_BEGIN", "", 0 },
+  { "ROI_END", "", 0 },
+};
 
-
-  while (token != NULL) {
-    strcpy(tokens[token_num], token);
-    token_num++;
-    token = strtok(NULL, ",");
+/* Table index of an opcode, -1 if unknown */
+static int
+lookup_opcode(const char* opcode)
+{
+  for (int i = 0; i < (int)(sizeof(opcode_table) / sizeof(opcode_table[0])); ++i) {
+    if (opcode_table[i].name[0] == opcode[0] && strcmp(opcode_table[i].name, opcode) == 0) {
+      return i;
+    }
   }
+  return -1;
+}
 
-  //replaced strcpy with this for taking care of trailing whitespaces
-  sscanf(tokens[0], "%s", ins->opcode);
-  //strcpy(ins->opcode, tokens[0]);
+/* READS_RS1, READS_RS2, WRITES_RD and SETS_ZERO of opcode, 0 if unknown */
+int
+APEX_opcode_flags(const char* opcode)
+{
+  int i = lookup_opcode(opcode);
+  return i < 0 ? 0 : opcode_table[i].flags;
+}
 
+/*
+ * Decodes the line [p, end) into ins. An empty line gives an empty opcode,
+ * unknown opcodes keep zero operands. Returns -1 if operands are missing.
+ */
+static int
+create_APEX_instruction(APEX_Instruction* ins, const char* p, const char* end)
+{
+  Line_Tokens tokens;
+  split_line(p, end, &tokens);
 
-  if (strcmp(ins->opcode, "ADD") == 0) {
-    ins->rd=get_num_from_string(tokens[1]);
-    ins->rs1=get_num_from_string(tokens[2]);
-    ins->rs2=get_num_from_string(tokens[3]);
+  /* First word of the first field, trailing whitespace dropped */
+  int length = 0;
+  if (tokens.count) {
+    const char* c = tokens.start[0];
+    while (c < tokens.end[0] && is_space(*c)) {
+      c++;
+    }
+    while (c < tokens.end[0] && !is_space(*c) && length < (int)sizeof(ins->opcode) - 1) {
+      ins->opcode[length++] = *c++;
+    }
   }
-  else if(strcmp(ins->opcode,"SUB")==0){
-    ins->rd=get_num_from_string(tokens[1]);
-    ins->rs1=get_num_from_string(tokens[2]);
-    ins->rs2=get_num_from_string(tokens[3]);
+  ins->opcode[length] = '\0';
+
+  int op = lookup_opcode(ins->opcode);
+  if (op < 0) {
+    return 0;
   }
-  else if(strcmp(ins->opcode,"LOAD")==0){
-    ins->rd=get_num_from_string(tokens[1]);
-    ins->rs1=get_num_from_string(tokens[2]);
-    ins->imm=get_num_from_string(tokens[3]);
+  const char* operands = opcode_table[op].operands;
+  if (tokens.count <= (int)strlen(operands)) {
+    return -1;
   }
-  else if(strcmp(ins->opcode, "STORE") == 0) {
-    ins->rs1 = get_num_from_string(tokens[1]);
-    ins->rs2 = get_num_from_string(tokens[2]);
-    ins->imm = get_num_from_string(tokens[3]);
+  for (int i = 0; operands[i]; ++i) {
+    int value = operand_value(tokens.start[i + 1], tokens.end[i + 1]);
+    switch (operands[i]) {
+      case 'd':
+        ins->rd = value;
+        break;
+      case '1':
+        ins->rs1 = value;
+        break;
+      case '2':
+        ins->rs2 = value;
+        break;
+      case 'i':
+        ins->imm = value;
+        break;
+    }
   }
-  else if(strcmp(ins->opcode,"MUL")==0){
-    ins->rd=get_num_from_string(tokens[1]);
-    ins->rs1=get_num_from_string(tokens[2]);
-    ins->rs2=get_num_from_string(tokens[3]);
+  return 0;
+}
+
+/*
+ * Annotates every instruction with the distance back to the producers of
+ * its sources and of the zero flag, looking at the DEP_WINDOW instructions
+ * before it in the program. Those are the only ones that can be in
+ * execute, memory or writeback when it decodes: arriving by a taken branch
+ * or JUMP, the pipeline holds nothing older than that branch. A zero
+ * distance therefore means no in-flight instruction produces the value.
+ */
+static void
+annotate_range(APEX_Instruction* code_memory, int from, int to)
+{
+  /* Flags of the last instructions, starting with the window before from */
+  int flags[DEP_WINDOW + 1];
+  int start = from > DEP_WINDOW ? from - DEP_WINDOW : 0;
+
+  for (int i = start; i < to; ++i) {
+    APEX_Instruction* ins = &code_memory[i];
+    int f = APEX_opcode_flags(ins->opcode);
+    if (i >= from) {
+      ins->dep_rs1 = 0;
+      ins->dep_rs2 = 0;
+      ins->dep_z = 0;
+      for (int d = DEP_WINDOW < i - start ? DEP_WINDOW : i - start; d >= 1; --d) {
+        /* Nearest producer wins, so walk from the farthest */
+        const APEX_Instruction* prev = &code_memory[i - d];
+        int prev_flags = flags[(i - d) % (DEP_WINDOW + 1)];
+        if ((prev_flags & WRITES_RD) && (f & READS_RS1) && prev->rd == ins->rs1) {
+          ins->dep_rs1 = d;
+        }
+        if ((prev_flags & WRITES_RD) && (f & READS_RS2) && prev->rd == ins->rs2) {
+          ins->dep_rs2 = d;
+        }
+        if (prev_flags & SETS_ZERO) {
+          ins->dep_z = d;
+        }
+      }
+    }
+    flags[i % (DEP_WINDOW + 1)] = f;
   }
-  else if (strcmp(ins->opcode, "MOVC") == 0) {
-    ins->rd = get_num_from_string(tokens[1]);
-    ins->imm = get_num_from_string(tokens[2]);
+}
+
+void
+APEX_annotate_dependences(APEX_Instruction* code_memory, int size)
+{
+  annotate_range(code_memory, 0, size);
+}
+
+/* Files smaller than this are parsed on the calling thread */
+#define PARSE_PARALLEL_BYTES (1 << 20)
+#define PARSE_MAX_THREADS 16
+
+/* Scanned text is dropped from memory in steps of this many bytes */
+#define PARSE_RELEASE_BYTES (8 << 20)
+
+/* A byte range of the file, parsed by one thread */
+typedef struct Parse_Chunk
+{
+    const char* text;
+    size_t text_size;
+    size_t begin;
+    size_t end;
+    size_t start;		// Of the first line starting in [begin, end)
+    APEX_Instruction* code_memory;
+    size_t* line_index;		// For lazy code memory
+    int release_text;		// Drop scanned text from memory, lazy code reads it again
+    const char* released;	// Up to here
+
+    int newlines;		// Inside [begin, end)
+    int first_line;		// Index of the first line starting in the chunk
+    int lines;			// Lines starting in the chunk
+    int errors;
+    int first_error;		// Line index of the first error
+    int has_roi;		// Some line is a ROI_BEGIN
+} Parse_Chunk;
+
+/* Drops the text pages the chunk has scanned up to p, if it should */
+static void
+release_text(Parse_Chunk* chunk, const char* p)
+{
+  if (!chunk->release_text) {
+    return;
   }
-  else if(strcmp(ins->opcode,"AND") == 0){
-    ins->rd=get_num_from_string(tokens[1]);
-    ins->rs1=get_num_from_string(tokens[2]);
-    ins->rs2=get_num_from_string(tokens[3]);
+  if (!chunk->released) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    chunk->released = chunk->text + (chunk->begin + page - 1) / page * page;
   }
-  else if(strcmp(ins->opcode,"OR") == 0){
-    ins->rd=get_num_from_string(tokens[1]);
-    ins->rs1=get_num_from_string(tokens[2]);
-    ins->rs2=get_num_from_string(tokens[3]);
+  while (p - chunk->released >= PARSE_RELEASE_BYTES) {
+    /* Pages come back from the page cache when read again */
+    madvise((void*)chunk->released, PARSE_RELEASE_BYTES, MADV_DONTNEED);
+    chunk->released += PARSE_RELEASE_BYTES;
   }
-  else if(strcmp(ins->opcode,"EX-OR") == 0){
-    ins->rd=get_num_from_string(tokens[1]);
-    ins->rs1=get_num_from_string(tokens[2]);
-    ins->rs2=get_num_from_string(tokens[3]);
+}
+
+static void*
+count_newlines(void* arg)
+{
+  Parse_Chunk* chunk = arg;
+  const char* p = chunk->text + chunk->begin;
+  const char* end = chunk->text + chunk->end;
+  int newlines = 0;
+  while ((p = memchr(p, '\n', end - p)) != NULL) {
+    newlines++;
+    p++;
+    if ((newlines & 0xFFFF) == 0) {
+      release_text(chunk, p);
+    }
   }
-  else if(strcmp(ins->opcode,"BZ")==0){
-    ins->imm = get_num_from_string(tokens[1]);
+  chunk->newlines = newlines;
+  chunk->released = NULL;
+  return NULL;
+}
+
+/* End of the line starting at p, the newline or the end of the file */
+static const char*
+line_end(const char* p, const char* file_end)
+{
+  const char* eol = memchr(p, '\n', file_end - p);
+  return eol ? eol : file_end;
+}
+
+/* Decodes the lines starting inside the chunk, the last one may run past its end */
+static void*
+parse_chunk(void* arg)
+{
+  Parse_Chunk* chunk = arg;
+  const char* file_end = chunk->text + chunk->text_size;
+  const char* p = chunk->text + chunk->start;
+  int line = chunk->first_line;
+
+  while (p < chunk->text + chunk->end) {
+    const char* eol = line_end(p, file_end);
+    if (create_APEX_instruction(&chunk->code_memory[line], p, eol)) {
+      if (!chunk->errors++) {
+        chunk->first_error = line;
+      }
+    }
+    line++;
+    p = eol + 1;
   }
-  else if(strcmp(ins->opcode,"BNZ")==0){
-    ins->imm = get_num_from_string(tokens[1]);
+  return NULL;
+}
+
+static void*
+annotate_chunk(void* arg)
+{
+  Parse_Chunk* chunk = arg;
+  annotate_range(chunk->code_memory, chunk->first_line, chunk->first_line + chunk->lines);
+  return NULL;
+}
+
+/* Runs fn on every chunk, one thread each, on the calling thread if none can start */
+static void
+run_chunks(void* (*fn)(void*), Parse_Chunk* chunks, int count)
+{
+  pthread_t workers[PARSE_MAX_THREADS];
+  int started[PARSE_MAX_THREADS];
+  for (int i = 1; i < count; ++i) {
+    started[i] = pthread_create(&workers[i], NULL, fn, &chunks[i]) == 0;
+  }
+  fn(&chunks[0]);
+  for (int i = 1; i < count; ++i) {
+    if (started[i]) {
+      pthread_join(workers[i], NULL);
+    } else {
+      fn(&chunks[i]);
+    }
+  }
+}
+
+/* Maps the whole file read-only, NULL if it is empty or cannot be read */
+static const char*
+map_text(const char* filename, size_t* text_size)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
   }
-  else if(strcmp(ins->opcode,"JUMP")==0){
-    ins->rs1=get_num_from_string(tokens[1]);
-    ins->imm = get_num_from_string(tokens[2]);
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size == 0) {
+    close(fd);
+    return NULL;
   }
-  else if(strcmp(ins->opcode,"HALT")==0){
+  *text_size = st.st_size;
+  const char* text = mmap(NULL, *text_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (text == MAP_FAILED) {
+    return NULL;
   }
+  madvise((void*)text, *text_size, MADV_SEQUENTIAL);
+  return text;
+}
 
+/*
+ * Cuts the text into one chunk per thread and counts the newlines of each
+ * in parallel, which places the lines starting in every chunk. Returns the
+ * number of lines, -1 if there are too many to index.
+ */
+static long
+split_lines(const char* filename, const char* text, size_t text_size, int release,
+            Parse_Chunk* chunks, int* threads)
+{
+  *threads = 1;
+  if (text_size >= PARSE_PARALLEL_BYTES) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    *threads = cpus < 1 ? 1 : cpus > PARSE_MAX_THREADS ? PARSE_MAX_THREADS : (int)cpus;
+  }
+  memset(chunks, 0, sizeof(*chunks) * PARSE_MAX_THREADS);
+  for (int i = 0; i < *threads; ++i) {
+    chunks[i].text = text;
+    chunks[i].text_size = text_size;
+    chunks[i].begin = text_size / *threads * i;
+    chunks[i].end = i == *threads - 1 ? text_size : text_size / *threads * (i + 1);
+    chunks[i].release_text = release;
+  }
 
+  run_chunks(count_newlines, chunks, *threads);
+  long lines = 0;
+  for (int i = 0; i < *threads; ++i) {
+    Parse_Chunk* chunk = &chunks[i];
+    chunk->first_line = (int)lines;
+    chunk->start = chunk->begin;
+    if (chunk->begin > 0 && text[chunk->begin - 1] != '\n') {
+      /* Owned by the previous chunk, up to the newline ending it */
+      const char* eol = memchr(text + chunk->begin, '\n', chunk->end - chunk->begin);
+      chunk->start = eol ? (size_t)(eol - text) + 1 : chunk->end;
+      chunk->first_line++;
+    }
+    lines += chunk->newlines;
+  }
+  if (text[text_size - 1] != '\n') {
+    lines++;
+  }
+  for (int i = 0; i < *threads; ++i) {
+    int next = i + 1 < *threads ? chunks[i + 1].first_line : (int)lines;
+    chunks[i].lines = chunks[i].start < chunks[i].end ? next - chunks[i].first_line : 0;
+  }
+  if (lines > INT_MAX / 4) {
+    fprintf(stderr, "APEX_Error : %s has too many lines (%ld)\n", filename, lines);
+    return -1;
+  }
+  return lines;
 }
 
 /*
- * This function is related to parsing input file
- *
- * Note : You are not supposed to edit this function
+ * Maps the file once, counts its lines in parallel chunks and decodes
+ * each chunk on its own thread straight into the code memory. Every line
+ * is one instruction. Lines with missing operands are reported by number
+ * and fail the load.
  */
 APEX_Instruction*
 create_code_memory(const char* filename, int* size)
 {
+  *size = 0;
   if (!filename) {
     return NULL;
   }
+  size_t text_size;
+  const char* text = map_text(filename, &text_size);
+  if (!text) {
+    return NULL;
+  }
+
+  Parse_Chunk chunks[PARSE_MAX_THREADS];
+  int threads;
+  long lines = split_lines(filename, text, text_size, 0, chunks, &threads);
+  APEX_Instruction* code_memory = lines > 0 ? APEX_calloc(lines, sizeof(*code_memory)) : NULL;
+  if (!code_memory) {
+    munmap((void*)text, text_size);
+    return NULL;
+  }
+  for (int i = 0; i < threads; ++i) {
+    chunks[i].code_memory = code_memory;
+  }
+  run_chunks(parse_chunk, chunks, threads);
+  munmap((void*)text, text_size);
 
-  FILE* fp = fopen(filename, "r");
-  if (!fp) {
+  int errors = 0;
+  for (int i = 0; i < threads; ++i) {
+    if (chunks[i].errors && !errors) {
+      int line = chunks[i].first_error;
+      fprintf(stderr, "APEX_Error : %s:%d: %s is missing operands\n", filename, line + 1,
+              code_memory[line].opcode);
+    }
+    errors += chunks[i].errors;
+  }
+  if (errors) {
+    if (errors > 1) {
+      fprintf(stderr, "APEX_Error : %d more malformed lines in %s\n", errors - 1, filename);
+    }
+    APEX_free(code_memory);
     return NULL;
   }
 
-  char* line = NULL;
-  size_t len = 0;
-  ssize_t nread;
-  int code_memory_size = 0;
+  run_chunks(annotate_chunk, chunks, threads);
+  *size = (int)lines;
+  return code_memory;
+}
+
+/* Lines between two entries of the line index of lazy code memory */
+#define LAZY_INDEX_STRIDE 64
+
+enum
+{
+    LINE_UNDECODED,
+    LINE_PARSED,		// Fields set, dependences not annotated yet
+    LINE_DECODED
+};
 
-  while ((nread = getline(&line, &len, fp)) != -1) {
-    code_memory_size++;
+typedef struct APEX_Lazy_Code
+{
+    char* filename;
+    const char* text;		// Mapped file, source text or object
+    size_t text_size;
+    size_t* line_index;		// Offset of every LAZY_INDEX_STRIDE-th line
+    const APEX_Object_Ins* records;	// Of an object, instead of text lines
+    APEX_Instruction* code_memory;	// Zero pages until decoded
+    unsigned char* state;	// LINE_* of every line
+    int size;
+    int decoded;
+    int has_roi;
+    pthread_mutex_t lock;
+} APEX_Lazy_Code;
+
+/* Whether the line starting at p has the given opcode */
+static int
+line_has_opcode(const char* p, const char* file_end, const char* opcode)
+{
+  while (p < file_end && (*p == ' ' || *p == '\t')) {
+    p++;
+  }
+  size_t length = strlen(opcode);
+  if ((size_t)(file_end - p) < length || memcmp(p, opcode, length) != 0) {
+    return 0;
   }
-  *size = code_memory_size;
-  if (!code_memory_size) {
-    fclose(fp);
+  p += length;
+  return p == file_end || *p == ',' || is_space(*p);
+}
+
+/* Fills the line index entries falling inside the chunk, and looks for ROI_BEGIN */
+static void*
+index_chunk(void* arg)
+{
+  Parse_Chunk* chunk = arg;
+  const char* file_end = chunk->text + chunk->text_size;
+  const char* p = chunk->text + chunk->start;
+  int line = chunk->first_line;
+
+  while (p < chunk->text + chunk->end) {
+    if (line % LAZY_INDEX_STRIDE == 0) {
+      chunk->line_index[line / LAZY_INDEX_STRIDE] = p - chunk->text;
+      release_text(chunk, p);
+    }
+    if (*p == 'R' || *p == ' ' || *p == '\t') {
+      chunk->has_roi |= line_has_opcode(p, file_end, "ROI_BEGIN");
+    }
+    const char* eol = memchr(p, '\n', file_end - p);
+    if (!eol) {
+      break;
+    }
+    p = eol + 1;
+    line++;
+  }
+  return NULL;
+}
+
+/*
+ * Maps the file and indexes its lines in one parallel scan, decoding
+ * nothing. Lines are decoded by APEX_lazy_decode the first time they are
+ * needed, so memory and time follow the executed code. Returns the code
+ * memory, still empty, and its owner in lazy.
+ */
+APEX_Instruction*
+create_lazy_code_memory(const char* filename, int* size, struct APEX_Lazy_Code** lazy)
+{
+  *size = 0;
+  *lazy = NULL;
+  if (!filename) {
+    return NULL;
+  }
+  size_t text_size;
+  const char* text = map_text(filename, &text_size);
+  if (!text) {
     return NULL;
   }
 
-  APEX_Instruction* code_memory =
-          malloc(sizeof(*code_memory) * code_memory_size);
-  if (!code_memory) {
-    fclose(fp);
+  Parse_Chunk chunks[PARSE_MAX_THREADS];
+  int threads;
+  long lines = split_lines(filename, text, text_size, 1, chunks, &threads);
+  APEX_Lazy_Code* code = lines > 0 ? APEX_calloc(1, sizeof(*code)) : NULL;
+  if (code) {
+    code->filename = strdup(filename);
+    code->line_index = APEX_malloc(sizeof(size_t) * (lines / LAZY_INDEX_STRIDE + 1));
+    code->code_memory = APEX_calloc(lines, sizeof(APEX_Instruction));
+    code->state = APEX_calloc(lines, 1);
+  }
+  if (!code || !code->filename || !code->line_index || !code->code_memory || !code->state) {
+    if (code) {
+      APEX_free(code->filename);
+      APEX_free(code->line_index);
+      APEX_free(code->code_memory);
+      APEX_free(code->state);
+      APEX_free(code);
+    }
+    munmap((void*)text, text_size);
     return NULL;
   }
+  for (int i = 0; i < threads; ++i) {
+    chunks[i].line_index = code->line_index;
+  }
+  run_chunks(index_chunk, chunks, threads);
 
-  rewind(fp);
-  int current_instruction = 0;
-  while ((nread = getline(&line, &len, fp)) != -1) {
-    create_APEX_instruction(&code_memory[current_instruction], line);
-    current_instruction++;
+  code->text = text;
+  code->text_size = text_size;
+  code->size = (int)lines;
+  for (int i = 0; i < threads; ++i) {
+    code->has_roi |= chunks[i].has_roi;
   }
+  pthread_mutex_init(&code->lock, NULL);
+  madvise((void*)text, text_size, MADV_DONTNEED);
+  madvise((void*)text, text_size, MADV_RANDOM);
 
-  free(line);
-  fclose(fp);
-  return code_memory;
+  *size = code->size;
+  *lazy = code;
+  return code->code_memory;
+}
+
+/*
+ * Maps an object file as lazy code memory, records are expanded when
+ * first fetched. Its initial data goes into data_memory.
+ */
+APEX_Instruction*
+create_object_code_memory(const char* filename, int* size, struct APEX_Lazy_Code** lazy,
+                          int* data_memory)
+{
+  *size = 0;
+  *lazy = NULL;
+  size_t mapped_size;
+  const APEX_Object_Header* header = APEX_object_map(filename, &mapped_size);
+  if (!header) {
+    return NULL;
+  }
+
+  int count = header->num_instructions;
+  APEX_Lazy_Code* code = APEX_calloc(1, sizeof(*code));
+  if (code) {
+    code->filename = strdup(filename);
+    code->code_memory = APEX_calloc(count, sizeof(APEX_Instruction));
+    code->state = APEX_calloc(count, 1);
+  }
+  if (!code || !code->filename || !code->code_memory || !code->state) {
+    if (code) {
+      APEX_free(code->filename);
+      APEX_free(code->code_memory);
+      APEX_free(code->state);
+      APEX_free(code);
+    }
+    munmap((void*)header, mapped_size);
+    return NULL;
+  }
+
+  code->text = (const char*)header;
+  code->text_size = mapped_size;
+  code->records = (const APEX_Object_Ins*)(header + 1);
+  code->size = count;
+  code->has_roi = (header->flags & OBJECT_HAS_ROI) != 0;
+  pthread_mutex_init(&code->lock, NULL);
+  memcpy(data_memory, code->records + count, sizeof(int) * header->num_data);
+
+  *size = count;
+  *lazy = code;
+  return code->code_memory;
+}
+
+/* Sets the fields of a line, the caller holds the lock */
+static void
+parse_lazy_line(APEX_Lazy_Code* code, int line)
+{
+  const char* file_end = code->text + code->text_size;
+  const char* p = code->text + code->line_index[line / LAZY_INDEX_STRIDE];
+  for (int i = line % LAZY_INDEX_STRIDE; i > 0; --i) {
+    p = line_end(p, file_end) + 1;
+  }
+  APEX_Instruction* ins = &code->code_memory[line];
+  if (create_APEX_instruction(ins, p, line_end(p, file_end))) {
+    /* Too late to fail the load, runs with the missing operands as zero */
+    fprintf(stderr, "APEX_Error : %s:%d: %s is missing operands\n", code->filename, line + 1,
+            ins->opcode);
+  }
+  code->state[line] = LINE_PARSED;
+}
+
+/*
+ * Instruction at a code index, decoded and annotated on first use. Lines
+ * before it in the dependence window are parsed too. The index must be in
+ * the program, APEX_program_at checks it. Safe to call from several threads.
+ */
+APEX_Instruction*
+APEX_lazy_decode(APEX_Lazy_Code* code, int index)
+{
+  if (__atomic_load_n(&code->state[index], __ATOMIC_ACQUIRE) == LINE_DECODED) {
+    return &code->code_memory[index];
+  }
+
+  pthread_mutex_lock(&code->lock);
+  if (code->records && code->state[index] != LINE_DECODED) {
+    /* Annotated when assembled */
+    APEX_object_decode(&code->records[index], &code->code_memory[index]);
+    code->decoded++;
+    __atomic_store_n(&code->state[index], LINE_DECODED, __ATOMIC_RELEASE);
+  }
+  if (code->state[index] != LINE_DECODED) {
+    for (int i = index > DEP_WINDOW ? index - DEP_WINDOW : 0; i <= index; ++i) {
+      if (code->state[i] == LINE_UNDECODED) {
+        parse_lazy_line(code, i);
+      }
+    }
+    annotate_range(code->code_memory, index, index + 1);
+    code->decoded++;
+    __atomic_store_n(&code->state[index], LINE_DECODED, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&code->lock);
+  return &code->code_memory[index];
+}
+
+int
+APEX_lazy_has_roi(APEX_Lazy_Code* code)
+{
+  return code->has_roi;
+}
+
+void
+APEX_lazy_report(APEX_Lazy_Code* code)
+{
+  printf("Lines decoded on demand: %d of %d \n", code->decoded, code->size);
+}
+
+void
+APEX_lazy_free(APEX_Lazy_Code* code)
+{
+  if (!code) {
+    return;
+  }
+  pthread_mutex_destroy(&code->lock);
+  munmap((void*)code->text, code->text_size);
+  APEX_free(code->filename);
+  APEX_free(code->line_index);
+  APEX_free(code->code_memory);
+  APEX_free(code->state);
+  APEX_free(code);
 }
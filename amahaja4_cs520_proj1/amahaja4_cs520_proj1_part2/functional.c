@@ -0,0 +1,93 @@
+/*
+ *  functional.c
+ *  Contains the functional (instruction at a time, no pipeline timing)
+ *  executor of APEX instructions
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+
+static int
+valid_data_address(int address)
+{
+  return address >= 0 && address < DATA_MEMORY_SIZE;
+}
+
+/*
+ * Executes the instruction at cpu->pc on the architectural state (registers,
+ * zero flag and data memory) and moves cpu->pc to the next instruction.
+ * Pipeline latches and statistics are not touched.
+ */
+int
+APEX_functional_step(APEX_CPU* cpu)
+{
+  int index = get_code_index(cpu->pc);
+  if (index < 0 || index >= cpu->code_memory_size) {
+    return FUNCTIONAL_END;
+  }
+
+  const APEX_Instruction* ins = APEX_code_at(cpu, index);
+  int next_pc = cpu->pc + 4;
+
+  if (strcmp(ins->opcode, "ADD") == 0) {
+    cpu->regs[ins->rd] = cpu->regs[ins->rs1] + cpu->regs[ins->rs2];
+    cpu->zero_flag = cpu->regs[ins->rd] == 0 ? 1 : 0;
+  }
+  else if (strcmp(ins->opcode, "SUB") == 0) {
+    cpu->regs[ins->rd] = cpu->regs[ins->rs1] - cpu->regs[ins->rs2];
+    cpu->zero_flag = cpu->regs[ins->rd] == 0 ? 1 : 0;
+  }
+  else if (strcmp(ins->opcode, "MUL") == 0) {
+    cpu->regs[ins->rd] = cpu->regs[ins->rs1] * cpu->regs[ins->rs2];
+    cpu->zero_flag = cpu->regs[ins->rd] == 0 ? 1 : 0;
+  }
+  else if (strcmp(ins->opcode, "AND") == 0) {
+    cpu->regs[ins->rd] = cpu->regs[ins->rs1] & cpu->regs[ins->rs2];
+  }
+  else if (strcmp(ins->opcode, "OR") == 0) {
+    cpu->regs[ins->rd] = cpu->regs[ins->rs1] | cpu->regs[ins->rs2];
+  }
+  else if (strcmp(ins->opcode, "EX-OR") == 0) {
+    cpu->regs[ins->rd] = cpu->regs[ins->rs1] ^ cpu->regs[ins->rs2];
+  }
+  else if (strcmp(ins->opcode, "MOVC") == 0) {
+    cpu->regs[ins->rd] = ins->imm + 0;
+  }
+  else if (strcmp(ins->opcode, "LOAD") == 0) {
+    int address = cpu->regs[ins->rs1] + ins->imm;
+    if (!valid_data_address(address)) {
+      return FUNCTIONAL_ERROR;
+    }
+    cpu->regs[ins->rd] = cpu->data_memory[address];
+  }
+  else if (strcmp(ins->opcode, "STORE") == 0) {
+    int address = cpu->regs[ins->rs2] + ins->imm;
+    if (!valid_data_address(address)) {
+      return FUNCTIONAL_ERROR;
+    }
+    cpu->data_memory[address] = cpu->regs[ins->rs1];
+    cpu->dirty_pages[address / DATA_PAGE_SIZE] = 1;
+  }
+  else if (strcmp(ins->opcode, "BZ") == 0) {
+    if (cpu->zero_flag) {
+      next_pc = cpu->pc + ins->imm;
+    }
+  }
+  else if (strcmp(ins->opcode, "BNZ") == 0) {
+    if (!cpu->zero_flag) {
+      next_pc = cpu->pc + ins->imm;
+    }
+  }
+  else if (strcmp(ins->opcode, "JUMP") == 0) {
+    next_pc = cpu->regs[ins->rs1] + ins->imm;
+  }
+  else if (strcmp(ins->opcode, "HALT") == 0) {
+    cpu->pc = next_pc;
+    return FUNCTIONAL_HALT;
+  }
+
+  cpu->pc = next_pc;
+  return FUNCTIONAL_OK;
+}
@@ -0,0 +1,435 @@
+/*
+ *  interval.c
+ *  Contains the interval-analysis timing model, its calibration against
+ *  the detailed pipeline and the comparison of the two
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "interval.h"
+#include "arena.h"
+
+/* Kernels are timed at two lengths, the difference cancels fill and drain */
+#define KERNEL_SHORT 8
+#define KERNEL_LONG 24
+
+/* Zeroed entries after a kernel, fetch runs a little past HALT */
+#define KERNEL_PADDING 4
+
+#define KERNEL_MAX_CYCLES 100000
+
+/* One instruction of a calibration kernel */
+typedef struct Kernel_Ins
+{
+    const char* opcode;
+    int rd;
+    int rs1;
+    int rs2;
+    int imm;
+    int to_next;		// imm is replaced by the address of the next instruction
+} Kernel_Ins;
+
+/* R14 and R15 stay 0. The prefix sets the zero flag */
+static const Kernel_Ins kernel_prefix = { "SUB", 13, 14, 15, 0, 0 };
+
+static const Kernel_Ins kernel_base[] = { { "MOVC", 1, 0, 0, 1, 0 } };
+static const Kernel_Ins kernel_alu[] = { { "ADD", 1, 1, 14, 0, 0 } };
+static const Kernel_Ins kernel_load[] = { { "LOAD", 1, 15, 0, 0, 0 }, { "ADD", 2, 1, 14, 0, 0 } };
+static const Kernel_Ins kernel_mul[] = { { "MUL", 1, 14, 15, 0, 0 } };
+static const Kernel_Ins kernel_mul_chain[] = { { "MUL", 1, 1, 14, 0, 0 } };
+static const Kernel_Ins kernel_branch[] = { { "MOVC", 1, 0, 0, 0, 0 }, { "BNZ", 0, 0, 0, 4, 0 } };
+static const Kernel_Ins kernel_zero_flag[] = { { "SUB", 1, 14, 15, 0, 0 }, { "BNZ", 0, 0, 0, 4, 0 } };
+static const Kernel_Ins kernel_taken[] = { { "SUB", 1, 14, 15, 0, 0 }, { "BZ", 0, 0, 0, 4, 0 } };
+static const Kernel_Ins kernel_jump[] = { { "JUMP", 0, 15, 0, 0, 1 } };
+
+#define KERNEL(k) k, (int)(sizeof(k) / sizeof(k[0]))
+
+static const char* event_names[INTERVAL_NUM_EVENTS] = {
+  "load-use", "dependence", "MUL", "zero flag", "taken branch", "JUMP"
+};
+
+/*
+ * Runs the prefix, repeat copies of the pattern and HALT on the detailed
+ * pipeline. Returns the cycles taken, -1 on failure.
+ */
+static int
+time_kernel(APEX_CPU* cpu, const Kernel_Ins* pattern, int length, int repeat)
+{
+  int size = 1 + length * repeat + 1;
+  APEX_Instruction* code = APEX_calloc(size + KERNEL_PADDING, sizeof(*code));
+  APEX_CPU* k = code ? APEX_cpu_clone(cpu) : NULL;
+  if (!k) {
+    APEX_free(code);
+    return -1;
+  }
+
+  for (int i = 0; i < size - 1; ++i) {
+    const Kernel_Ins* src = i == 0 ? &kernel_prefix : &pattern[(i - 1) % length];
+    APEX_Instruction* ins = &code[i];
+    strcpy(ins->opcode, src->opcode);
+    ins->rd = src->rd;
+    ins->rs1 = src->rs1;
+    ins->rs2 = src->rs2;
+    ins->imm = src->to_next ? 4000 + (i + 1) * 4 : src->imm;
+  }
+  strcpy(code[size - 1].opcode, "HALT");
+  APEX_annotate_dependences(code, size);
+
+  k->code_memory = code;
+  k->program = NULL;
+  k->code_memory_size = size;
+  k->pc = 4000;
+  k->clock = 0;
+  k->ins_completed = 0;
+  k->zero_flag = 0;
+  k->roi_mode = 0;
+  k->in_roi = 0;
+  memset(k->regs, 0, sizeof(k->regs));
+  APEX_cpu_reset_pipeline(k);
+
+  while (!APEX_cpu_halted(k) && k->clock < KERNEL_MAX_CYCLES) {
+    APEX_cpu_step(k);
+  }
+  int clock = APEX_cpu_halted(k) ? k->clock : -1;
+
+  APEX_free(k);
+  APEX_free(code);
+  return clock;
+}
+
+/* Cycles per copy of the pattern in steady state, rounded */
+static int
+pattern_cost(APEX_CPU* cpu, const Kernel_Ins* pattern, int length, int* failed)
+{
+  int short_run = time_kernel(cpu, pattern, length, KERNEL_SHORT);
+  int long_run = time_kernel(cpu, pattern, length, KERNEL_LONG);
+  if (short_run < 0 || long_run < 0) {
+    *failed = 1;
+    return 0;
+  }
+  int repeats = KERNEL_LONG - KERNEL_SHORT;
+  return (long_run - short_run + repeats / 2) / repeats;
+}
+
+static int
+non_negative(int value)
+{
+  return value < 0 ? 0 : value;
+}
+
+/*
+ * Derives the model parameters for the timing configuration of the cpu by
+ * timing one kernel per latency or penalty on the detailed pipeline.
+ */
+int
+APEX_interval_calibrate(APEX_CPU* cpu, APEX_Interval_Params* params)
+{
+  int saved_debug = ENABLE_DEBUG_MESSAGES;
+  int failed = 0;
+  ENABLE_DEBUG_MESSAGES = 0;
+
+  int base = pattern_cost(cpu, KERNEL(kernel_base), &failed);
+  int alu = pattern_cost(cpu, KERNEL(kernel_alu), &failed);
+  int load = pattern_cost(cpu, KERNEL(kernel_load), &failed);
+  int mul = pattern_cost(cpu, KERNEL(kernel_mul), &failed);
+  int mul_chain = pattern_cost(cpu, KERNEL(kernel_mul_chain), &failed);
+  int branch = pattern_cost(cpu, KERNEL(kernel_branch), &failed);
+  int zero_flag = pattern_cost(cpu, KERNEL(kernel_zero_flag), &failed);
+  int taken = pattern_cost(cpu, KERNEL(kernel_taken), &failed);
+  int jump = pattern_cost(cpu, KERNEL(kernel_jump), &failed);
+  int empty = time_kernel(cpu, kernel_base, 1, 0);
+
+  ENABLE_DEBUG_MESSAGES = saved_debug;
+  if (failed || empty < 0) {
+    return -1;
+  }
+
+  params->base = base > 0 ? base : 1;
+  params->alu_latency = non_negative(alu);
+  params->load_latency = non_negative(load - base);
+  params->mul_latency = non_negative(mul_chain);
+  params->mul_occupancy = non_negative(mul - base);
+  params->branch_extra = non_negative(branch - 2 * base);
+  params->z_latency = non_negative(zero_flag - base);
+  params->taken_penalty = non_negative(taken - zero_flag);
+  params->jump_penalty = non_negative(jump - base);
+  /* The prefix issues at 0 and HALT one base interval later */
+  params->fill_drain = non_negative(empty - base);
+  return 0;
+}
+
+static int
+valid_register(int r)
+{
+  return r >= 0 && r < 16;
+}
+
+/* Delays issue until register r is ready, charging the wait to its producer */
+static long
+wait_for(long issue, long ready, int event, APEX_Interval_Result* result)
+{
+  if (ready > issue) {
+    result->events[event]++;
+    result->event_cycles[event] += ready - issue;
+    return ready;
+  }
+  return issue;
+}
+
+/* Operands and result of an instruction as the model sees it */
+typedef struct Ins_Class
+{
+    int reads_rs1;
+    int reads_rs2;
+    int writes_rd;
+    int sets_z;
+    int branch;		// BZ or BNZ, waits for the zero flag
+    int latency;	// Until a consumer of rd may issue
+    int event;		// Charged with that wait
+} Ins_Class;
+
+static void
+classify(const APEX_Interval_Params* params, const char* op, Ins_Class* c)
+{
+  memset(c, 0, sizeof(*c));
+  c->latency = params->alu_latency;
+  c->event = INTERVAL_DEPENDENCE;
+  if (strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0) {
+    c->reads_rs1 = c->reads_rs2 = c->writes_rd = c->sets_z = 1;
+  } else if (strcmp(op, "MUL") == 0) {
+    c->reads_rs1 = c->reads_rs2 = c->writes_rd = c->sets_z = 1;
+    c->latency = params->mul_latency;
+  } else if (strcmp(op, "AND") == 0 || strcmp(op, "OR") == 0 || strcmp(op, "EX-OR") == 0) {
+    c->reads_rs1 = c->reads_rs2 = c->writes_rd = 1;
+  } else if (strcmp(op, "MOVC") == 0) {
+    c->writes_rd = 1;
+  } else if (strcmp(op, "LOAD") == 0) {
+    c->reads_rs1 = c->writes_rd = 1;
+    c->latency = params->load_latency;
+    c->event = INTERVAL_LOAD_USE;
+  } else if (strcmp(op, "STORE") == 0) {
+    c->reads_rs1 = c->reads_rs2 = 1;
+  } else if (strcmp(op, "JUMP") == 0) {
+    c->reads_rs1 = 1;
+  } else if (strcmp(op, "BZ") == 0 || strcmp(op, "BNZ") == 0) {
+    c->branch = 1;
+  }
+}
+
+/*
+ * Static estimate for count instructions of straight-line code entered
+ * with every source and the zero flag ready. Fills cycles[i] with the
+ * cycles instruction i adds, the MUL occupancy it causes included. The
+ * penalty of a taken branch or JUMP ending the run is left to the caller.
+ * Returns the total.
+ */
+int
+APEX_interval_block_cycles(const APEX_Interval_Params* params, const APEX_Instruction* code,
+                           int count, int* cycles)
+{
+  APEX_Interval_Result scratch;
+  long ready[16] = { 0 };
+  long z_ready = 0;
+  long issue = 0;
+  long previous = 0;
+  int penalty = 0;
+  memset(&scratch, 0, sizeof(scratch));
+
+  for (int i = 0; i < count; ++i) {
+    const APEX_Instruction* ins = &code[i];
+    Ins_Class c;
+    classify(params, ins->opcode, &c);
+
+    issue += (i ? params->base : 0) + penalty;
+    if (c.branch) {
+      issue += params->branch_extra;
+      issue = wait_for(issue, z_ready, INTERVAL_ZERO_FLAG, &scratch);
+    }
+    if (c.reads_rs1 && valid_register(ins->rs1)) {
+      issue = wait_for(issue, ready[ins->rs1], c.event, &scratch);
+    }
+    if (c.reads_rs2 && valid_register(ins->rs2)) {
+      issue = wait_for(issue, ready[ins->rs2], c.event, &scratch);
+    }
+    if (c.writes_rd && valid_register(ins->rd)) {
+      ready[ins->rd] = issue + c.latency;
+    }
+    if (c.sets_z) {
+      z_ready = issue + params->z_latency;
+    }
+    penalty = strcmp(ins->opcode, "MUL") == 0 ? params->mul_occupancy : 0;
+
+    /* The last one also pays for the interval to the instruction after it */
+    long next = i + 1 == count ? issue + params->base + penalty : issue;
+    cycles[i] = (int)(next - previous);
+    previous = next;
+  }
+  return (int)previous;
+}
+
+/*
+ * Runs the program functionally on a copy of the cpu and estimates its
+ * cycles. Stops at HALT, when the PC leaves the code, or once the estimate
+ * reaches the cycle limit of the cpu. Returns the copy holding the final
+ * architectural state, NULL on failure.
+ */
+APEX_CPU*
+APEX_interval_estimate(APEX_CPU* cpu, const APEX_Interval_Params* params,
+                       APEX_Interval_Result* result)
+{
+  APEX_CPU* fcpu = APEX_cpu_clone(cpu);
+  if (!fcpu) {
+    return NULL;
+  }
+  memset(result, 0, sizeof(*result));
+
+  /* Earliest issue cycle of a consumer of each register and of the zero flag */
+  long ready[16] = { 0 };
+  int ready_event[16] = { 0 };
+  long z_ready = 0;
+
+  long issue = -params->base;
+  int penalty = 0;
+  int penalty_event = 0;
+
+  while (1) {
+    if (cpu->function_cycles > 0 && result->instructions &&
+        issue + params->fill_drain >= cpu->function_cycles) {
+      break;
+    }
+    int index = get_code_index(fcpu->pc);
+    if (index < 0 || index >= fcpu->code_memory_size) {
+      break;
+    }
+    const APEX_Instruction* ins = APEX_code_at(fcpu, index);
+    const char* op = ins->opcode;
+
+    issue += params->base + penalty;
+    result->event_cycles[penalty_event] += penalty;
+
+    Ins_Class c;
+    classify(params, op, &c);
+    if (c.branch) {
+      if (params->branch_extra) {
+        issue = wait_for(issue, issue + params->branch_extra, INTERVAL_ZERO_FLAG, result);
+      }
+      issue = wait_for(issue, z_ready, INTERVAL_ZERO_FLAG, result);
+    }
+
+    if (c.reads_rs1 && valid_register(ins->rs1)) {
+      issue = wait_for(issue, ready[ins->rs1], ready_event[ins->rs1], result);
+    }
+    if (c.reads_rs2 && valid_register(ins->rs2)) {
+      issue = wait_for(issue, ready[ins->rs2], ready_event[ins->rs2], result);
+    }
+
+    int pc = fcpu->pc;
+    int status = APEX_functional_step(fcpu);
+    if (status == FUNCTIONAL_ERROR) {
+      fprintf(stderr, "APEX_Error : Data memory access out of range at pc %d\n", pc);
+      APEX_free(fcpu);
+      return NULL;
+    }
+    result->instructions++;
+
+    if (c.writes_rd && valid_register(ins->rd)) {
+      ready[ins->rd] = issue + c.latency;
+      ready_event[ins->rd] = c.event;
+    }
+    if (c.sets_z) {
+      z_ready = issue + params->z_latency;
+    }
+
+    penalty = 0;
+    if (strcmp(op, "MUL") == 0) {
+      penalty = params->mul_occupancy;
+      penalty_event = INTERVAL_MUL;
+    } else if (strcmp(op, "JUMP") == 0) {
+      penalty = params->jump_penalty;
+      penalty_event = INTERVAL_JUMP;
+    } else if ((strcmp(op, "BZ") == 0 || strcmp(op, "BNZ") == 0) && fcpu->pc != pc + 4) {
+      penalty = params->taken_penalty;
+      penalty_event = INTERVAL_TAKEN_BRANCH;
+    }
+    if (penalty) {
+      result->events[penalty_event]++;
+    }
+
+    if (status == FUNCTIONAL_HALT) {
+      break;
+    }
+  }
+
+  result->cycles = result->instructions ? issue + params->fill_drain : 0;
+  return fcpu;
+}
+
+/* Percentage by which estimate misses actual */
+static double
+relative_error(double estimate, double actual)
+{
+  return actual ? 100.0 * (estimate - actual) / actual : 0;
+}
+
+/*
+ *  Interval model replacement for APEX_cpu_run. With check set, the
+ *  detailed pipeline also runs the program and the error is reported.
+ */
+int
+APEX_interval_run(APEX_CPU* cpu, int check)
+{
+  APEX_Interval_Params params;
+  if (APEX_interval_calibrate(cpu, &params)) {
+    fprintf(stderr, "APEX_Error : Interval model calibration failed\n");
+    return -1;
+  }
+
+  APEX_Interval_Result result;
+  APEX_CPU* final = APEX_interval_estimate(cpu, &params, &result);
+  if (!final) {
+    return -1;
+  }
+
+  printf("(apex) >> Interval model: base %d, latency ALU %d LOAD %d MUL %d, MUL occupancy +%d, "
+         "zero flag %d (+%d), taken branch +%d, JUMP +%d, fill/drain %d\n",
+         params.base, params.alu_latency, params.load_latency, params.mul_latency,
+         params.mul_occupancy, params.z_latency, params.branch_extra, params.taken_penalty,
+         params.jump_penalty, params.fill_drain);
+  printf("%-14s %-10s %s\n", "event", "count", "cycles");
+  for (int e = 0; e < INTERVAL_NUM_EVENTS; ++e) {
+    printf("%-14s %-10ld %ld\n", event_names[e], result.events[e], result.event_cycles[e]);
+  }
+
+  double cpi = result.instructions ? (double)result.cycles / result.instructions : 0;
+  printf("(apex) >> Simulation Complete \n");
+  printf("Total Instructions Present: %d, Total instructions processed: %ld \n",
+         cpu->code_memory_size, result.instructions);
+  printf("Estimated clock cycles: %ld (CPI %.3f) \n", result.cycles, cpi);
+
+  if (check) {
+    int saved_debug = ENABLE_DEBUG_MESSAGES;
+    APEX_CPU* detailed = APEX_cpu_clone(cpu);
+    if (!detailed) {
+      APEX_free(final);
+      return -1;
+    }
+    ENABLE_DEBUG_MESSAGES = 0;
+    while (!APEX_cpu_halted(detailed) && detailed->clock != cpu->function_cycles) {
+      APEX_cpu_step(detailed);
+    }
+    ENABLE_DEBUG_MESSAGES = saved_debug;
+
+    double detailed_cpi = detailed->ins_completed ?
+                          (double)detailed->clock / detailed->ins_completed : 0;
+    printf("Detailed pipeline: %d clock cycles, %d instructions (CPI %.3f) \n",
+           detailed->clock, detailed->ins_completed, detailed_cpi);
+    printf("Interval model error: cycles %+.2f%%, CPI %+.2f%% \n",
+           relative_error(result.cycles, detailed->clock), relative_error(cpi, detailed_cpi));
+    APEX_free(detailed);
+  }
+
+  Print_regs_content(final);
+  APEX_free(final);
+  return 0;
+}
@@ -0,0 +1,67 @@
+#ifndef _APEX_INTERVAL_H_
+#define _APEX_INTERVAL_H_
+/**
+ *  interval.h
+ *  Contains data structures for the interval-analysis timing model
+ *
+ *  The model walks the functional instruction stream once. Instructions
+ *  issue one base interval apart unless a miss event holds them back:
+ *  a source produced too recently (load-use and other dependences), MUL
+ *  occupying execute, the zero flag of a branch not ready yet, or the
+ *  refill after a taken branch or JUMP. Every latency and penalty is
+ *  calibrated by timing small kernels on the detailed pipeline with the
+ *  cpu's timing configuration.
+ */
+
+#include "cpu.h"
+
+/* Calibrated latencies and penalties, all in cycles */
+typedef struct APEX_Interval_Params
+{
+    int base;		    // Between independent instructions
+    int alu_latency;	// From an ALU or MOVC producer to a dependent instruction
+    int load_latency;	// From LOAD to a dependent instruction
+    int mul_latency;	// From MUL to a dependent instruction
+    int mul_occupancy;	// Extra cycles MUL holds execute
+    int z_latency;		// From ADD/SUB/MUL to BZ/BNZ
+    int branch_extra;	// BZ/BNZ without a recent zero flag producer
+    int taken_penalty;	// Refill after a taken BZ/BNZ
+    int jump_penalty;	// Refill after JUMP
+    int fill_drain;		// Pipeline fill and drain around the whole run
+} APEX_Interval_Params;
+
+/* Miss events seen and the cycles charged to them */
+enum
+{
+    INTERVAL_LOAD_USE,
+    INTERVAL_DEPENDENCE,
+    INTERVAL_MUL,
+    INTERVAL_ZERO_FLAG,
+    INTERVAL_TAKEN_BRANCH,
+    INTERVAL_JUMP,
+    INTERVAL_NUM_EVENTS
+};
+
+typedef struct APEX_Interval_Result
+{
+    long instructions;
+    long cycles;
+    long events[INTERVAL_NUM_EVENTS];
+    long event_cycles[INTERVAL_NUM_EVENTS];
+} APEX_Interval_Result;
+
+int
+APEX_interval_calibrate(APEX_CPU* cpu, APEX_Interval_Params* params);
+
+int
+APEX_interval_block_cycles(const APEX_Interval_Params* params, const APEX_Instruction* code,
+                           int count, int* cycles);
+
+APEX_CPU*
+APEX_interval_estimate(APEX_CPU* cpu, const APEX_Interval_Params* params,
+                       APEX_Interval_Result* result);
+
+int
+APEX_interval_run(APEX_CPU* cpu, int check);
+
+#endif
@@ -0,0 +1,557 @@
+/*
+ *  jit.c
+ *  Contains the translation of APEX blocks into x86-64 code, the code
+ *  cache and the dispatcher running translations from the functional
+ *  executor
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jit.h"
+#include "arena.h"
+#include "stats.h"
+
+#if defined(__x86_64__)
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#if (DATA_PAGE_SIZE & (DATA_PAGE_SIZE - 1)) != 0
+#error "The translated STORE marks dirty pages with a shift, DATA_PAGE_SIZE must be a power of two"
+#endif
+
+/* Return values of a translation back to the dispatcher, >= 0 is an exit index */
+#define JIT_DYNAMIC -1		// cpu->pc was computed, look it up
+#define JIT_STOP -2		    // Out of budget or out of range access, interpreter goes next
+
+/* Code of the trampolines, translations start after it */
+#define JIT_TRAMPOLINE_SIZE 64
+
+/* Room a block may take, checked before translating it */
+#define JIT_BLOCK_ROOM (JIT_MAX_BLOCK * 96 + 256)
+
+#define OFF_REG(r) ((int)(offsetof(APEX_CPU, regs) + 4 * (r)))
+#define OFF_PC ((int)offsetof(APEX_CPU, pc))
+#define OFF_ZERO_FLAG ((int)offsetof(APEX_CPU, zero_flag))
+#define OFF_DATA ((int)offsetof(APEX_CPU, data_memory))
+#define OFF_DIRTY ((int)offsetof(APEX_CPU, dirty_pages))
+
+enum
+{
+    JIT_ADD,
+    JIT_SUB,
+    JIT_MUL,
+    JIT_AND,
+    JIT_OR,
+    JIT_EXOR,
+    JIT_MOVC,
+    JIT_LOAD,
+    JIT_STORE,
+    JIT_BZ,
+    JIT_BNZ,
+    JIT_JUMP,
+    JIT_UNSUPPORTED
+};
+
+typedef int (*jit_enter_fn)(APEX_CPU* cpu, long* budget, unsigned char* block);
+
+static int
+classify(const APEX_Instruction* ins)
+{
+  static const char* opcodes[] = { "ADD", "SUB", "MUL", "AND", "OR", "EX-OR",
+                                   "MOVC", "LOAD", "STORE", "BZ", "BNZ", "JUMP" };
+  int op = JIT_UNSUPPORTED;
+  for (int i = 0; i < JIT_UNSUPPORTED; ++i) {
+    if (strcmp(ins->opcode, opcodes[i]) == 0) {
+      op = i;
+      break;
+    }
+  }
+
+  /* Register numbers are baked into addresses, leave bad ones to the interpreter */
+  int rd = op <= JIT_MOVC || op == JIT_LOAD;
+  int rs1 = op <= JIT_EXOR || op == JIT_LOAD || op == JIT_STORE || op == JIT_JUMP;
+  int rs2 = op <= JIT_EXOR || op == JIT_STORE;
+  if ((rd && (ins->rd < 0 || ins->rd >= 16)) || (rs1 && (ins->rs1 < 0 || ins->rs1 >= 16)) ||
+      (rs2 && (ins->rs2 < 0 || ins->rs2 >= 16))) {
+    return JIT_UNSUPPORTED;
+  }
+  return op;
+}
+
+static int
+page_shift()
+{
+  int shift = 0;
+  while ((1 << shift) < DATA_PAGE_SIZE) {
+    shift++;
+  }
+  return shift;
+}
+
+static void
+emit1(APEX_Jit* jit, int byte)
+{
+  jit->code[jit->used++] = (unsigned char)byte;
+}
+
+static void
+emit4(APEX_Jit* jit, int value)
+{
+  memcpy(jit->code + jit->used, &value, 4);
+  jit->used += 4;
+}
+
+static void
+patch4(unsigned char* at, int value)
+{
+  memcpy(at, &value, 4);
+}
+
+/* jmp rel32 to target */
+static void
+emit_jmp(APEX_Jit* jit, unsigned char* target)
+{
+  emit1(jit, 0xE9);
+  emit4(jit, (int)(target - (jit->code + jit->used + 4)));
+}
+
+/* <opcode> <reg>, [rbx + disp32], reg 0 is eax and 1 is ecx */
+static void
+emit_rbx(APEX_Jit* jit, int opcode, int reg, int disp)
+{
+  if (opcode > 0xFF) {
+    emit1(jit, opcode >> 8);
+  }
+  emit1(jit, opcode & 0xFF);
+  emit1(jit, 0x83 | (reg << 3));
+  emit4(jit, disp);
+}
+
+/* mov dword [rbx + disp32], imm32 */
+static void
+emit_store_imm(APEX_Jit* jit, int disp, int value)
+{
+  emit1(jit, 0xC7);
+  emit1(jit, 0x83);
+  emit4(jit, disp);
+  emit4(jit, value);
+}
+
+/* zero_flag = eax == 0 */
+static void
+emit_zero_flag(APEX_Jit* jit)
+{
+  emit1(jit, 0x31);	// xor ecx, ecx
+  emit1(jit, 0xC9);
+  emit1(jit, 0x85);	// test eax, eax
+  emit1(jit, 0xC0);
+  emit1(jit, 0x0F);	// sete cl
+  emit1(jit, 0x94);
+  emit1(jit, 0xC1);
+  emit_rbx(jit, 0x89, 1, OFF_ZERO_FLAG);
+}
+
+/* Sets the pc, gives back unused budget and returns JIT_STOP */
+static void
+emit_stop(APEX_Jit* jit, int pc, int budget_back)
+{
+  if (budget_back) {
+    emit1(jit, 0x49);	// add r13, imm32
+    emit1(jit, 0x81);
+    emit1(jit, 0xC5);
+    emit4(jit, budget_back);
+  }
+  emit_store_imm(jit, OFF_PC, pc);
+  emit1(jit, 0xB8);	// mov eax, imm32
+  emit4(jit, JIT_STOP);
+  emit_jmp(jit, jit->leave);
+}
+
+/*
+ * eax = data memory address, leaves for the interpreter if out of range.
+ * remaining is the budget already taken for the faulting instruction and
+ * the ones after it in the block.
+ */
+static void
+emit_address_check(APEX_Jit* jit, int base_reg, int imm, int pc, int remaining)
+{
+  emit_rbx(jit, 0x8B, 0, OFF_REG(base_reg));
+  emit1(jit, 0x05);	// add eax, imm32
+  emit4(jit, imm);
+  emit1(jit, 0x3D);	// cmp eax, imm32
+  emit4(jit, DATA_MEMORY_SIZE);
+  emit1(jit, 0x72);	// jb rel8, unsigned so negative addresses fail too
+  int skip = jit->used;
+  emit1(jit, 0);
+  emit_stop(jit, pc, remaining);
+  jit->code[skip] = (unsigned char)(jit->used - skip - 1);
+}
+
+/* Exit to a fixed target, a jmp to the next instruction until chained */
+static int
+emit_exit(APEX_Jit* jit, int target_pc)
+{
+  if (jit->num_exits == jit->exits_capacity) {
+    int capacity = jit->exits_capacity ? 2 * jit->exits_capacity : 256;
+    APEX_Jit_Exit* exits = APEX_realloc(jit->exits, capacity * sizeof(*exits));
+    if (!exits) {
+      return -1;
+    }
+    jit->exits = exits;
+    jit->exits_capacity = capacity;
+  }
+  APEX_Jit_Exit* exit = &jit->exits[jit->num_exits];
+  exit->jump = jit->code + jit->used;
+  exit->target_pc = target_pc;
+  emit1(jit, 0xE9);
+  emit4(jit, 0);
+  emit_store_imm(jit, OFF_PC, target_pc);
+  emit1(jit, 0xB8);	// mov eax, exit index
+  emit4(jit, jit->num_exits);
+  emit_jmp(jit, jit->leave);
+  jit->num_exits++;
+  return 0;
+}
+
+static void
+emit_trampolines(APEX_Jit* jit)
+{
+  static const unsigned char enter[] = {
+    0x53,			        // push rbx
+    0x41, 0x54,		        // push r12
+    0x41, 0x55,		        // push r13
+    0x48, 0x89, 0xFB,	    // mov rbx, rdi     cpu
+    0x49, 0x89, 0xF4,	    // mov r12, rsi     &budget
+    0x4D, 0x8B, 0x2C, 0x24,	// mov r13, [r12]
+    0xFF, 0xE2		        // jmp rdx          block
+  };
+  static const unsigned char leave[] = {
+    0x4D, 0x89, 0x2C, 0x24,	// mov [r12], r13
+    0x41, 0x5D,		        // pop r13
+    0x41, 0x5C,		        // pop r12
+    0x5B,			        // pop rbx
+    0xC3			        // ret
+  };
+  jit->enter = jit->code;
+  memcpy(jit->enter, enter, sizeof(enter));
+  jit->leave = jit->code + sizeof(enter);
+  memcpy(jit->leave, leave, sizeof(leave));
+  jit->used = JIT_TRAMPOLINE_SIZE;
+}
+
+/*
+ * Switches the code cache between RW, to translate and chain, and RX, to
+ * run, so that it is never writable and executable at once. Returns 0 on
+ * success.
+ */
+static int
+set_writable(APEX_Jit* jit, int writable)
+{
+  if (jit->writable == writable) {
+    return 0;
+  }
+  int prot = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+  if (mprotect(jit->code, JIT_CODE_SIZE, prot)) {
+    return -1;
+  }
+  jit->writable = writable;
+  return 0;
+}
+
+/* Drops every translation */
+static void
+flush(APEX_Jit* jit)
+{
+  jit->used = JIT_TRAMPOLINE_SIZE;
+  memset(jit->blocks, 0, jit->code_memory_size * sizeof(*jit->blocks));
+  jit->num_exits = 0;
+  jit->flushes++;
+}
+
+/*
+ * Translates the block starting at code index start, whose first
+ * instruction is supported. Returns NULL if out of memory for its exits
+ * or if the code cache cannot be made writable.
+ */
+static unsigned char*
+translate(APEX_Jit* jit, APEX_CPU* cpu, int start)
+{
+  if (set_writable(jit, 1)) {
+    return NULL;
+  }
+  if (JIT_CODE_SIZE - jit->used < JIT_BLOCK_ROOM) {
+    flush(jit);
+  }
+  int used = jit->used;
+  int num_exits = jit->num_exits;
+  unsigned char* block = jit->code + jit->used;
+
+  /* Budget check, the length is patched in at the end */
+  emit1(jit, 0x49);	// cmp r13, imm32
+  emit1(jit, 0x81);
+  emit1(jit, 0xFD);
+  int cmp_length = jit->used;
+  emit4(jit, 0);
+  emit1(jit, 0x0F);	// jl rel32
+  emit1(jit, 0x8C);
+  int budget_exit = jit->used;
+  emit4(jit, 0);
+  emit1(jit, 0x49);	// sub r13, imm32
+  emit1(jit, 0x81);
+  emit1(jit, 0xED);
+  int sub_length = jit->used;
+  emit4(jit, 0);
+
+  /* Body first, then the length is known for the out of range exits */
+  int length = 0;
+  while (length < JIT_MAX_BLOCK && start + length < cpu->code_memory_size) {
+    int op = classify(APEX_code_at(cpu, start + length));
+    if (op == JIT_UNSUPPORTED) {
+      break;
+    }
+    length++;
+    if (op >= JIT_BZ) {
+      break;
+    }
+  }
+
+  int failed = 0;
+  for (int i = 0; i < length; ++i) {
+    const APEX_Instruction* ins = APEX_code_at(cpu, start + i);
+    int pc = 4000 + 4 * (start + i);
+    int op = classify(ins);
+    switch (op) {
+      case JIT_ADD:
+      case JIT_SUB:
+      case JIT_MUL:
+      case JIT_AND:
+      case JIT_OR:
+      case JIT_EXOR: {
+        static const int opcodes[] = { 0x03, 0x2B, 0x0FAF, 0x23, 0x0B, 0x33 };
+        emit_rbx(jit, 0x8B, 0, OFF_REG(ins->rs1));
+        emit_rbx(jit, opcodes[op - JIT_ADD], 0, OFF_REG(ins->rs2));
+        emit_rbx(jit, 0x89, 0, OFF_REG(ins->rd));
+        if (op <= JIT_MUL) {
+          emit_zero_flag(jit);
+        }
+        break;
+      }
+      case JIT_MOVC:
+        emit_store_imm(jit, OFF_REG(ins->rd), ins->imm);
+        break;
+      case JIT_LOAD:
+        emit_address_check(jit, ins->rs1, ins->imm, pc, length - i);
+        emit1(jit, 0x8B);	// mov eax, [rbx + rax * 4 + data_memory]
+        emit1(jit, 0x84);
+        emit1(jit, 0x83);
+        emit4(jit, OFF_DATA);
+        emit_rbx(jit, 0x89, 0, OFF_REG(ins->rd));
+        break;
+      case JIT_STORE:
+        emit_address_check(jit, ins->rs2, ins->imm, pc, length - i);
+        emit_rbx(jit, 0x8B, 1, OFF_REG(ins->rs1));
+        emit1(jit, 0x89);	// mov [rbx + rax * 4 + data_memory], ecx
+        emit1(jit, 0x8C);
+        emit1(jit, 0x83);
+        emit4(jit, OFF_DATA);
+        emit1(jit, 0xC1);	// shr eax, page shift
+        emit1(jit, 0xE8);
+        emit1(jit, page_shift());
+        emit1(jit, 0xC6);	// mov byte [rbx + rax + dirty_pages], 1
+        emit1(jit, 0x84);
+        emit1(jit, 0x03);
+        emit4(jit, OFF_DIRTY);
+        emit1(jit, 1);
+        break;
+      case JIT_BZ:
+      case JIT_BNZ: {
+        emit1(jit, 0x83);	// cmp dword [rbx + zero_flag], 0
+        emit1(jit, 0xBB);
+        emit4(jit, OFF_ZERO_FLAG);
+        emit1(jit, 0);
+        emit1(jit, 0x0F);	// jne/je rel32 to the taken exit
+        emit1(jit, op == JIT_BZ ? 0x85 : 0x84);
+        int taken = jit->used;
+        emit4(jit, 0);
+        failed |= emit_exit(jit, pc + 4);
+        patch4(jit->code + taken, jit->used - taken - 4);
+        failed |= emit_exit(jit, pc + ins->imm);
+        break;
+      }
+      case JIT_JUMP:
+        emit_rbx(jit, 0x8B, 0, OFF_REG(ins->rs1));
+        emit1(jit, 0x05);	// add eax, imm32
+        emit4(jit, ins->imm);
+        emit_rbx(jit, 0x89, 0, OFF_PC);
+        emit1(jit, 0xB8);	// mov eax, JIT_DYNAMIC
+        emit4(jit, JIT_DYNAMIC);
+        emit_jmp(jit, jit->leave);
+        break;
+    }
+  }
+
+  /* Ran into an unsupported instruction, the end of code or the length limit */
+  int last = classify(APEX_code_at(cpu, start + length - 1));
+  if (last < JIT_BZ) {
+    failed |= emit_exit(jit, 4000 + 4 * (start + length));
+  }
+  if (failed) {
+    jit->used = used;
+    jit->num_exits = num_exits;
+    return NULL;
+  }
+
+  patch4(jit->code + cmp_length, length);
+  patch4(jit->code + sub_length, length);
+  patch4(jit->code + budget_exit, jit->used - budget_exit - 4);
+  emit_stop(jit, 4000 + 4 * start, 0);
+
+  jit->blocks[start] = block;
+  jit->blocks_translated++;
+  return block;
+}
+
+/* Translation starting at pc, translated now if needed, NULL if none */
+static unsigned char*
+lookup(APEX_Jit* jit, APEX_CPU* cpu, int pc)
+{
+  if (pc < 4000 || (pc - 4000) % 4 != 0) {
+    return NULL;
+  }
+  int index = get_code_index(pc);
+  if (index >= cpu->code_memory_size || jit->untranslatable[index]) {
+    return NULL;
+  }
+  if (!jit->blocks[index]) {
+    if (classify(APEX_code_at(cpu, index)) == JIT_UNSUPPORTED) {
+      jit->untranslatable[index] = 1;
+      return NULL;
+    }
+    translate(jit, cpu, index);
+  }
+  return jit->blocks[index];
+}
+
+APEX_Jit*
+APEX_jit_create(APEX_CPU* cpu)
+{
+  APEX_Jit* jit = APEX_calloc(1, sizeof(*jit));
+  if (!jit) {
+    return NULL;
+  }
+  jit->code_memory_size = cpu->code_memory_size;
+  jit->blocks = APEX_calloc(cpu->code_memory_size + 1, sizeof(*jit->blocks));
+  jit->untranslatable = APEX_calloc(cpu->code_memory_size + 1, 1);
+  void* code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                    -1, 0);
+  if (!jit->blocks || !jit->untranslatable || code == MAP_FAILED) {
+    if (code != MAP_FAILED) {
+      munmap(code, JIT_CODE_SIZE);
+    }
+    APEX_free(jit->blocks);
+    APEX_free(jit->untranslatable);
+    APEX_free(jit);
+    return NULL;
+  }
+  jit->code = code;
+  jit->writable = 1;
+  emit_trampolines(jit);
+  return jit;
+}
+
+void
+APEX_jit_free(APEX_Jit* jit)
+{
+  if (!jit) {
+    return;
+  }
+  munmap(jit->code, JIT_CODE_SIZE);
+  APEX_free(jit->blocks);
+  APEX_free(jit->untranslatable);
+  APEX_free(jit->exits);
+  APEX_free(jit);
+}
+
+/*
+ * Executes natively from cpu->pc, at most max_instructions of them. Stops
+ * at the first instruction the interpreter has to execute, cpu->pc is left
+ * pointing to it. Returns the number of instructions executed.
+ */
+int
+APEX_jit_run(APEX_Jit* jit, APEX_CPU* cpu, int max_instructions)
+{
+  jit_enter_fn enter = (jit_enter_fn)jit->enter;
+  long budget = max_instructions;
+  unsigned char* block = lookup(jit, cpu, cpu->pc);
+  while (block && budget > 0) {
+    if (set_writable(jit, 0)) {
+      break;
+    }
+    int exit = enter(cpu, &budget, block);
+    if (exit == JIT_STOP) {
+      break;
+    }
+    long flushes = jit->flushes;
+    block = lookup(jit, cpu, cpu->pc);
+    if (exit >= 0 && block && flushes == jit->flushes && !set_writable(jit, 1)) {
+      /* Chain, later runs jump straight to the target */
+      unsigned char* jump = jit->exits[exit].jump;
+      patch4(jump + 1, (int)(block - (jump + 5)));
+    }
+  }
+  jit->instructions += max_instructions - budget;
+  return max_instructions - budget;
+}
+
+void
+APEX_jit_report(APEX_Jit* jit)
+{
+  printf("JIT: %ld blocks translated, %ld instructions executed natively, %ld code cache flushes \n",
+         jit->blocks_translated, jit->instructions, jit->flushes);
+}
+
+/* Registers the counters of the translator under "jit". Returns 0 on success */
+int
+APEX_jit_register_stats(APEX_Jit* jit, APEX_Stats* stats)
+{
+  int ok = APEX_stats_bind(stats, "jit.blocks_translated", &jit->blocks_translated) &&
+           APEX_stats_bind(stats, "jit.instructions", &jit->instructions) &&
+           APEX_stats_bind(stats, "jit.flushes", &jit->flushes);
+  return ok ? 0 : -1;
+}
+
+#else
+
+/* No translator for this host, the interpreter does everything */
+
+APEX_Jit*
+APEX_jit_create(APEX_CPU* cpu)
+{
+  return NULL;
+}
+
+void
+APEX_jit_free(APEX_Jit* jit)
+{
+}
+
+int
+APEX_jit_run(APEX_Jit* jit, APEX_CPU* cpu, int max_instructions)
+{
+  return 0;
+}
+
+void
+APEX_jit_report(APEX_Jit* jit)
+{
+}
+
+int
+APEX_jit_register_stats(APEX_Jit* jit, APEX_Stats* stats)
+{
+  return 0;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _APEX_JIT_H_
+#define _APEX_JIT_H_
+/**
+ *  jit.h
+ *  Contains data structures for the x86-64 translator of the functional
+ *  executor
+ *
+ *  Straight-line runs of ADD, SUB, MUL, AND, OR, EX-OR, MOVC, LOAD and
+ *  STORE ending with BZ, BNZ or JUMP are translated on first execution into
+ *  native code working directly on the APEX_CPU registers, zero flag and
+ *  data memory. Exits to a fixed target are chained to the target's
+ *  translation once it exists, so loops run without leaving native code.
+ *  Every other instruction (HALT, ROI markers, ...) and any data memory
+ *  access out of range stop native execution just before it, and the
+ *  interpreter, APEX_functional_step, takes over.
+ */
+
+#include "cpu.h"
+
+/* Executable memory for translations, all of it is dropped when full */
+#define JIT_CODE_SIZE (16 << 20)
+
+/* Instructions translated into one block at most */
+#define JIT_MAX_BLOCK 256
+
+/* Exit of a block to a fixed target, patched to jump there directly */
+typedef struct APEX_Jit_Exit
+{
+    unsigned char* jump;	// jmp rel32 falling through to the exit code
+    int target_pc;
+} APEX_Jit_Exit;
+
+typedef struct APEX_Jit
+{
+    unsigned char* code;
+    int used;
+    int writable;		// Code cache mapped RW for translating, else RX to run
+    unsigned char* enter;		// Trampoline from C
+    unsigned char* leave;		// Return to C
+
+    /* Translation starting at each code index, NULL if none yet */
+    unsigned char** blocks;
+    unsigned char* untranslatable;
+    int code_memory_size;
+
+    APEX_Jit_Exit* exits;
+    int num_exits;
+    int exits_capacity;
+
+    long blocks_translated;
+    long flushes;
+    long instructions;		// Executed natively
+} APEX_Jit;
+
+APEX_Jit*
+APEX_jit_create(APEX_CPU* cpu);
+
+void
+APEX_jit_free(APEX_Jit* jit);
+
+int
+APEX_jit_run(APEX_Jit* jit, APEX_CPU* cpu, int max_instructions);
+
+void
+APEX_jit_report(APEX_Jit* jit);
+
+int
+APEX_jit_register_stats(APEX_Jit* jit, struct APEX_Stats* stats);
+
+#endif
@@ -0,0 +1,145 @@
+/*
+ *  latency.c
+ *  Contains the per-opcode latency histograms and their report
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency.h"
+#include "arena.h"
+
+static const char* segment_names[LATENCY_NUM_SEGMENTS] = {
+  "fetch", "decode", "execute", "memory", "total"
+};
+
+/* Percentiles reported, in tenths of a percent */
+static const int percentiles[] = { 500, 900, 990, 999 };
+#define NUM_PERCENTILES (int)(sizeof(percentiles) / sizeof(percentiles[0]))
+
+APEX_Latency*
+APEX_latency_create(void)
+{
+  return APEX_calloc(1, sizeof(APEX_Latency));
+}
+
+void
+APEX_latency_free(APEX_Latency* latency)
+{
+  APEX_free(latency);
+}
+
+static void
+sample(APEX_Latency_Histogram* histogram, int cycles)
+{
+  histogram->count++;
+  histogram->sum += cycles;
+  if (cycles > histogram->max) {
+    histogram->max = cycles;
+  }
+  histogram->buckets[cycles < LATENCY_MAX ? cycles : LATENCY_MAX]++;
+}
+
+/*
+ * Called at the start of every stepped cycle. Samples the instruction
+ * writeback retires this cycle, then tags the instructions that have
+ * entered a stage since the last cycle with the current one.
+ */
+void
+APEX_latency_cycle(APEX_CPU* cpu)
+{
+  CPU_Stage* retiring = &cpu->stage[WB];
+  if (!retiring->busy && !retiring->stalled && retiring->opcode[0] != 'N' &&
+      retiring->opcode[0] != '\0') {
+    int* entered = retiring->stage_cycle;
+    entered[WB] = cpu->clock;
+    int known = 1;
+    for (int i = F; i <= WB; ++i) {
+      known = known && entered[i] >= 0;
+    }
+    if (known) {
+      APEX_Latency_Histogram* histograms =
+          cpu->latency->histograms[APEX_opcode_index(retiring->opcode)];
+      for (int i = F; i < WB; ++i) {
+        sample(&histograms[i], entered[i + 1] - entered[i]);
+      }
+      sample(&histograms[LATENCY_TOTAL], entered[WB] - entered[F] + 1);
+    }
+  }
+
+  for (int i = DRF; i < WB; ++i) {
+    CPU_Stage* stage = &cpu->stage[i];
+    if (!stage->busy && stage->stage_cycle[i] == -1) {
+      stage->stage_cycle[i] = cpu->clock;
+    }
+  }
+}
+
+/* Marks the instructions in the latches as not to be sampled */
+void
+APEX_latency_forget(APEX_CPU* cpu)
+{
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    for (int j = 0; j < NUM_STAGES; ++j) {
+      cpu->stage[i].stage_cycle[j] = LATENCY_UNKNOWN;
+    }
+  }
+}
+
+/* Smallest latency at least per_mille of the samples do not exceed */
+static int
+percentile(const APEX_Latency_Histogram* histogram, int per_mille)
+{
+  long rank = (histogram->count * per_mille + 999) / 1000;
+  long seen = 0;
+  for (int i = 0; i < LATENCY_MAX; ++i) {
+    seen += histogram->buckets[i];
+    if (seen >= rank) {
+      return i;
+    }
+  }
+  return histogram->max;
+}
+
+/*
+ * Prints, for every opcode retired, the distribution of the cycles in
+ * each stage and from fetch to writeback, and the tail percentiles.
+ */
+void
+APEX_latency_report(APEX_Latency* latency)
+{
+  printf("Latency in cycles by opcode, from fetch to writeback \n");
+  printf("  %-10s %-8s %10s %8s", "opcode", "stage", "count", "mean");
+  for (int p = 0; p < NUM_PERCENTILES; ++p) {
+    char name[16];
+    snprintf(name, sizeof(name), "p%g", percentiles[p] / 10.0);
+    printf(" %6s", name);
+  }
+  printf(" %6s \n", "max");
+
+  for (int op = 0; op < STATS_NUM_OPCODES; ++op) {
+    APEX_Latency_Histogram* histograms = latency->histograms[op];
+    if (!histograms[LATENCY_TOTAL].count) {
+      continue;
+    }
+    for (int s = 0; s < LATENCY_NUM_SEGMENTS; ++s) {
+      const APEX_Latency_Histogram* histogram = &histograms[s];
+      printf("  %-10s %-8s %10ld %8.2f", s == 0 ? APEX_opcode_name(op) : "", segment_names[s],
+             histogram->count, (double)histogram->sum / histogram->count);
+      for (int p = 0; p < NUM_PERCENTILES; ++p) {
+        printf(" %6d", percentile(histogram, percentiles[p]));
+      }
+      printf(" %6d \n", histogram->max);
+    }
+
+    /* Distribution of the total, latency:count for every latency seen */
+    const APEX_Latency_Histogram* total = &histograms[LATENCY_TOTAL];
+    printf("  %-10s %-8s", "", "cycles");
+    for (int i = 0; i <= LATENCY_MAX; ++i) {
+      if (total->buckets[i]) {
+        printf(" %s%d:%ld", i == LATENCY_MAX ? ">=" : "", i, total->buckets[i]);
+      }
+    }
+    printf(" \n");
+  }
+}
@@ -0,0 +1,62 @@
+#ifndef _APEX_LATENCY_H_
+#define _APEX_LATENCY_H_
+/**
+ *  latency.h
+ *  Contains the per-opcode latency histograms
+ *
+ *  Fetch tags every instruction with its fetch cycle, and each cycle the
+ *  cycle it enters every later stage is recorded in its latch, so the
+ *  tags travel with the instruction. When it retires, the cycles it spent
+ *  in each stage and from fetch to writeback are counted into histograms
+ *  of its opcode, exact up to LATENCY_MAX cycles, for percentiles.
+ */
+
+#include "cpu.h"
+#include "stats.h"
+
+/* Latencies at least this long share the last bucket */
+#define LATENCY_MAX 256
+
+/* Stage tag of an instruction whose earlier stages are unknown, e.g. one
+ * restored by --memo or --loops. It is not sampled */
+#define LATENCY_UNKNOWN -2
+
+enum
+{
+    LATENCY_FETCH,		// Cycles in each stage
+    LATENCY_DECODE,
+    LATENCY_EXECUTE,
+    LATENCY_MEMORY,
+    LATENCY_TOTAL,		// From fetch to writeback, both included
+    LATENCY_NUM_SEGMENTS
+};
+
+typedef struct APEX_Latency_Histogram
+{
+    long count;
+    long sum;
+    int max;
+    long buckets[LATENCY_MAX + 1];
+} APEX_Latency_Histogram;
+
+typedef struct APEX_Latency
+{
+    APEX_Latency_Histogram histograms[STATS_NUM_OPCODES][LATENCY_NUM_SEGMENTS];
+} APEX_Latency;
+
+APEX_Latency*
+APEX_latency_create(void);
+
+void
+APEX_latency_free(APEX_Latency* latency);
+
+void
+APEX_latency_cycle(APEX_CPU* cpu);
+
+void
+APEX_latency_forget(APEX_CPU* cpu);
+
+void
+APEX_latency_report(APEX_Latency* latency);
+
+#endif
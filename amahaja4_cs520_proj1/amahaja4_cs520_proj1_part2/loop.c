@@ -0,0 +1,174 @@
+/*
+ *  loop.c
+ *  Contains detection of periodic steady states at block boundaries and
+ *  the functional execution of the remaining loop iterations
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "loop.h"
+#include "arena.h"
+#include "stats.h"
+
+APEX_Loops*
+APEX_loops_create()
+{
+  APEX_Loops* loops = APEX_calloc(1, sizeof(*loops));
+  if (loops) {
+    loops->last_redirects = -1;
+  }
+  return loops;
+}
+
+void
+APEX_loops_free(APEX_Loops* loops)
+{
+  if (!loops) {
+    return;
+  }
+  APEX_block_undo_free(&loops->undo);
+  APEX_free(loops);
+}
+
+/* Boundary k steps back, 0 being the latest */
+static APEX_Loop_Boundary*
+boundary(APEX_Loops* loops, int k)
+{
+  return &loops->history[(loops->head - 1 - k + 2 * LOOP_HISTORY) % LOOP_HISTORY];
+}
+
+/* The last period blocks repeat the period blocks before them */
+static int
+is_periodic(APEX_Loops* loops, int period)
+{
+  for (int j = 0; j <= period; ++j) {
+    APEX_Loop_Boundary* a = boundary(loops, j);
+    APEX_Loop_Boundary* b = boundary(loops, j + period);
+    if (a->entry_pc != b->entry_pc || a->entry_valid != b->entry_valid ||
+        a->branch_pc != b->branch_pc) {
+      return 0;
+    }
+    if (j < period) {
+      APEX_Loop_Boundary* a_prev = boundary(loops, j + 1);
+      APEX_Loop_Boundary* b_prev = boundary(loops, j + period + 1);
+      if (a->clock - a_prev->clock != b->clock - b_prev->clock ||
+          a->ins_completed - a_prev->ins_completed != b->ins_completed - b_prev->ins_completed) {
+        return 0;
+      }
+    }
+  }
+  /* The period closes with a backward branch or JUMP */
+  return boundary(loops, 0)->entry_pc <= boundary(loops, 0)->branch_pc;
+}
+
+/*
+ * Executes whole periods functionally while they follow the recorded path
+ * and fit under the cycle limit. The pipeline is left as it is, being in
+ * the same state at the end of every period. Returns the periods executed.
+ */
+static int
+extrapolate(APEX_Loops* loops, APEX_CPU* cpu, int period)
+{
+  int cycles = boundary(loops, 0)->clock - boundary(loops, period)->clock;
+  int instructions = boundary(loops, 0)->ins_completed - boundary(loops, period)->ins_completed;
+  int boundary_pc = cpu->pc;
+  int written = 0;
+  int iterations = 0;
+  /* Invalid registers whose forwarded value is not their value, as memo
+   * checks them. Writing one in the pipeline forwards it, so none turn
+   * stale later in the period */
+  int stale = APEX_block_stale_mask(cpu);
+
+  while (cpu->function_cycles <= 0 || cpu->clock + cycles <= cpu->function_cycles) {
+    APEX_block_undo_begin(&loops->undo, cpu);
+    int same_path = 1;
+    for (int j = period; j > 0 && same_path; --j) {
+      APEX_Loop_Boundary* from = boundary(loops, j);
+      APEX_Loop_Boundary* to = boundary(loops, j - 1);
+      int exit_pc = 0;
+      int exit_target = 0;
+      cpu->pc = from->entry_pc;
+      int n = APEX_block_run(cpu, &loops->undo, stale, &exit_pc, &exit_target, &written);
+      same_path = n == to->ins_completed - from->ins_completed && exit_pc == to->branch_pc &&
+                  exit_target == to->entry_pc;
+    }
+    if (!same_path) {
+      APEX_block_undo(&loops->undo, cpu);
+      break;
+    }
+    cpu->clock += cycles;
+    cpu->ins_completed += instructions;
+    cpu->redirects += period;
+    iterations++;
+  }
+
+  cpu->pc = boundary_pc;
+  APEX_block_forward(cpu, written);
+  return iterations;
+}
+
+/*
+ * Called by the simulation loop before each cycle. Records block
+ * boundaries and, once a loop is in steady state, skips its iterations.
+ * Returns 1 if the cpu was advanced.
+ */
+int
+APEX_loops_apply(APEX_CPU* cpu)
+{
+  APEX_Loops* loops = cpu->loops;
+  if (cpu->redirects == loops->last_redirects || !APEX_block_boundary(cpu)) {
+    return 0;
+  }
+  if (cpu->redirects != loops->last_redirects + 1) {
+    /* A redirect went by without a clean boundary, the history is broken */
+    loops->count = 0;
+  }
+  loops->last_redirects = cpu->redirects;
+
+  APEX_Loop_Boundary* b = &loops->history[loops->head];
+  b->entry_pc = cpu->stage[DRF].pc;
+  b->entry_valid = APEX_block_valid_mask(cpu);
+  b->branch_pc = cpu->stage[WB].pc;
+  b->clock = cpu->clock;
+  b->ins_completed = cpu->ins_completed;
+  loops->head = (loops->head + 1) % LOOP_HISTORY;
+  if (loops->count < LOOP_HISTORY) {
+    loops->count++;
+  }
+
+  for (int period = 1; 2 * period + 1 <= loops->count; ++period) {
+    if (!is_periodic(loops, period)) {
+      continue;
+    }
+    long clock = cpu->clock;
+    int iterations = extrapolate(loops, cpu, period);
+    if (!iterations) {
+      return 0;
+    }
+    loops->loops++;
+    loops->iterations += iterations;
+    loops->cycles_added += cpu->clock - clock;
+    loops->count = 0;
+    loops->last_redirects = cpu->redirects;
+    return 1;
+  }
+  return 0;
+}
+
+void
+APEX_loops_report(APEX_Loops* loops)
+{
+  printf("Loop extrapolation: %ld steady states, %ld iterations executed functionally, %ld cycles added \n",
+         loops->loops, loops->iterations, loops->cycles_added);
+}
+
+/* Registers the counters of the loop detector under "loops". Returns 0 on success */
+int
+APEX_loops_register_stats(APEX_Loops* loops, APEX_Stats* stats)
+{
+  int ok = APEX_stats_bind(stats, "loops.steady_states", &loops->loops) &&
+           APEX_stats_bind(stats, "loops.iterations", &loops->iterations) &&
+           APEX_stats_bind(stats, "loops.cycles_added", &loops->cycles_added);
+  return ok ? 0 : -1;
+}
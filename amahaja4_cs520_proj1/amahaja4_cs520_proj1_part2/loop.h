@@ -0,0 +1,64 @@
+#ifndef _APEX_LOOP_H_
+#define _APEX_LOOP_H_
+/**
+ *  loop.h
+ *  Contains data structures for steady-state loop extrapolation
+ *
+ *  At every block boundary (see memo.h) the target, the valid registers and
+ *  the branch that led there are recorded with the clock. Once the last
+ *  P blocks repeat the P before them exactly, with the same cycles and
+ *  instructions each, and the period closes with a backward branch, the
+ *  loop is in steady state. Further iterations are executed functionally
+ *  and charged the cycles of one period each, for as long as they follow
+ *  the same path. Detailed stepping resumes at the first one that does not.
+ */
+
+#include "cpu.h"
+#include "memo.h"
+
+/* Longest period detected, in blocks */
+#define LOOP_MAX_PERIOD 8
+
+#define LOOP_HISTORY (2 * LOOP_MAX_PERIOD + 1)
+
+/* State of the pipeline at one block boundary */
+typedef struct APEX_Loop_Boundary
+{
+    int entry_pc;		// Target in fetch and decode
+    int entry_valid;	// Mask of registers marked valid
+    int branch_pc;		// Taken branch or JUMP that led here
+    int clock;
+    int ins_completed;
+} APEX_Loop_Boundary;
+
+typedef struct APEX_Loops
+{
+    /* Consecutive boundaries, history[head - 1] the latest */
+    APEX_Loop_Boundary history[LOOP_HISTORY];
+    int head;
+    int count;
+    int last_redirects;
+
+    APEX_Block_Undo undo;
+
+    long loops;		    // Steady states extrapolated
+    long iterations;	// Periods executed functionally
+    long cycles_added;
+} APEX_Loops;
+
+APEX_Loops*
+APEX_loops_create();
+
+void
+APEX_loops_free(APEX_Loops* loops);
+
+int
+APEX_loops_apply(APEX_CPU* cpu);
+
+void
+APEX_loops_report(APEX_Loops* loops);
+
+int
+APEX_loops_register_stats(APEX_Loops* loops, struct APEX_Stats* stats);
+
+#endif
@@ -10,27 +10,574 @@
 #include <string.h>
 
 #include "cpu.h"
+#include "checkpoint.h"
+#include "explore.h"
+#include "parallel.h"
+#include "simpoint.h"
+#include "interval.h"
+#include "memo.h"
+#include "loop.h"
+#include "jit.h"
+#include "program.h"
+#include "arena.h"
+#include "stats.h"
+#include "profile.h"
+#include "stall_log.h"
+#include "latency.h"
+#include "window.h"
+#include "mem_trace.h"
+#include "retire_trace.h"
+
+#define ARENA_DEFAULT_MB 1024
+
+static void
+print_usage(const char* prog)
+{
+  fprintf(stderr, "APEX_Help : Usage %s <input_file> <simulate|display> <cycles> [options]\n", prog);
+  fprintf(stderr, "APEX_Help :       %s <jobs_file> batch <cycles> [options]\n", prog);
+  fprintf(stderr, "APEX_Help : Options\n");
+  fprintf(stderr, "  --checkpoint <interval> <file>   checkpoint every <interval> cycles into <file>\n");
+  fprintf(stderr, "  --restore <file> <index>         start from checkpoint <index> saved in <file>\n");
+  fprintf(stderr, "  --compact <file> <index>         fold checkpoints up to <index> in <file> into a base\n");
+  fprintf(stderr, "  --parallel <segment> <warmup> <threads>\n");
+  fprintf(stderr, "                                   simulate <segment>-instruction slices of a functional run in parallel\n");
+  fprintf(stderr, "  --explore <cycle|pc> <value> <configs>\n");
+  fprintf(stderr, "                                   fork one child per ';'-separated config (e.g. \"fwd=0;mul=3\")\n");
+  fprintf(stderr, "  --simpoint <interval> <max_k> <warmup> <threads>\n");
+  fprintf(stderr, "                                   simulate one representative <interval> per basic block vector cluster\n");
+  fprintf(stderr, "  --bbv <file>                     write the basic block vectors of --simpoint to <file>\n");
+  fprintf(stderr, "  --interval                       estimate cycles with the calibrated interval model\n");
+  fprintf(stderr, "  --memo                           replay cached basic block timing instead of stepping\n");
+  fprintf(stderr, "  --memo-verify <n>                as --memo, also step every <n>th replay and compare\n");
+  fprintf(stderr, "  --loops                          execute loops in steady state functionally, adding their cycles\n");
+  fprintf(stderr, "  --jit                            fast-forward to regions of interest with native x86-64 code\n");
+  fprintf(stderr, "  --lazy                           decode each program line on first fetch instead of at load\n");
+  fprintf(stderr, "  --image <file>                   share the decoded program with other runs through <file>\n");
+  fprintf(stderr, "  --interval-check                 as --interval, and report its error against the pipeline\n");
+  fprintf(stderr, "  --cpi                            print the CPI stack of the run and of each region of interest\n");
+  fprintf(stderr, "  --latency                        print per-opcode latency distributions from fetch to writeback\n");
+  fprintf(stderr, "  --profile <file>                 list the input to <file> with the counters of each instruction\n");
+  fprintf(stderr, "  --stall-log <file>               log every decode stall with its producer to <file>, see apex_stalls\n");
+  fprintf(stderr, "  --mem-trace <file>               trace every LOAD and STORE to <file>, see apex_memtrace\n");
+  fprintf(stderr, "  --retire-trace <file>            trace every retired instruction to <file>, see apex_ddg\n");
+  fprintf(stderr, "  --stats <file>                   write statistics to <file>, CSV if it ends in .csv, else JSON lines\n");
+  fprintf(stderr, "  --stats-interval <cycles>        also write them every <cycles> cycles\n");
+  fprintf(stderr, "  --window <cycles> <file>         append IPC, stall causes, flushes and memory ops of every <cycles> to <file>\n");
+  fprintf(stderr, "  --arena <MB>                     allocate each run from one arena of <MB> (batch default %d)\n",
+          ARENA_DEFAULT_MB);
+}
+
+
+/* Options of the command line, applied to every job of a batch */
+typedef struct Run_Options
+{
+  int checkpoint_interval;
+  const char* checkpoint_file;
+  const char* restore_file;
+  int restore_index;
+  const char* compact_file;
+  int compact_index;
+  const char** explore_args;
+  int parallel_segment;
+  int parallel_warmup;
+  int parallel_threads;
+  int simpoint_interval;
+  int simpoint_max_k;
+  int simpoint_warmup;
+  int simpoint_threads;
+  const char* bbv_file;
+  int interval_model;
+  int interval_check;
+  int memo;
+  int memo_verify;
+  int loops;
+  int jit;
+  const char* image_file;
+  int arena_mb;
+  FILE* stats_out;
+  int stats_format;
+  int stats_interval;
+  int cpi;
+  int latency;
+  FILE* profile_out;
+  FILE* stall_log_out;
+  FILE* mem_trace_out;
+  FILE* retire_trace_out;
+  int window_interval;
+  FILE* window_out;
+} Run_Options;
+
+/*
+ * Simulates one input. Returns 0 on success, -1 after reporting the
+ * error.
+ */
+static int
+run_job(const char* input, const char* mode, const char* cycles, const Run_Options* o)
+{
+  APEX_CPU* cpu = NULL;
+  if (o->image_file) {
+    APEX_Program* program = APEX_program_share(input, o->image_file, LAZY_CODE_MEMORY);
+    if (program) {
+      cpu = APEX_cpu_create(program, mode, cycles);
+      APEX_program_release(program);
+    }
+  } else {
+    cpu = APEX_cpu_init(input, mode, cycles);
+  }
+
+
+  if (!cpu) {
+    fprintf(stderr, "APEX_Error : Unable to initialize CPU\n");
+    return -1;
+  }
+
+  if (o->compact_file) {
+    APEX_Checkpoint_Series* series =
+        APEX_checkpoint_series_load(o->compact_file, cpu->code_memory_size);
+    if (!series || APEX_checkpoint_compact(series, o->compact_index) ||
+        APEX_checkpoint_series_save(series, o->compact_file)) {
+      fprintf(stderr, "APEX_Error : Unable to compact checkpoints in %s\n", o->compact_file);
+      APEX_checkpoint_series_free(series);
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+    APEX_checkpoint_series_free(series);
+  }
+
+  if (o->restore_file) {
+    APEX_Checkpoint_Series* series =
+        APEX_checkpoint_series_load(o->restore_file, cpu->code_memory_size);
+    if (!series || APEX_checkpoint_restore(series, o->restore_index, cpu)) {
+      fprintf(stderr, "APEX_Error : Unable to restore checkpoint %d from %s\n",
+              o->restore_index, o->restore_file);
+      APEX_checkpoint_series_free(series);
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+    APEX_checkpoint_series_free(series);
+  }
+
+  if (o->checkpoint_file) {
+    cpu->checkpoints = APEX_checkpoint_series_create(o->checkpoint_file, cpu->code_memory_size);
+    if (!cpu->checkpoints) {
+      fprintf(stderr, "APEX_Error : Unable to create checkpoint file %s\n", o->checkpoint_file);
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+    cpu->checkpoint_interval = o->checkpoint_interval;
+  }
+
+  if (o->explore_args) {
+    cpu->explore = APEX_explore_create(o->explore_args[0], o->explore_args[1], o->explore_args[2]);
+    if (!cpu->explore) {
+      fprintf(stderr, "APEX_Error : Invalid exploration request\n");
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+  }
+
+  if (o->memo) {
+    cpu->memo = APEX_memo_create(o->memo_verify);
+    if (!cpu->memo) {
+      fprintf(stderr, "APEX_Error : Unable to allocate the block timing memo\n");
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+  }
+
+  if (o->loops) {
+    cpu->loops = APEX_loops_create();
+    if (!cpu->loops) {
+      fprintf(stderr, "APEX_Error : Unable to allocate the loop detector\n");
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+  }
+
+  if (o->jit) {
+    cpu->jit = APEX_jit_create(cpu);
+    if (!cpu->jit) {
+      fprintf(stderr, "APEX_Help : No native translation on this host, fast-forwarding with the interpreter\n");
+    }
+  }
+
+  cpu->cpi_report = o->cpi;
+
+  if (o->latency) {
+    cpu->latency = APEX_latency_create();
+    if (!cpu->latency) {
+      fprintf(stderr, "APEX_Error : Unable to allocate the latency histograms\n");
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+  }
+
+  if (o->profile_out) {
+    cpu->profile = APEX_profile_create(cpu, o->profile_out, input);
+    if (!cpu->profile) {
+      fprintf(stderr, "APEX_Error : Unable to allocate the profile\n");
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+  }
+
+  if (o->window_out) {
+    cpu->window = APEX_window_create(cpu, o->window_out, input, o->window_interval);
+    if (!cpu->window) {
+      fprintf(stderr, "APEX_Error : Unable to start the windowed series\n");
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+  }
+
+  if (o->mem_trace_out) {
+    cpu->mem_trace = APEX_mem_trace_create(o->mem_trace_out, input);
+    if (!cpu->mem_trace) {
+      fprintf(stderr, "APEX_Error : Unable to start the memory trace\n");
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+  }
+
+  if (o->retire_trace_out) {
+    cpu->retire_trace = APEX_retire_trace_create(o->retire_trace_out, input);
+    if (!cpu->retire_trace) {
+      fprintf(stderr, "APEX_Error : Unable to start the retire trace\n");
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+  }
+
+  if (o->stall_log_out) {
+    cpu->stall_log = APEX_stall_log_create(o->stall_log_out, input);
+    if (!cpu->stall_log) {
+      fprintf(stderr, "APEX_Error : Unable to start the stall log\n");
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+  }
+
+  if (o->stats_out) {
+    APEX_Stats* stats = APEX_stats_create(o->stats_out, o->stats_format, input, o->stats_interval);
+    if (!stats || APEX_cpu_enable_stats(cpu, stats) ||
+        (cpu->memo && APEX_memo_register_stats(cpu->memo, stats)) ||
+        (cpu->loops && APEX_loops_register_stats(cpu->loops, stats)) ||
+        (cpu->jit && APEX_jit_register_stats(cpu->jit, stats))) {
+      fprintf(stderr, "APEX_Error : Unable to register statistics\n");
+      APEX_cpu_stop(cpu);
+      return -1;
+    }
+  }
+
+  int ret = 0;
+  if (o->parallel_segment) {
+    /* Workers run quietly, one trace per cycle would interleave */
+    ENABLE_DEBUG_MESSAGES = 0;
+    if (APEX_parallel_run(cpu, o->parallel_segment, o->parallel_warmup, o->parallel_threads)) {
+      fprintf(stderr, "APEX_Error : Time-parallel simulation failed\n");
+      ret = -1;
+    }
+  } else if (o->simpoint_interval) {
+    ENABLE_DEBUG_MESSAGES = 0;
+    if (APEX_simpoint_run(cpu, o->simpoint_interval, o->simpoint_max_k, o->simpoint_warmup,
+                          o->simpoint_threads, o->bbv_file)) {
+      fprintf(stderr, "APEX_Error : SimPoint simulation failed\n");
+      ret = -1;
+    }
+  } else if (o->interval_model) {
+    if (APEX_interval_run(cpu, o->interval_check)) {
+      fprintf(stderr, "APEX_Error : Interval model failed\n");
+      ret = -1;
+    }
+  } else {
+    APEX_cpu_run(cpu);
+  }
+  APEX_cpu_stop(cpu);
+  return ret;
+}
+
+/*
+ * Simulates every input listed in jobs_file, one per line and optionally
+ * followed by its own cycle limit. All allocations of a job come from the
+ * arena, which is emptied for the next one. Returns the number of failed
+ * jobs, or -1 if the list cannot be read.
+ */
+static int
+run_batch(const char* jobs_file, const char* cycles, APEX_Arena* arena, const Run_Options* o)
+{
+  FILE* fp = fopen(jobs_file, "r");
+  if (!fp) {
+    fprintf(stderr, "APEX_Error : Unable to open jobs file %s\n", jobs_file);
+    return -1;
+  }
+
+  int failed = 0;
+  int job = 0;
+  char line[4096];
+  while (fgets(line, sizeof(line), fp)) {
+    char input[4096];
+    char job_cycles[64];
+    int fields = sscanf(line, "%4095s %63s", input, job_cycles);
+    if (fields < 1) {
+      continue;
+    }
+    job++;
+    printf("(apex) >> Job %d: %s \n", job, input);
+    if (run_job(input, "simulate", fields == 2 ? job_cycles : cycles, o)) {
+      fprintf(stderr, "APEX_Error : Job %d (%s) failed\n", job, input);
+      failed++;
+    }
+    fflush(stdout);
+    if (arena) {
+      APEX_arena_reset(arena);
+    }
+  }
+  fclose(fp);
+  return failed;
+}
 
 int
 main(int argc, char const* argv[])
 {
-  if (argc != 4) {
-    fprintf(stderr, "APEX_Help : Usage %s <input_file>\n", argv[0]);
+  if (argc < 4) {
+    print_usage(argv[0]);
     exit(1);
   }
 
+  Run_Options options;
+  Run_Options* o = &options;
+  memset(o, 0, sizeof(*o));
+  int batch = strcmp(argv[2], "batch") == 0;
+  const char* stats_file = NULL;
+  const char* profile_file = NULL;
+  const char* stall_log_file = NULL;
+  const char* window_file = NULL;
+  const char* mem_trace_file = NULL;
+  const char* retire_trace_file = NULL;
 
-  APEX_CPU* cpu = APEX_cpu_init(argv[1],argv[2],argv[3]);
+  for (int i = 4; i < argc; ++i) {
+    if (strcmp(argv[i], "--checkpoint") == 0 && i + 2 < argc) {
+      o->checkpoint_interval = atoi(argv[++i]);
+      o->checkpoint_file = argv[++i];
+    } else if (strcmp(argv[i], "--restore") == 0 && i + 2 < argc) {
+      o->restore_file = argv[++i];
+      o->restore_index = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--compact") == 0 && i + 2 < argc) {
+      o->compact_file = argv[++i];
+      o->compact_index = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--parallel") == 0 && i + 3 < argc) {
+      o->parallel_segment = atoi(argv[++i]);
+      o->parallel_warmup = atoi(argv[++i]);
+      o->parallel_threads = atoi(argv[++i]);
+      if (o->parallel_segment <= 0 || o->parallel_warmup < 0 ||
+          o->parallel_warmup > o->parallel_segment || o->parallel_threads <= 0) {
+        fprintf(stderr, "APEX_Error : --parallel needs segment > 0, 0 <= warmup <= segment, threads > 0\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--simpoint") == 0 && i + 4 < argc) {
+      o->simpoint_interval = atoi(argv[++i]);
+      o->simpoint_max_k = atoi(argv[++i]);
+      o->simpoint_warmup = atoi(argv[++i]);
+      o->simpoint_threads = atoi(argv[++i]);
+      if (o->simpoint_interval <= 0 || o->simpoint_max_k <= 0 || o->simpoint_warmup < 0 ||
+          o->simpoint_threads <= 0) {
+        fprintf(stderr, "APEX_Error : --simpoint needs interval > 0, max_k > 0, warmup >= 0, threads > 0\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--bbv") == 0 && i + 1 < argc) {
+      o->bbv_file = argv[++i];
+    } else if (strcmp(argv[i], "--interval") == 0) {
+      o->interval_model = 1;
+    } else if (strcmp(argv[i], "--interval-check") == 0) {
+      o->interval_model = 1;
+      o->interval_check = 1;
+    } else if (strcmp(argv[i], "--memo") == 0) {
+      o->memo = 1;
+    } else if (strcmp(argv[i], "--loops") == 0) {
+      o->loops = 1;
+    } else if (strcmp(argv[i], "--jit") == 0) {
+      o->jit = 1;
+    } else if (strcmp(argv[i], "--lazy") == 0) {
+      LAZY_CODE_MEMORY = 1;
+    } else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+      o->image_file = argv[++i];
+    } else if (strcmp(argv[i], "--cpi") == 0) {
+      o->cpi = 1;
+    } else if (strcmp(argv[i], "--latency") == 0) {
+      o->latency = 1;
+    } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      profile_file = argv[++i];
+    } else if (strcmp(argv[i], "--stall-log") == 0 && i + 1 < argc) {
+      stall_log_file = argv[++i];
+    } else if (strcmp(argv[i], "--mem-trace") == 0 && i + 1 < argc) {
+      mem_trace_file = argv[++i];
+    } else if (strcmp(argv[i], "--retire-trace") == 0 && i + 1 < argc) {
+      retire_trace_file = argv[++i];
+    } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+      stats_file = argv[++i];
+    } else if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc) {
+      o->stats_interval = atoi(argv[++i]);
+      if (o->stats_interval <= 0) {
+        fprintf(stderr, "APEX_Error : --stats-interval needs a positive number of cycles\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--window") == 0 && i + 2 < argc) {
+      o->window_interval = atoi(argv[++i]);
+      window_file = argv[++i];
+      if (o->window_interval <= 0) {
+        fprintf(stderr, "APEX_Error : --window needs a positive number of cycles\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--arena") == 0 && i + 1 < argc) {
+      o->arena_mb = atoi(argv[++i]);
+      if (o->arena_mb <= 0) {
+        fprintf(stderr, "APEX_Error : --arena needs a positive size in MB\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--memo-verify") == 0 && i + 1 < argc) {
+      o->memo = 1;
+      o->memo_verify = atoi(argv[++i]);
+      if (o->memo_verify <= 0) {
+        fprintf(stderr, "APEX_Error : --memo-verify needs a positive interval\n");
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "--explore") == 0 && i + 3 < argc) {
+      o->explore_args = &argv[i + 1];
+      i += 3;
+    } else {
+      fprintf(stderr, "APEX_Error : Unknown or incomplete option %s\n", argv[i]);
+      print_usage(argv[0]);
+      exit(1);
+    }
+  }
 
+  if (o->bbv_file && !o->simpoint_interval) {
+    fprintf(stderr, "APEX_Error : --bbv requires --simpoint\n");
+    exit(1);
+  }
 
-  if (!cpu) {
-    fprintf(stderr, "APEX_Error : Unable to initialize CPU\n");
+  if ((o->memo || o->loops) &&
+      (o->checkpoint_file || o->explore_args || (strcmp(argv[2], "simulate") != 0 && !batch))) {
+    /* Replayed blocks skip the cycles these act on */
+    fprintf(stderr, "APEX_Error : --memo and --loops need simulate mode, without --checkpoint or --explore\n");
     exit(1);
   }
 
+  if (o->checkpoint_file && o->checkpoint_interval <= 0) {
+    fprintf(stderr, "APEX_Error : Checkpoint interval must be positive\n");
+    exit(1);
+  }
 
+  if (o->stats_interval && !stats_file) {
+    fprintf(stderr, "APEX_Error : --stats-interval requires --stats\n");
+    exit(1);
+  }
 
-  APEX_cpu_run(cpu);
-  APEX_cpu_stop(cpu);
-  return 0;
-}
\ No newline at end of file
+  if ((stats_file || o->cpi || o->latency || profile_file || stall_log_file || window_file ||
+       mem_trace_file || retire_trace_file) &&
+      (o->parallel_segment || o->simpoint_interval || o->interval_model)) {
+    /* These never run the pipeline of the cpu the stats are registered with */
+    fprintf(stderr, "APEX_Error : --stats, --cpi, --latency, --profile, --stall-log, --window, --mem-trace and --retire-trace need a pipeline run, without --parallel, --simpoint or --interval\n");
+    exit(1);
+  }
+
+  if ((stall_log_file || window_file || mem_trace_file || retire_trace_file || profile_file ||
+       o->stats_interval) && o->explore_args) {
+    /* Forked configurations inherit the open files and would interleave their output */
+    fprintf(stderr, "APEX_Error : --stall-log, --window, --mem-trace, --retire-trace, --profile and --stats-interval cannot be combined with --explore\n");
+    exit(1);
+  }
+
+  if (stats_file) {
+    size_t length = strlen(stats_file);
+    o->stats_format = length > 4 && strcmp(stats_file + length - 4, ".csv") == 0 ? STATS_CSV : STATS_JSON;
+    o->stats_out = fopen(stats_file, "w");
+    if (!o->stats_out) {
+      fprintf(stderr, "APEX_Error : Unable to create statistics file %s\n", stats_file);
+      exit(1);
+    }
+  }
+
+  if (profile_file) {
+    o->profile_out = fopen(profile_file, "w");
+    if (!o->profile_out) {
+      fprintf(stderr, "APEX_Error : Unable to create profile file %s\n", profile_file);
+      exit(1);
+    }
+  }
+
+  if (stall_log_file) {
+    o->stall_log_out = fopen(stall_log_file, "wb");
+    if (!o->stall_log_out) {
+      fprintf(stderr, "APEX_Error : Unable to create stall log %s\n", stall_log_file);
+      exit(1);
+    }
+  }
+
+  if (mem_trace_file) {
+    o->mem_trace_out = fopen(mem_trace_file, "wb");
+    if (!o->mem_trace_out) {
+      fprintf(stderr, "APEX_Error : Unable to create memory trace %s\n", mem_trace_file);
+      exit(1);
+    }
+  }
+
+  if (retire_trace_file) {
+    o->retire_trace_out = fopen(retire_trace_file, "wb");
+    if (!o->retire_trace_out) {
+      fprintf(stderr, "APEX_Error : Unable to create retire trace %s\n", retire_trace_file);
+      exit(1);
+    }
+  }
+
+  if (window_file) {
+    o->window_out = fopen(window_file, "w");
+    if (!o->window_out) {
+      fprintf(stderr, "APEX_Error : Unable to create window file %s\n", window_file);
+      exit(1);
+    }
+  }
+
+  APEX_Arena* arena = NULL;
+  if (batch || o->arena_mb) {
+    size_t arena_mb = o->arena_mb ? o->arena_mb : ARENA_DEFAULT_MB;
+    arena = APEX_arena_create(arena_mb << 20);
+    if (!arena) {
+      fprintf(stderr, "APEX_Help : Unable to reserve a %zu MB arena, using malloc\n", arena_mb);
+    }
+    APEX_arena_use(arena);
+  }
+
+  int ret;
+  if (batch) {
+    ret = run_batch(argv[1], argv[3], arena, o);
+  } else {
+    ret = run_job(argv[1], argv[2], argv[3], o);
+  }
+  APEX_arena_free(arena);
+  if (o->stats_out && fclose(o->stats_out)) {
+    fprintf(stderr, "APEX_Error : Unable to write statistics file %s\n", stats_file);
+    ret = -1;
+  }
+  if (o->profile_out && fclose(o->profile_out)) {
+    fprintf(stderr, "APEX_Error : Unable to write profile file %s\n", profile_file);
+    ret = -1;
+  }
+  if (o->window_out && fclose(o->window_out)) {
+    fprintf(stderr, "APEX_Error : Unable to write window file %s\n", window_file);
+    ret = -1;
+  }
+  if (o->mem_trace_out && fclose(o->mem_trace_out)) {
+    fprintf(stderr, "APEX_Error : Unable to write memory trace %s\n", mem_trace_file);
+    ret = -1;
+  }
+  if (o->retire_trace_out && fclose(o->retire_trace_out)) {
+    fprintf(stderr, "APEX_Error : Unable to write retire trace %s\n", retire_trace_file);
+    ret = -1;
+  }
+  if (o->stall_log_out && fclose(o->stall_log_out)) {
+    fprintf(stderr, "APEX_Error : Unable to write stall log %s\n", stall_log_file);
+    ret = -1;
+  }
+  return ret ? 1 : 0;
+}
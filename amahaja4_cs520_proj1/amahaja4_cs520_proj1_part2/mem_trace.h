@@ -0,0 +1,50 @@
+#ifndef _APEX_MEM_TRACE_H_
+#define _APEX_MEM_TRACE_H_
+/**
+ *  mem_trace.h
+ *  Contains the binary trace of data memory accesses
+ *
+ *  Every LOAD and STORE the memory stage performs appends a 12 byte
+ *  record: cycle, pc and the word address with the direction in its low
+ *  bit. Runs are framed as in trace.h, the end record has cycle -1.
+ *  Accesses of instructions executed functionally (fast-forwarding, or
+ *  blocks replayed by --memo and --loops) are not traced. apex_memtrace
+ *  analyzes a trace.
+ */
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+#define MEM_TRACE_MAGIC "APEXMTR"
+#define MEM_TRACE_VERSION 1
+
+typedef struct APEX_Mem_Access
+{
+    int cycle;			// -1 ends the run
+    int pc;
+    int access;			// Word address << 1 | 1 for a STORE
+} APEX_Mem_Access;
+
+typedef struct APEX_Mem_Trace
+{
+    FILE* out;			// Not owned
+    long accesses;
+} APEX_Mem_Trace;
+
+APEX_Mem_Trace*
+APEX_mem_trace_create(FILE* out, const char* input);
+
+int
+APEX_mem_trace_close(APEX_Mem_Trace* trace);
+
+/* Appends one access, write errors show when the trace is closed */
+static inline void
+APEX_mem_trace_access(APEX_Mem_Trace* trace, int cycle, int pc, int address, int write)
+{
+  APEX_Mem_Access access = { cycle, pc, (int)((unsigned)address << 1) | (write ? 1 : 0) };
+  fwrite(&access, sizeof(access), 1, trace->out);
+  trace->accesses++;
+}
+
+#endif
@@ -0,0 +1,469 @@
+/*
+ *  memo.c
+ *  Contains memoized basic block timing: recording blocks while stepping,
+ *  replaying them on a hit and spot-checking replays against stepping
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "memo.h"
+#include "arena.h"
+#include "stats.h"
+
+APEX_Memo*
+APEX_memo_create(int verify_every)
+{
+  APEX_Memo* memo = APEX_calloc(1, sizeof(*memo));
+  if (!memo) {
+    return NULL;
+  }
+  memo->verify_every = verify_every;
+  memo->boundary_redirects = -1;
+  return memo;
+}
+
+void
+APEX_memo_free(APEX_Memo* memo)
+{
+  if (!memo) {
+    return;
+  }
+  for (int b = 0; b < MEMO_BUCKETS; ++b) {
+    APEX_Memo_Entry* entry = memo->buckets[b];
+    while (entry) {
+      APEX_Memo_Entry* next = entry->next;
+      APEX_free(entry);
+      entry = next;
+    }
+  }
+  APEX_free(memo->verify_cpu);
+  APEX_block_undo_free(&memo->undo);
+  APEX_free(memo);
+}
+
+static int
+is_nop(const CPU_Stage* stage)
+{
+  return strcmp(stage->opcode, "NOP") == 0;
+}
+
+static int
+is_control(const char* opcode)
+{
+  return strcmp(opcode, "BZ") == 0 || strcmp(opcode, "BNZ") == 0 || strcmp(opcode, "JUMP") == 0;
+}
+
+/*
+ * The pipeline holds the target of a taken branch or JUMP in fetch and
+ * decode and bubbles in execute and memory, so that no value is in flight.
+ * Holds for one cycle after each redirect.
+ */
+int
+APEX_block_boundary(APEX_CPU* cpu)
+{
+  CPU_Stage* stage = cpu->stage;
+  if (!is_control(stage[WB].opcode) || !is_nop(&stage[EX]) || !is_nop(&stage[MEM])) {
+    return 0;
+  }
+  for (int i = 0; i < NUM_STAGES; ++i) {
+    if (stage[i].busy || stage[i].stalled || (i >= EX && stage[i].cycles_left)) {
+      return 0;
+    }
+  }
+  return stage[F].pc == stage[DRF].pc && strcmp(stage[F].opcode, stage[DRF].opcode) == 0 &&
+         cpu->pc == stage[F].pc + 4;
+}
+
+/*
+ * Registers left marked invalid by earlier claims whose forwarded value is
+ * not the register value. Decode would read the forwarded value, so blocks
+ * reading them are not executed functionally.
+ */
+int
+APEX_block_stale_mask(APEX_CPU* cpu)
+{
+  int mask = 0;
+  for (int r = 0; r < 16; ++r) {
+    if (!cpu->regs_valid[r] &&
+        (!cpu->enable_data_forwarding || cpu->regs_forwarding[r] != cpu->regs[r])) {
+      mask |= 1 << r;
+    }
+  }
+  return mask;
+}
+
+/* Registers marked valid, part of the key as stale invalid ones change timing */
+int
+APEX_block_valid_mask(APEX_CPU* cpu)
+{
+  int mask = 0;
+  for (int r = 0; r < 16; ++r) {
+    if (cpu->regs_valid[r]) {
+      mask |= 1 << r;
+    }
+  }
+  return mask;
+}
+
+static unsigned int
+memo_hash(int entry_pc, int entry_valid, int exit_pc, int exit_target)
+{
+  unsigned int h = (unsigned int)entry_pc;
+  h = h * 31 + (unsigned int)entry_valid;
+  h = h * 31 + (unsigned int)exit_pc;
+  h = h * 31 + (unsigned int)exit_target;
+  return h % MEMO_BUCKETS;
+}
+
+static APEX_Memo_Entry*
+memo_find(APEX_Memo* memo, int entry_pc, int entry_valid, int exit_pc, int exit_target)
+{
+  APEX_Memo_Entry* entry = memo->buckets[memo_hash(entry_pc, entry_valid, exit_pc, exit_target)];
+  while (entry && (entry->entry_pc != entry_pc || entry->entry_valid != entry_valid ||
+                   entry->exit_pc != exit_pc ||
+                   entry->exit_target != exit_target)) {
+    entry = entry->next;
+  }
+  return entry;
+}
+
+/* Saves the architectural state, functional runs of blocks follow */
+void
+APEX_block_undo_begin(APEX_Block_Undo* undo, APEX_CPU* cpu)
+{
+  memcpy(undo->regs, cpu->regs, sizeof(undo->regs));
+  memcpy(undo->dirty_pages, cpu->dirty_pages, sizeof(undo->dirty_pages));
+  undo->zero_flag = cpu->zero_flag;
+  undo->pc = cpu->pc;
+  undo->count = 0;
+}
+
+/* Gives back everything executed since APEX_block_undo_begin */
+void
+APEX_block_undo(APEX_Block_Undo* undo, APEX_CPU* cpu)
+{
+  for (int i = undo->count - 1; i >= 0; --i) {
+    cpu->data_memory[undo->address[i]] = undo->value[i];
+  }
+  memcpy(cpu->regs, undo->regs, sizeof(cpu->regs));
+  memcpy(cpu->dirty_pages, undo->dirty_pages, sizeof(cpu->dirty_pages));
+  cpu->zero_flag = undo->zero_flag;
+  cpu->pc = undo->pc;
+  undo->count = 0;
+}
+
+void
+APEX_block_undo_free(APEX_Block_Undo* undo)
+{
+  APEX_free(undo->address);
+  APEX_free(undo->value);
+  undo->address = NULL;
+  undo->value = NULL;
+  undo->count = 0;
+  undo->capacity = 0;
+}
+
+static int
+log_store(APEX_Block_Undo* undo, int address, int value)
+{
+  if (undo->count == undo->capacity) {
+    int capacity = undo->capacity ? undo->capacity * 2 : 64;
+    int* a = APEX_realloc(undo->address, sizeof(int) * capacity);
+    if (a) {
+      undo->address = a;
+    }
+    int* v = a ? APEX_realloc(undo->value, sizeof(int) * capacity) : NULL;
+    if (!v) {
+      return -1;
+    }
+    undo->value = v;
+    undo->capacity = capacity;
+  }
+  undo->address[undo->count] = address;
+  undo->value[undo->count] = value;
+  undo->count++;
+  return 0;
+}
+
+/*
+ * Executes the block starting at cpu->pc functionally up to and including
+ * the first taken branch or JUMP, logging data memory writes in undo.
+ * Returns the instructions executed, 0 if the block is too long, reads a
+ * register in stale or contains HALT, a region marker or an error.
+ * Registers written are added to written.
+ */
+int
+APEX_block_run(APEX_CPU* cpu, APEX_Block_Undo* undo, int stale, int* exit_pc, int* exit_target,
+               int* written)
+{
+  for (int n = 1; n <= MEMO_MAX_BLOCK; ++n) {
+    int index = get_code_index(cpu->pc);
+    if (index < 0 || index >= cpu->code_memory_size) {
+      return 0;
+    }
+    const APEX_Instruction* ins = APEX_code_at(cpu, index);
+    const char* op = ins->opcode;
+    if (strcmp(op, "HALT") == 0 || strcmp(op, "ROI_BEGIN") == 0 || strcmp(op, "ROI_END") == 0) {
+      return 0;
+    }
+
+    int reads = 0;
+    if (strcmp(op, "LOAD") == 0 || strcmp(op, "JUMP") == 0) {
+      reads = 1 << ins->rs1;
+    } else if (strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0 || strcmp(op, "MUL") == 0 ||
+               strcmp(op, "AND") == 0 || strcmp(op, "OR") == 0 || strcmp(op, "EX-OR") == 0 ||
+               strcmp(op, "STORE") == 0) {
+      reads = (1 << ins->rs1) | (1 << ins->rs2);
+    }
+    if (reads & stale) {
+      return 0;
+    }
+
+    if (strcmp(op, "STORE") == 0) {
+      int address = cpu->regs[ins->rs2] + ins->imm;
+      if (address >= 0 && address < DATA_MEMORY_SIZE &&
+          log_store(undo, address, cpu->data_memory[address])) {
+        return 0;
+      }
+    } else if (strcmp(op, "ADD") == 0 || strcmp(op, "SUB") == 0 || strcmp(op, "MUL") == 0 ||
+               strcmp(op, "AND") == 0 || strcmp(op, "OR") == 0 || strcmp(op, "EX-OR") == 0 ||
+               strcmp(op, "MOVC") == 0 || strcmp(op, "LOAD") == 0) {
+      *written |= 1 << ins->rd;
+    }
+
+    /* The pipeline redirects on every JUMP, and on BZ/BNZ when taken even to pc + 4 */
+    int taken = strcmp(op, "JUMP") == 0 ||
+                (strcmp(op, "BZ") == 0 && cpu->zero_flag) ||
+                (strcmp(op, "BNZ") == 0 && !cpu->zero_flag);
+    int pc = cpu->pc;
+    if (APEX_functional_step(cpu) != FUNCTIONAL_OK) {
+      return 0;
+    }
+    if (taken) {
+      *exit_pc = pc;
+      *exit_target = cpu->pc;
+      return n;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Registers written by blocks executed functionally forward their new
+ * value, as they would have after stepping
+ */
+void
+APEX_block_forward(APEX_CPU* cpu, int written)
+{
+  if (cpu->enable_data_forwarding) {
+    for (int r = 0; r < 16; ++r) {
+      if (written & (1 << r)) {
+        cpu->regs_forwarding[r] = cpu->regs[r];
+      }
+    }
+  }
+}
+
+/* Completes a block executed functionally with its recorded timing */
+static void
+apply_entry(APEX_CPU* cpu, const APEX_Memo_Entry* entry, int written)
+{
+  memcpy(cpu->stage, entry->stage, sizeof(cpu->stage));
+  memcpy(cpu->regs_valid, entry->regs_valid, sizeof(cpu->regs_valid));
+  cpu->pc = entry->pc;
+  cpu->clock += entry->cycles;
+  cpu->ins_completed += entry->instructions;
+  cpu->redirects++;
+  APEX_block_forward(cpu, written);
+}
+
+/* Stores the block recorded since the previous boundary, if it is one block */
+static void
+finish_recording(APEX_Memo* memo, APEX_CPU* cpu)
+{
+  memo->recording = 0;
+  if (cpu->redirects != memo->rec_redirects + 1 || cpu->roi_entries != memo->rec_roi_entries ||
+      memo->num_entries >= MEMO_MAX_ENTRIES) {
+    return;
+  }
+  int exit_pc = cpu->stage[WB].pc;
+  int exit_target = cpu->stage[F].pc;
+  if (memo_find(memo, memo->rec_entry_pc, memo->rec_entry_valid, exit_pc, exit_target)) {
+    return;
+  }
+
+  APEX_Memo_Entry* entry = APEX_malloc(sizeof(*entry));
+  if (!entry) {
+    return;
+  }
+  entry->entry_pc = memo->rec_entry_pc;
+  entry->entry_valid = memo->rec_entry_valid;
+  entry->exit_pc = exit_pc;
+  entry->exit_target = exit_target;
+  entry->cycles = cpu->clock - memo->rec_clock;
+  entry->instructions = cpu->ins_completed - memo->rec_ins_completed;
+  entry->pc = cpu->pc;
+  memcpy(entry->stage, cpu->stage, sizeof(entry->stage));
+  memcpy(entry->regs_valid, cpu->regs_valid, sizeof(entry->regs_valid));
+
+  unsigned int b = memo_hash(entry->entry_pc, entry->entry_valid, exit_pc, exit_target);
+  entry->next = memo->buckets[b];
+  memo->buckets[b] = entry;
+  memo->num_entries++;
+}
+
+/* Timing state of a latch, its values aside */
+static int
+same_latch(const CPU_Stage* a, const CPU_Stage* b)
+{
+  return a->pc == b->pc && strcmp(a->opcode, b->opcode) == 0 && a->busy == b->busy &&
+         a->stalled == b->stalled && a->cycles_left == b->cycles_left;
+}
+
+/* Any nonzero status is valid: APEX_cpu_create sets them bytewise, writeback to 1 */
+static int
+same_register_status(const APEX_CPU* a, const APEX_CPU* b)
+{
+  for (int r = 0; r < 16; ++r) {
+    if (!a->regs_valid[r] != !b->regs_valid[r]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* Compares the state a hit produced with the one stepping reached */
+static void
+verify(APEX_Memo* memo, APEX_CPU* cpu)
+{
+  APEX_CPU* expected = memo->verify_cpu;
+  const char* field = NULL;
+
+  if (cpu->clock != expected->clock) {
+    field = "clock";
+  } else if (cpu->ins_completed != expected->ins_completed) {
+    field = "instructions completed";
+  } else if (cpu->pc != expected->pc) {
+    field = "pc";
+  } else if (memcmp(cpu->regs, expected->regs, sizeof(cpu->regs)) != 0 ||
+             cpu->zero_flag != expected->zero_flag) {
+    field = "registers";
+  } else if (!same_register_status(cpu, expected)) {
+    field = "register status";
+  } else if (cpu->enable_data_forwarding &&
+             memcmp(cpu->regs_forwarding, expected->regs_forwarding, sizeof(cpu->regs_forwarding)) != 0) {
+    field = "forwarded values";
+  } else if (memcmp(cpu->data_memory, expected->data_memory, sizeof(cpu->data_memory)) != 0) {
+    field = "data memory";
+  } else {
+    for (int i = 0; i < NUM_STAGES && !field; ++i) {
+      if (!same_latch(&cpu->stage[i], &expected->stage[i])) {
+        field = "pipeline latches";
+      }
+    }
+  }
+
+  memo->verified++;
+  if (field) {
+    if (!memo->mismatches) {
+      fprintf(stderr, "APEX_Error : Memoized block ending at cycle %d differs from stepping in %s\n",
+              expected->clock, field);
+    }
+    memo->mismatches++;
+  }
+  APEX_free(expected);
+  memo->verify_cpu = NULL;
+}
+
+/*
+ * Called by the simulation loop before each cycle. At a block boundary,
+ * replays the next block if it is cached and returns 1, having advanced
+ * the cpu to the end of the block. Otherwise returns 0 and the cycle is
+ * stepped, recording the block if it was not cached.
+ */
+int
+APEX_memo_apply(APEX_CPU* cpu)
+{
+  APEX_Memo* memo = cpu->memo;
+
+  if (memo->verify_cpu && cpu->clock >= memo->verify_clock) {
+    verify(memo, cpu);
+  }
+  if (cpu->redirects == memo->boundary_redirects || !APEX_block_boundary(cpu)) {
+    return 0;
+  }
+  memo->boundary_redirects = cpu->redirects;
+  if (memo->recording) {
+    finish_recording(memo, cpu);
+  }
+
+  APEX_block_undo_begin(&memo->undo, cpu);
+  int entry_pc = cpu->stage[DRF].pc;
+  int entry_valid = APEX_block_valid_mask(cpu);
+  int exit_pc = 0;
+  int exit_target = 0;
+  int written = 0;
+  cpu->pc = entry_pc;
+  int n = APEX_block_run(cpu, &memo->undo, APEX_block_stale_mask(cpu), &exit_pc, &exit_target,
+                         &written);
+  APEX_Memo_Entry* entry = n ? memo_find(memo, entry_pc, entry_valid, exit_pc, exit_target) : NULL;
+
+  if (entry && entry->instructions == n &&
+      (cpu->function_cycles <= 0 || cpu->clock + entry->cycles <= cpu->function_cycles)) {
+    memo->hits++;
+    if (memo->verify_every && !memo->verify_cpu && memo->hits % memo->verify_every == 0) {
+      /* Keep the replayed result aside and step the block for real */
+      APEX_CPU* expected = APEX_cpu_clone(cpu);
+      APEX_block_undo(&memo->undo, cpu);
+      if (expected) {
+        apply_entry(expected, entry, written);
+        memo->verify_cpu = expected;
+        memo->verify_clock = expected->clock;
+      }
+      return 0;
+    }
+    apply_entry(cpu, entry, written);
+    memo->cycles_replayed += entry->cycles;
+    return 1;
+  }
+
+  APEX_block_undo(&memo->undo, cpu);
+  memo->misses++;
+  if (!entry) {
+    memo->recording = 1;
+    memo->rec_entry_pc = entry_pc;
+    memo->rec_entry_valid = entry_valid;
+    memo->rec_clock = cpu->clock;
+    memo->rec_ins_completed = cpu->ins_completed;
+    memo->rec_redirects = cpu->redirects;
+    memo->rec_roi_entries = cpu->roi_entries;
+  }
+  return 0;
+}
+
+void
+APEX_memo_report(APEX_Memo* memo)
+{
+  printf("Block timing memo: %d blocks cached, %ld hits, %ld misses, %ld cycles replayed",
+         memo->num_entries, memo->hits, memo->misses, memo->cycles_replayed);
+  if (memo->verify_every) {
+    printf(", %ld verified, %ld mismatches", memo->verified, memo->mismatches);
+  }
+  printf(" \n");
+}
+
+/* Registers the counters of the memo under "memo". Returns 0 on success */
+int
+APEX_memo_register_stats(APEX_Memo* memo, APEX_Stats* stats)
+{
+  int ok = APEX_stats_bind_int(stats, "memo.blocks_cached", &memo->num_entries) &&
+           APEX_stats_bind(stats, "memo.hits", &memo->hits) &&
+           APEX_stats_bind(stats, "memo.misses", &memo->misses) &&
+           APEX_stats_bind(stats, "memo.cycles_replayed", &memo->cycles_replayed);
+  if (ok && memo->verify_every) {
+    ok = APEX_stats_bind(stats, "memo.verified", &memo->verified) &&
+         APEX_stats_bind(stats, "memo.mismatches", &memo->mismatches);
+  }
+  return ok ? 0 : -1;
+}
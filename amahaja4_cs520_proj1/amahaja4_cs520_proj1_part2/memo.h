@@ -0,0 +1,130 @@
+#ifndef _APEX_MEMO_H_
+#define _APEX_MEMO_H_
+/**
+ *  memo.h
+ *  Contains data structures for memoized basic block timing
+ *
+ *  A taken branch or JUMP leaves the pipeline in a clean state: every
+ *  older instruction has retired, fetch and decode hold the target and
+ *  execute and memory hold bubbles. From such a state the cycles until the
+ *  next taken branch or JUMP depend only on the target and on the path of
+ *  instructions executed, not on register or memory values. The memo
+ *  records, per (target, valid registers, ending branch, its target), the
+ *  cycles and the pipeline latches at the end of the block. A functional
+ *  run of the block finds the path and, on a hit, produces the values.
+ */
+
+#include "cpu.h"
+
+#define MEMO_BUCKETS 1024
+
+/* Blocks are at most this many instructions long, longer ones are stepped */
+#define MEMO_MAX_BLOCK 1024
+
+/* Cached blocks, recording stops when the memo is full */
+#define MEMO_MAX_ENTRIES 65536
+
+/* Architectural state to give back when a functional run of blocks is abandoned */
+typedef struct APEX_Block_Undo
+{
+    int regs[16];
+    int zero_flag;
+    int pc;
+    unsigned char dirty_pages[DATA_NUM_PAGES];
+    int* address;		// Data memory words written, oldest first
+    int* value;		    // Their previous values
+    int count;
+    int capacity;
+} APEX_Block_Undo;
+
+typedef struct APEX_Memo_Entry
+{
+    /* Key */
+    int entry_pc;		// Target the block starts at
+    int entry_valid;	// Mask of registers marked valid at the start
+    int exit_pc;		// Taken branch or JUMP ending the block
+    int exit_target;	// Where it went
+
+    /* Result */
+    int cycles;
+    int instructions;	// Retired, the previous block's branch included
+    int pc;		        // Fetch PC at the end
+    CPU_Stage stage[NUM_STAGES];	// Latches at the end
+    int regs_valid[16];
+
+    struct APEX_Memo_Entry* next;
+} APEX_Memo_Entry;
+
+typedef struct APEX_Memo
+{
+    APEX_Memo_Entry* buckets[MEMO_BUCKETS];
+    int num_entries;
+
+    /* Redirect count at the last block boundary seen */
+    int boundary_redirects;
+
+    /* Block being recorded */
+    int recording;
+    int rec_entry_pc;
+    int rec_entry_valid;
+    int rec_clock;
+    int rec_ins_completed;
+    int rec_redirects;
+    int rec_roi_entries;
+
+    /* Undo log of a functional run that missed */
+    APEX_Block_Undo undo;
+
+    /* Every verify_every-th hit is also stepped and compared, 0 disables */
+    int verify_every;
+    APEX_CPU* verify_cpu;	// Result of the hit, awaiting comparison
+    int verify_clock;		// Clock at which stepping reaches it
+
+    long hits;
+    long misses;
+    long cycles_replayed;
+    long verified;
+    long mismatches;
+} APEX_Memo;
+
+int
+APEX_block_boundary(APEX_CPU* cpu);
+
+int
+APEX_block_valid_mask(APEX_CPU* cpu);
+
+int
+APEX_block_stale_mask(APEX_CPU* cpu);
+
+void
+APEX_block_undo_begin(APEX_Block_Undo* undo, APEX_CPU* cpu);
+
+int
+APEX_block_run(APEX_CPU* cpu, APEX_Block_Undo* undo, int stale, int* exit_pc, int* exit_target,
+               int* written);
+
+void
+APEX_block_undo(APEX_Block_Undo* undo, APEX_CPU* cpu);
+
+void
+APEX_block_undo_free(APEX_Block_Undo* undo);
+
+void
+APEX_block_forward(APEX_CPU* cpu, int written);
+
+APEX_Memo*
+APEX_memo_create(int verify_every);
+
+void
+APEX_memo_free(APEX_Memo* memo);
+
+int
+APEX_memo_apply(APEX_CPU* cpu);
+
+void
+APEX_memo_report(APEX_Memo* memo);
+
+int
+APEX_memo_register_stats(APEX_Memo* memo, struct APEX_Stats* stats);
+
+#endif
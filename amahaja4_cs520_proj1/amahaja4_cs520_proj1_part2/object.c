@@ -0,0 +1,152 @@
+/*
+ *  object.c
+ *  Contains the encoding, writing and mapping of binary APEX objects
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "object.h"
+
+/* Record opcode numbers, 0 is the empty line */
+static const char* opcodes[] = { "", "ADD", "SUB", "MUL", "AND", "OR", "EX-OR", "MOVC", "LOAD",
+                                 "STORE", "BZ", "BNZ", "JUMP", "HALT", "ROI_BEGIN", "ROI_END" };
+
+#define NUM_OPCODES ((int)(sizeof(opcodes) / sizeof(opcodes[0])))
+
+static int
+fits_nibble(int value)
+{
+  return value >= 0 && value < 16;
+}
+
+/*
+ * Encodes ins, from the given line of its source, into record. Returns -1
+ * for opcodes the format has no number for and registers beyond R15.
+ */
+int
+APEX_object_encode(const APEX_Instruction* ins, APEX_Object_Ins* record, int line)
+{
+  int op = -1;
+  for (int i = 0; i < NUM_OPCODES; ++i) {
+    if (strcmp(ins->opcode, opcodes[i]) == 0) {
+      op = i;
+      break;
+    }
+  }
+  if (op < 0) {
+    fprintf(stderr, "APEX_Error : Unknown opcode %s at line %d\n", ins->opcode, line);
+    return -1;
+  }
+  /* Fields an opcode does not use are zero */
+  if (!fits_nibble(ins->rd) || !fits_nibble(ins->rs1) || !fits_nibble(ins->rs2)) {
+    fprintf(stderr, "APEX_Error : Register out of range at line %d (%s)\n", line, ins->opcode);
+    return -1;
+  }
+
+  record->opcode = op;
+  record->rd_rs1 = ins->rd | ins->rs1 << 4;
+  record->rs2_dep_z = ins->rs2 | ins->dep_z << 4;
+  record->deps = ins->dep_rs1 | ins->dep_rs2 << 4;
+  record->imm = ins->imm;
+  return 0;
+}
+
+void
+APEX_object_decode(const APEX_Object_Ins* record, APEX_Instruction* ins)
+{
+  int op = record->opcode < NUM_OPCODES ? record->opcode : 0;
+  strcpy(ins->opcode, opcodes[op]);
+  ins->rd = record->rd_rs1 & 0xF;
+  ins->rs1 = record->rd_rs1 >> 4;
+  ins->rs2 = record->rs2_dep_z & 0xF;
+  ins->dep_z = record->rs2_dep_z >> 4;
+  ins->dep_rs1 = record->deps & 0xF;
+  ins->dep_rs2 = record->deps >> 4;
+  ins->imm = record->imm;
+}
+
+/* Returns 0 on success, -1 if the file cannot be written */
+int
+APEX_object_write(const char* filename, const APEX_Object_Ins* records, int num_instructions,
+                  const int* data, int num_data, int flags)
+{
+  FILE* fp = fopen(filename, "wb");
+  if (!fp) {
+    return -1;
+  }
+
+  APEX_Object_Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, OBJECT_MAGIC, sizeof(OBJECT_MAGIC));
+  header.version = OBJECT_VERSION;
+  header.flags = flags;
+  header.num_instructions = num_instructions;
+  header.num_data = num_data;
+
+  int failed = fwrite(&header, sizeof(header), 1, fp) != 1 ||
+               fwrite(records, sizeof(*records), num_instructions, fp) != (size_t)num_instructions ||
+               (num_data && fwrite(data, sizeof(*data), num_data, fp) != (size_t)num_data);
+  if (fclose(fp) || failed) {
+    remove(filename);
+    return -1;
+  }
+  return 0;
+}
+
+/* Whether the file starts like an object, text programs never do */
+int
+APEX_object_is_file(const char* filename)
+{
+  FILE* fp = fopen(filename, "rb");
+  if (!fp) {
+    return 0;
+  }
+  char magic[8];
+  int is_object = fread(magic, sizeof(magic), 1, fp) == 1 &&
+                  memcmp(magic, OBJECT_MAGIC, sizeof(OBJECT_MAGIC)) == 0;
+  fclose(fp);
+  return is_object;
+}
+
+/*
+ * Maps an object read-only and shared, records and data follow the
+ * header. Returns NULL if the file is not a complete object of this
+ * version.
+ */
+const APEX_Object_Header*
+APEX_object_map(const char* filename, size_t* mapped_size)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size < sizeof(APEX_Object_Header)) {
+    close(fd);
+    return NULL;
+  }
+  const APEX_Object_Header* header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (header == MAP_FAILED) {
+    return NULL;
+  }
+
+  size_t expected = sizeof(*header) + (size_t)header->num_instructions * sizeof(APEX_Object_Ins) +
+                    (size_t)header->num_data * sizeof(int);
+  if (memcmp(header->magic, OBJECT_MAGIC, sizeof(OBJECT_MAGIC)) != 0 ||
+      header->version != OBJECT_VERSION || header->num_instructions <= 0 ||
+      header->num_data < 0 || header->num_data > DATA_MEMORY_SIZE ||
+      (size_t)st.st_size != expected) {
+    fprintf(stderr, "APEX_Error : %s is not a complete version %d APEX object\n", filename,
+            OBJECT_VERSION);
+    munmap((void*)header, st.st_size);
+    return NULL;
+  }
+  *mapped_size = st.st_size;
+  return header;
+}
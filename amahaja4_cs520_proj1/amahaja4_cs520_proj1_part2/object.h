@@ -0,0 +1,57 @@
+#ifndef _APEX_OBJECT_H_
+#define _APEX_OBJECT_H_
+/**
+ *  object.h
+ *  Contains the binary APEX object format
+ *
+ *  An object file is a header, one fixed-width record per instruction and
+ *  the initial contents of data memory from address 0. Records keep the
+ *  dependence annotations, so the loader maps the file read-only and
+ *  shared and expands a record the first time it is fetched, with no
+ *  parsing. Fields are in host byte order, like checkpoints.
+ */
+
+#include "cpu.h"
+
+#define OBJECT_MAGIC "APEXOBJ"
+#define OBJECT_VERSION 1
+
+/* Header flags */
+#define OBJECT_HAS_ROI 1	// Some instruction is a ROI_BEGIN
+
+typedef struct APEX_Object_Header
+{
+    char magic[8];
+    int version;
+    int flags;
+    int num_instructions;	// Records following the header
+    int num_data;		// Data memory words following the records
+} APEX_Object_Header;
+
+/* An encoded instruction, registers and dependence distances fit in 4 bits */
+typedef struct APEX_Object_Ins
+{
+    unsigned char opcode;	// Index in the opcode table of object.c
+    unsigned char rd_rs1;	// rd | rs1 << 4
+    unsigned char rs2_dep_z;	// rs2 | dep_z << 4
+    unsigned char deps;		// dep_rs1 | dep_rs2 << 4
+    int imm;
+} APEX_Object_Ins;
+
+int
+APEX_object_encode(const APEX_Instruction* ins, APEX_Object_Ins* record, int line);
+
+void
+APEX_object_decode(const APEX_Object_Ins* record, APEX_Instruction* ins);
+
+int
+APEX_object_write(const char* filename, const APEX_Object_Ins* records, int num_instructions,
+                  const int* data, int num_data, int flags);
+
+int
+APEX_object_is_file(const char* filename);
+
+const APEX_Object_Header*
+APEX_object_map(const char* filename, size_t* mapped_size);
+
+#endif
@@ -0,0 +1,349 @@
+/*
+ *  parallel.c
+ *  Contains the functional checkpointing pass and the worker threads of
+ *  time-parallel detailed simulation
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "parallel.h"
+#include "bbcache.h"
+#include "arena.h"
+
+/*
+ * Runs the program functionally on a copy of the cpu and cuts the dynamic
+ * instruction stream into segments of segment_length instructions. A
+ * checkpoint is taken warmup instructions ahead of every segment start.
+ * The cycle limit of the cpu bounds the instructions executed; only if the
+ * program ended first is the final segment marked last. The copy is
+ * returned in final, holding the architectural state at the end. If given,
+ * hook observes every instruction before it executes.
+ */
+APEX_Segment*
+APEX_functional_segments(APEX_CPU* cpu, APEX_Checkpoint_Series* checkpoints,
+                         int segment_length, int warmup, int* num_segments, APEX_CPU** final,
+                         APEX_Functional_Hook hook, void* hook_arg)
+{
+  APEX_CPU* fcpu = APEX_cpu_clone(cpu);
+  if (!fcpu) {
+    return NULL;
+  }
+
+  /* Without a hook whole blocks run between checkpoints */
+  APEX_Block_Cache* cache = hook ? NULL : APEX_bbcache_create(fcpu);
+
+  int capacity = 16;
+  int* positions = APEX_malloc(sizeof(*positions) * capacity);
+  int* indices = APEX_malloc(sizeof(*indices) * capacity);
+  if (!positions || !indices) {
+    APEX_free(positions);
+    APEX_free(indices);
+    APEX_bbcache_free(cache);
+    APEX_free(fcpu);
+    return NULL;
+  }
+
+  /* Checkpoint k is taken after positions[k] instructions */
+  int num_checkpoints = 0;
+  int next_segment = 1;
+  int count = 0;
+  int status = FUNCTIONAL_OK;
+  while (1) {
+    int position = next_segment * segment_length - warmup;
+    if (count == 0 || count == position) {
+      if (num_checkpoints == capacity) {
+        capacity *= 2;
+        int* p = APEX_realloc(positions, sizeof(*positions) * capacity);
+        int* q = p ? APEX_realloc(indices, sizeof(*indices) * capacity) : NULL;
+        if (p) {
+          positions = p;
+        }
+        if (!q) {
+          status = FUNCTIONAL_ERROR;
+          break;
+        }
+        indices = q;
+      }
+      APEX_Checkpoint* ckpt = APEX_checkpoint_take(checkpoints, fcpu);
+      if (!ckpt) {
+        status = FUNCTIONAL_ERROR;
+        break;
+      }
+      positions[num_checkpoints] = count;
+      indices[num_checkpoints] = ckpt->core.index;
+      num_checkpoints++;
+    }
+    while (next_segment * segment_length - warmup <= count) {
+      next_segment++;
+    }
+
+    if (cpu->function_cycles > 0 && count >= cpu->function_cycles) {
+      break;
+    }
+    if (hook) {
+      hook(hook_arg, fcpu, count);
+    }
+    if (cache) {
+      int budget = next_segment * segment_length - warmup - count;
+      if (cpu->function_cycles > 0 && cpu->function_cycles - count < budget) {
+        budget = cpu->function_cycles - count;
+      }
+      int executed = APEX_bbcache_run(cache, fcpu, budget);
+      if (executed) {
+        count += executed;
+        continue;
+      }
+    }
+    status = APEX_functional_step(fcpu);
+    if (status == FUNCTIONAL_OK || status == FUNCTIONAL_HALT) {
+      count++;
+    }
+    if (status != FUNCTIONAL_OK) {
+      break;
+    }
+  }
+
+  if (status == FUNCTIONAL_ERROR) {
+    fprintf(stderr, "APEX_Error : Functional pass failed at pc %d\n", fcpu->pc);
+    APEX_free(positions);
+    APEX_free(indices);
+    APEX_bbcache_free(cache);
+    APEX_free(fcpu);
+    return NULL;
+  }
+
+  /* Stopped by the limit, the program goes on past the final segment */
+  int ended = status == FUNCTIONAL_HALT || status == FUNCTIONAL_END;
+  int n = count ? (count + segment_length - 1) / segment_length : 1;
+  APEX_Segment* segments = APEX_calloc(n, sizeof(*segments));
+  if (segments) {
+    int c = 0;
+    for (int k = 0; k < n; ++k) {
+      int start = k * segment_length;
+      int from = start > warmup ? start - warmup : 0;
+      while (c + 1 < num_checkpoints && positions[c + 1] <= from) {
+        c++;
+      }
+      segments[k].start = start;
+      segments[k].length = k == n - 1 ? count - start : segment_length;
+      segments[k].warmup = start - positions[c];
+      segments[k].checkpoint = indices[c];
+      segments[k].last = k == n - 1 && ended;
+    }
+  }
+
+  APEX_free(positions);
+  APEX_free(indices);
+  if (!segments) {
+    APEX_bbcache_free(cache);
+    APEX_free(fcpu);
+    return NULL;
+  }
+  *num_segments = n;
+  APEX_bbcache_free(cache);
+  *final = fcpu;
+  return segments;
+}
+
+/*
+ * Simulates one segment in detail on a private copy of the cpu. Retire
+ * cycles are sampled at the segment boundaries and overlap instructions
+ * after each of them.
+ */
+static void
+simulate_segment(APEX_Parallel_Run* run, APEX_Segment* segment)
+{
+  APEX_CPU* cpu = APEX_cpu_clone(run->cpu);
+  if (!cpu || APEX_checkpoint_restore(run->checkpoints, segment->checkpoint, cpu)) {
+    segment->failed = 1;
+    APEX_free(cpu);
+    return;
+  }
+  APEX_cpu_reset_pipeline(cpu);
+  cpu->clock = 0;
+  cpu->ins_completed = 0;
+
+  int overlap = run->overlap < segment->length ? run->overlap : segment->length;
+  int marks[4] = {
+    segment->warmup,
+    segment->warmup + overlap,
+    segment->warmup + segment->length,
+    segment->warmup + segment->length + run->overlap
+  };
+  int clocks[4] = { -1, -1, -1, -1 };
+
+  /* Generous bound so that a broken restore cannot hang a worker */
+  long max_cycles = 1000 + 100L * (marks[3] > 0 ? marks[3] : 1);
+
+  while (1) {
+    for (int i = 0; i < 4; ++i) {
+      if (clocks[i] < 0 && cpu->ins_completed == marks[i]) {
+        clocks[i] = cpu->clock;
+      }
+    }
+    if ((!segment->last && clocks[3] >= 0) || APEX_cpu_halted(cpu) || cpu->clock >= max_cycles) {
+      break;
+    }
+    APEX_cpu_step(cpu);
+  }
+
+  if (segment->last) {
+    /* The final segment also pays for draining the pipeline */
+    clocks[2] = cpu->clock;
+    clocks[3] = cpu->clock;
+  } else if (clocks[3] < 0 && APEX_cpu_halted(cpu)) {
+    /* Program ended within the overlap past this segment */
+    clocks[3] = cpu->clock;
+  }
+
+  if (clocks[0] < 0 || clocks[1] < 0 || clocks[2] < 0 || clocks[3] < 0) {
+    segment->failed = 1;
+  } else {
+    segment->cycles = clocks[2] - clocks[0];
+    segment->head_cycles = clocks[1] - clocks[0];
+    segment->tail_cycles = clocks[3] - clocks[2];
+  }
+  APEX_free(cpu);
+}
+
+static void*
+segment_worker(void* arg)
+{
+  APEX_Parallel_Run* run = arg;
+  while (1) {
+    int k = __atomic_fetch_add(&run->next_segment, 1, __ATOMIC_RELAXED);
+    if (k >= run->num_segments) {
+      break;
+    }
+    simulate_segment(run, &run->segments[k]);
+  }
+  return NULL;
+}
+
+/*
+ * Simulates every segment of the run on up to the given number of threads.
+ * Returns the number of segments that could not be simulated.
+ */
+int
+APEX_simulate_segments(APEX_Parallel_Run* run, int threads)
+{
+  if (threads > run->num_segments) {
+    threads = run->num_segments;
+  }
+  if (threads < 1) {
+    threads = 1;
+  }
+
+  pthread_t* workers = APEX_malloc(sizeof(*workers) * threads);
+  int started = 0;
+  run->next_segment = 0;
+  for (int i = 0; workers && i < threads; ++i) {
+    if (pthread_create(&workers[i], NULL, segment_worker, run) == 0) {
+      started++;
+    }
+  }
+  if (!started) {
+    /* No threads available, simulate on the calling thread */
+    segment_worker(run);
+  }
+  for (int i = 0; i < started; ++i) {
+    pthread_join(workers[i], NULL);
+  }
+  APEX_free(workers);
+
+  int failed = 0;
+  for (int k = 0; k < run->num_segments; ++k) {
+    failed += run->segments[k].failed;
+  }
+  return failed;
+}
+
+/*
+ *  Time-parallel replacement for APEX_cpu_run
+ */
+int
+APEX_parallel_run(APEX_CPU* cpu, int segment_length, int warmup, int threads)
+{
+  APEX_Checkpoint_Series* checkpoints =
+      APEX_checkpoint_series_create(NULL, cpu->code_memory_size);
+  if (!checkpoints) {
+    return -1;
+  }
+
+  int num_segments = 0;
+  APEX_CPU* final = NULL;
+  APEX_Segment* segments =
+      APEX_functional_segments(cpu, checkpoints, segment_length, warmup, &num_segments, &final,
+                               NULL, NULL);
+  if (!segments) {
+    APEX_checkpoint_series_free(checkpoints);
+    return -1;
+  }
+
+  APEX_Parallel_Run run;
+  memset(&run, 0, sizeof(run));
+  run.cpu = cpu;
+  run.checkpoints = checkpoints;
+  run.segments = segments;
+  run.num_segments = num_segments;
+  run.overlap = warmup;
+
+  int failed = APEX_simulate_segments(&run, threads);
+
+  printf("(apex) >> Time-parallel simulation: %d segments of %d instructions, warm-up %d, %d threads\n",
+         num_segments, segment_length, warmup, threads);
+  if (!segments[num_segments - 1].last) {
+    /* Segments are cut from the functional run, which counts instructions */
+    printf("(apex) >> Stopped by the cycle limit, applied as a limit of %d instructions\n",
+           cpu->function_cycles);
+  }
+  printf("%-9s %-12s %-14s %-10s %s\n", "segment", "start", "instructions", "cycles", "boundary error");
+
+  long total_cycles = 0;
+  long total_instructions = 0;
+  long total_error = 0;
+  int failed_segments = 0;
+  for (int k = 0; k < num_segments; ++k) {
+    APEX_Segment* s = &segments[k];
+    if (s->failed) {
+      printf("%-9d %-12d %-14d failed\n", k, s->start, s->length);
+      failed_segments++;
+      continue;
+    }
+    total_cycles += s->cycles;
+    total_instructions += s->length;
+    printf("%-9d %-12d %-14d %-10d", k, s->start, s->length, s->cycles);
+
+    /* Both neighbours simulated the overlap instructions after the boundary */
+    if (k > 0 && !segments[k - 1].failed && warmup > 0 && s->length >= warmup) {
+      int error = s->head_cycles - segments[k - 1].tail_cycles;
+      total_error += error < 0 ? -error : error;
+      printf(" %+d", error);
+    }
+    printf("\n");
+  }
+
+  printf("(apex) >> Simulation Complete \n");
+  printf("Total Instructions Present: %d, Total instructions processed: %ld \n",
+         cpu->code_memory_size, total_instructions);
+  /* Without warm-up no instructions are simulated on both sides of a
+   * boundary, so its error cannot be measured, only the cold start shows */
+  printf("Total clock cycles taken: %ld (stitched, boundary error ", total_cycles);
+  if (warmup > 0) {
+    printf("%ld cycles", total_error);
+  } else {
+    printf("n/a without warm-up");
+  }
+  if (failed_segments) {
+    printf(", %d failed segments left out", failed_segments);
+  }
+  printf(")\n");
+  Print_regs_content(final);
+
+  APEX_free(final);
+  APEX_free(segments);
+  APEX_checkpoint_series_free(checkpoints);
+  return failed ? -1 : 0;
+}
@@ -0,0 +1,57 @@
+#ifndef _APEX_PARALLEL_H_
+#define _APEX_PARALLEL_H_
+/**
+ *  parallel.h
+ *  Contains data structures for time-parallel detailed simulation
+ *
+ *  A functional pass drops checkpoints along the dynamic instruction
+ *  stream. Worker threads then simulate fixed-size segments of it in full
+ *  pipeline detail, each one warmed up on the instructions preceding its
+ *  segment, and the segment cycle counts are stitched into a total.
+ */
+
+#include "cpu.h"
+#include "checkpoint.h"
+
+/* Called by the functional pass before each instruction, count is its dynamic index */
+typedef void (*APEX_Functional_Hook)(void* arg, APEX_CPU* cpu, int count);
+
+/* One slice of the dynamic instruction stream */
+typedef struct APEX_Segment
+{
+    int start;		    // Dynamic index of the first measured instruction
+    int length;		    // Instructions measured
+    int warmup;		    // Instructions simulated before start, not measured
+    int checkpoint;		// Checkpoint taken at instruction start - warmup
+    int last;		    // Segment runs until the program ends
+
+    /* Filled in by the worker */
+    int cycles;		    // Cycles to retire the measured instructions
+    int head_cycles;	// Cycles of the first overlap instructions of the segment
+    int tail_cycles;	// Cycles of overlap instructions simulated past the end
+    int failed;
+} APEX_Segment;
+
+/* Shared by the worker threads of one time-parallel run */
+typedef struct APEX_Parallel_Run
+{
+    APEX_CPU* cpu;		// Initial state, cloned by every worker
+    APEX_Checkpoint_Series* checkpoints;
+    APEX_Segment* segments;
+    int num_segments;
+    int overlap;		// Instructions used to estimate boundary errors
+    int next_segment;	// Next segment to hand out, taken atomically
+} APEX_Parallel_Run;
+
+APEX_Segment*
+APEX_functional_segments(APEX_CPU* cpu, APEX_Checkpoint_Series* checkpoints,
+                         int segment_length, int warmup, int* num_segments, APEX_CPU** final,
+                         APEX_Functional_Hook hook, void* hook_arg);
+
+int
+APEX_simulate_segments(APEX_Parallel_Run* run, int threads);
+
+int
+APEX_parallel_run(APEX_CPU* cpu, int segment_length, int warmup, int threads);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ *  profile.c
+ *  Contains the per-instruction hotspot profile and its annotated listing
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "profile.h"
+#include "cpi.h"
+#include "object.h"
+#include "arena.h"
+
+/* Causes listed as stall columns. Fill has no instruction to charge, base
+ * is the executions and replayed cycles are never stepped */
+static const int listed_causes[] = {
+  CPI_RAW, CPI_LOAD_USE, CPI_MUL, CPI_BRANCH_Z, CPI_FLUSH, CPI_DRAIN, CPI_NOP
+};
+#define NUM_LISTED_CAUSES (int)(sizeof(listed_causes) / sizeof(listed_causes[0]))
+
+/* Profiles the code of cpu, listing input to out at the end of the run */
+APEX_Profile*
+APEX_profile_create(APEX_CPU* cpu, FILE* out, const char* input)
+{
+  APEX_Profile* profile = APEX_calloc(1, sizeof(*profile));
+  if (!profile) {
+    return NULL;
+  }
+  profile->pcs = APEX_calloc(cpu->code_memory_size ? cpu->code_memory_size : 1,
+                             sizeof(*profile->pcs));
+  if (!profile->pcs) {
+    APEX_free(profile);
+    return NULL;
+  }
+  profile->size = cpu->code_memory_size;
+  profile->out = out;
+  profile->input = input;
+  return profile;
+}
+
+void
+APEX_profile_free(APEX_Profile* profile)
+{
+  if (!profile) {
+    return;
+  }
+  APEX_free(profile->pcs);
+  APEX_free(profile);
+}
+
+static void
+write_counters(FILE* fp, const APEX_Pc_Profile* pc)
+{
+  fprintf(fp, "%10ld %10ld", pc->executions, pc->decode_cycles);
+  for (int i = 0; i < NUM_LISTED_CAUSES; ++i) {
+    fprintf(fp, " %10ld", pc->stalls[listed_causes[i]]);
+  }
+  fprintf(fp, " %10ld", pc->flushes);
+}
+
+/* Text of line index, without its newline. Objects list the decoded fields */
+static void
+write_source(FILE* fp, APEX_CPU* cpu, FILE* source, char** line, size_t* capacity, int index)
+{
+  if (!source) {
+    const APEX_Instruction* ins = APEX_code_at(cpu, index);
+    fprintf(fp, "%-9s %-9d %-9d %-9d %d", ins->opcode, ins->rd, ins->rs1, ins->rs2, ins->imm);
+    return;
+  }
+  ssize_t length = getline(line, capacity, source);
+  while (length > 0 && ((*line)[length - 1] == '\n' || (*line)[length - 1] == '\r')) {
+    length--;
+  }
+  if (length > 0) {
+    fwrite(*line, 1, length, fp);
+  }
+}
+
+/*
+ * Lists every line of the input with its counters, and their totals, as of
+ * the end of the run. Returns 0 on success.
+ */
+int
+APEX_profile_write(APEX_Profile* profile, APEX_CPU* cpu)
+{
+  FILE* fp = profile->out;
+  FILE* source = NULL;
+  if (!APEX_object_is_file(profile->input)) {
+    source = fopen(profile->input, "r");
+    if (!source) {
+      fprintf(stderr, "APEX_Error : Unable to read %s to annotate it\n", profile->input);
+      return -1;
+    }
+  }
+
+  fprintf(fp, "Profile of %s: %d cycles, %d instructions\n", profile->input, cpu->clock,
+          cpu->ins_completed);
+  fprintf(fp, "%6s %10s %10s", "pc", "executed", "decode");
+  for (int i = 0; i < NUM_LISTED_CAUSES; ++i) {
+    fprintf(fp, " %10s", APEX_cpi_cause_name(listed_causes[i]));
+  }
+  fprintf(fp, " %10s  %s\n", "flushes", "instruction");
+
+  APEX_Pc_Profile total;
+  memset(&total, 0, sizeof(total));
+  char* line = NULL;
+  size_t capacity = 0;
+  for (int i = 0; i < profile->size; ++i) {
+    const APEX_Pc_Profile* pc = &profile->pcs[i];
+    total.executions += pc->executions;
+    total.decode_cycles += pc->decode_cycles;
+    for (int c = 0; c < CPI_NUM_CAUSES; ++c) {
+      total.stalls[c] += pc->stalls[c];
+    }
+    total.flushes += pc->flushes;
+
+    fprintf(fp, "%6d ", 4000 + 4 * i);
+    write_counters(fp, pc);
+    fprintf(fp, "  ");
+    write_source(fp, cpu, source, &line, &capacity, i);
+    fputc('\n', fp);
+  }
+  fprintf(fp, "%6s ", "total");
+  write_counters(fp, &total);
+  fprintf(fp, "\n\n");
+
+  free(line);
+  if (source) {
+    fclose(source);
+  }
+  return fflush(fp) ? -1 : 0;
+}
@@ -0,0 +1,51 @@
+#ifndef _APEX_PROFILE_H_
+#define _APEX_PROFILE_H_
+/**
+ *  profile.h
+ *  Contains the per-instruction hotspot profile
+ *
+ *  Counters are kept per code index. A bubble writeback takes is charged
+ *  to the instruction that caused it, the same way the CPI stack charges
+ *  it to a cause (see cpi.h): the instruction stalled in decode, the MUL
+ *  holding execute, the branch flushing or the HALT/ROI_END draining. At
+ *  the end of the run the input is listed with the counters of each line.
+ */
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+typedef struct APEX_Pc_Profile
+{
+    long executions;			// Retired
+    long decode_cycles;			// Held in decode, stalls included
+    long stalls[CPI_NUM_CAUSES];	// Bubble cycles charged to it, by cause
+    long flushes;			// Taken as a branch or JUMP
+} APEX_Pc_Profile;
+
+typedef struct APEX_Profile
+{
+    APEX_Pc_Profile* pcs;	// By code index
+    int size;
+    FILE* out;			// Not owned
+    const char* input;		// Listed from, unless it is an object
+} APEX_Profile;
+
+/* Counters of the instruction at pc, NULL outside the code */
+static inline APEX_Pc_Profile*
+APEX_profile_at(APEX_Profile* profile, int pc)
+{
+  unsigned index = (unsigned)(pc - 4000) / 4;
+  return pc >= 4000 && index < (unsigned)profile->size ? &profile->pcs[index] : NULL;
+}
+
+APEX_Profile*
+APEX_profile_create(APEX_CPU* cpu, FILE* out, const char* input);
+
+void
+APEX_profile_free(APEX_Profile* profile);
+
+int
+APEX_profile_write(APEX_Profile* profile, APEX_CPU* cpu);
+
+#endif
@@ -0,0 +1,216 @@
+/*
+ *  program.c
+ *  Contains loading, reference counting and shared images of programs
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "program.h"
+#include "object.h"
+#include "arena.h"
+
+/*
+ * Loads a text program or an object. Text is decoded up front, or on
+ * demand if lazy is set, objects always on demand. The caller holds the
+ * only reference.
+ */
+APEX_Program*
+APEX_program_load(const char* filename, int lazy)
+{
+  if (!filename) {
+    return NULL;
+  }
+  APEX_Program* program = APEX_calloc(1, sizeof(*program));
+  if (!program) {
+    return NULL;
+  }
+
+  APEX_Instruction* code_memory;
+  int size;
+  if (APEX_object_is_file(filename)) {
+    code_memory = create_object_code_memory(filename, &size, &program->lazy, program->owned_data);
+  } else if (lazy) {
+    code_memory = create_lazy_code_memory(filename, &size, &program->lazy);
+  } else {
+    code_memory = create_code_memory(filename, &size);
+  }
+  if (!code_memory) {
+    APEX_free(program);
+    return NULL;
+  }
+
+  if (program->lazy) {
+    program->has_roi = APEX_lazy_has_roi(program->lazy);
+  } else {
+    program->owned_code = code_memory;
+    for (int i = 0; i < size; ++i) {
+      if (strcmp(code_memory[i].opcode, "ROI_BEGIN") == 0) {
+        program->has_roi = 1;
+      }
+    }
+  }
+  program->code_memory = code_memory;
+  program->code_memory_size = size;
+  program->initial_data = program->owned_data;
+  program->refs = 1;
+  return program;
+}
+
+APEX_Program*
+APEX_program_retain(APEX_Program* program)
+{
+  __atomic_add_fetch(&program->refs, 1, __ATOMIC_RELAXED);
+  return program;
+}
+
+void
+APEX_program_release(APEX_Program* program)
+{
+  if (!program || __atomic_sub_fetch(&program->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+    return;
+  }
+  if (program->lazy) {
+    APEX_lazy_free(program->lazy);
+  }
+  APEX_free(program->owned_code);
+  if (program->image) {
+    munmap(program->image, program->image_size);
+  }
+  APEX_free(program);
+}
+
+/* Fetched beyond the last instruction, by programs that do not end in HALT */
+static const APEX_Instruction past_end = { "", -1, -1, -1 };
+
+/* Instruction at a code index, decoded first if the program is lazy */
+const APEX_Instruction*
+APEX_program_at(APEX_Program* program, int index)
+{
+  if (index < 0 || index >= program->code_memory_size) {
+    return &past_end;
+  }
+  if (program->lazy) {
+    return APEX_lazy_decode(program->lazy, index);
+  }
+  return &program->code_memory[index];
+}
+
+/*
+ * Writes the program, decoded in full, as an image for source. The image
+ * appears under its name complete or not at all. Returns 0 on success.
+ */
+int
+APEX_program_save_image(APEX_Program* program, const char* source, const char* image)
+{
+  struct stat st;
+  if (stat(source, &st)) {
+    return -1;
+  }
+  APEX_Image_Header header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  header.version = IMAGE_VERSION;
+  header.instruction_size = sizeof(APEX_Instruction);
+  header.code_memory_size = program->code_memory_size;
+  header.has_roi = program->has_roi;
+  header.source_size = st.st_size;
+  header.source_mtime = st.st_mtime;
+
+  char temp[4096];
+  snprintf(temp, sizeof(temp), "%s.%d.tmp", image, (int)getpid());
+  FILE* fp = fopen(temp, "wb");
+  if (!fp) {
+    return -1;
+  }
+  int failed = fwrite(&header, sizeof(header), 1, fp) != 1 ||
+               fwrite(program->initial_data, sizeof(int), DATA_MEMORY_SIZE, fp) != DATA_MEMORY_SIZE;
+  for (int i = 0; !failed && i < program->code_memory_size; ++i) {
+    failed = fwrite(APEX_program_at(program, i), sizeof(APEX_Instruction), 1, fp) != 1;
+  }
+  if (fclose(fp) || failed || rename(temp, image)) {
+    remove(temp);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Maps an image read-only and shared. Returns NULL if there is no image
+ * of this build for the current contents of source.
+ */
+APEX_Program*
+APEX_program_map_image(const char* source, const char* image)
+{
+  struct stat source_st;
+  struct stat st;
+  int fd = open(image, O_RDONLY);
+  if (fd < 0 || stat(source, &source_st) || fstat(fd, &st) ||
+      (size_t)st.st_size < sizeof(APEX_Image_Header)) {
+    if (fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+  void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return NULL;
+  }
+
+  const APEX_Image_Header* header = mapping;
+  size_t expected = sizeof(*header) + sizeof(int) * DATA_MEMORY_SIZE +
+                    sizeof(APEX_Instruction) * (size_t)header->code_memory_size;
+  APEX_Program* program = NULL;
+  if (memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) == 0 &&
+      header->version == IMAGE_VERSION && header->instruction_size == sizeof(APEX_Instruction) &&
+      header->code_memory_size > 0 && (size_t)st.st_size == expected &&
+      header->source_size == source_st.st_size && header->source_mtime == source_st.st_mtime) {
+    program = APEX_calloc(1, sizeof(*program));
+  }
+  if (!program) {
+    munmap(mapping, st.st_size);
+    return NULL;
+  }
+
+  program->initial_data = (const int*)(header + 1);
+  program->code_memory = (const APEX_Instruction*)(program->initial_data + DATA_MEMORY_SIZE);
+  program->code_memory_size = header->code_memory_size;
+  program->has_roi = header->has_roi;
+  program->image = mapping;
+  program->image_size = st.st_size;
+  program->refs = 1;
+  return program;
+}
+
+/*
+ * Program of source shared through the image file: mapped if the image
+ * is current, otherwise loaded, saved as the image and mapped. Falls back
+ * to a private program if the image cannot be written.
+ */
+APEX_Program*
+APEX_program_share(const char* source, const char* image, int lazy)
+{
+  APEX_Program* program = APEX_program_map_image(source, image);
+  if (program) {
+    return program;
+  }
+  program = APEX_program_load(source, lazy);
+  if (!program) {
+    return NULL;
+  }
+  if (!APEX_program_save_image(program, source, image)) {
+    APEX_Program* shared = APEX_program_map_image(source, image);
+    if (shared) {
+      APEX_program_release(program);
+      return shared;
+    }
+  }
+  fprintf(stderr, "APEX_Help : Unable to share %s through %s, using a private copy\n", source,
+          image);
+  return program;
+}
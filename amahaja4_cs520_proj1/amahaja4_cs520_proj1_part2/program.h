@@ -0,0 +1,73 @@
+#ifndef _APEX_PROGRAM_H_
+#define _APEX_PROGRAM_H_
+/**
+ *  program.h
+ *  Contains the program image shared by simulations
+ *
+ *  A program holds the decoded code memory and initial data memory of an
+ *  input. It is read-only once loaded (lazy decoding fills it in behind
+ *  APEX_program_at) and reference counted: every APEX_CPU made from it
+ *  holds a reference, the last release frees it. Clones of a cpu borrow
+ *  the reference of their original.
+ *
+ *  A fully decoded program can be saved as an image file and mapped
+ *  read-only and shared from there. Kept in shared memory (/dev/shm),
+ *  one image serves every simulator process running the same input.
+ */
+
+#include "cpu.h"
+
+#define IMAGE_MAGIC "APEXIMG"
+#define IMAGE_VERSION 1
+
+typedef struct APEX_Program
+{
+    const APEX_Instruction* code_memory;
+    int code_memory_size;
+    int has_roi;		// Some instruction is a ROI_BEGIN
+    const int* initial_data;	// DATA_MEMORY_SIZE words
+
+    int refs;
+    struct APEX_Lazy_Code* lazy;	// Decodes code_memory on demand, if set
+
+    /* Storage, exactly one of these */
+    APEX_Instruction* owned_code;	// Parsed from text
+    void* image;			// Mapped image file
+    size_t image_size;
+    int owned_data[DATA_MEMORY_SIZE];
+} APEX_Program;
+
+/* Image file layout, followed by the initial data and the code memory */
+typedef struct APEX_Image_Header
+{
+    char magic[8];
+    int version;
+    int instruction_size;	// sizeof(APEX_Instruction) of the build writing it
+    int code_memory_size;
+    int has_roi;
+    long source_size;		// Of the input it was made from
+    long source_mtime;
+} APEX_Image_Header;
+
+APEX_Program*
+APEX_program_load(const char* filename, int lazy);
+
+APEX_Program*
+APEX_program_retain(APEX_Program* program);
+
+void
+APEX_program_release(APEX_Program* program);
+
+const APEX_Instruction*
+APEX_program_at(APEX_Program* program, int index);
+
+int
+APEX_program_save_image(APEX_Program* program, const char* source, const char* image);
+
+APEX_Program*
+APEX_program_map_image(const char* source, const char* image);
+
+APEX_Program*
+APEX_program_share(const char* source, const char* image, int lazy);
+
+#endif
@@ -0,0 +1,40 @@
+/*
+ *  retire_trace.c
+ *  Contains the writer of retired instruction traces
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "retire_trace.h"
+#include "trace.h"
+#include "arena.h"
+
+/* Starts the run of input in out, which stays open */
+APEX_Retire_Trace*
+APEX_retire_trace_create(FILE* out, const char* input)
+{
+  APEX_Retire_Trace* trace = APEX_calloc(1, sizeof(*trace));
+  if (!trace) {
+    return NULL;
+  }
+  if (APEX_trace_write_header(out, RETIRE_TRACE_MAGIC, RETIRE_TRACE_VERSION, sizeof(APEX_Retired),
+                              input)) {
+    APEX_free(trace);
+    return NULL;
+  }
+  trace->out = out;
+  return trace;
+}
+
+/* Ends the run with its end record and frees trace. Returns 0 on success */
+int
+APEX_retire_trace_close(APEX_Retire_Trace* trace)
+{
+  if (!trace) {
+    return 0;
+  }
+  APEX_Retired end = { -1, -1, -1, 0, 0, 0, -1, -1, -1, 0 };
+  int failed = fwrite(&end, sizeof(end), 1, trace->out) != 1 || fflush(trace->out);
+  APEX_free(trace);
+  return failed ? -1 : 0;
+}
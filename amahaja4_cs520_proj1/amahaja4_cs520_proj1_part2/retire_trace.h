@@ -0,0 +1,64 @@
+#ifndef _APEX_RETIRE_TRACE_H_
+#define _APEX_RETIRE_TRACE_H_
+/**
+ *  retire_trace.h
+ *  Contains the binary trace of retired instructions
+ *
+ *  Every instruction writeback retires appends a 20 byte record: cycle,
+ *  pc, the registers it read and wrote, the zero flag, the data memory
+ *  word of a LOAD or STORE, whether it can redirect fetch, and the cycles
+ *  from entering execute to its result being ready. That is all it takes
+ *  to rebuild the dynamic data and control dependence graph; apex_ddg
+ *  does. Runs are framed as in trace.h, the end record has cycle -1.
+ *  Instructions executed functionally are not traced.
+ */
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+#define RETIRE_TRACE_MAGIC "APEXRET"
+#define RETIRE_TRACE_VERSION 1
+
+/* Flags of a record */
+#define RETIRE_SETS_ZERO 1
+#define RETIRE_READS_ZERO 2	// BZ and BNZ
+#define RETIRE_CONTROL 4	// BZ, BNZ and JUMP
+#define RETIRE_LOAD 8
+#define RETIRE_STORE 16
+
+typedef struct APEX_Retired
+{
+    int cycle;			// Of writeback, -1 ends the run
+    int pc;
+    int address;		// Word of a LOAD or STORE, else -1
+    unsigned char opcode;	// APEX_opcode_index
+    unsigned char flags;	// RETIRE_ flags
+    unsigned char latency;	// Cycles from execute until its result can be used
+    signed char rd;		// -1 if it writes no register
+    signed char rs1;		// -1 if it reads no register
+    signed char rs2;
+    short pad;
+} APEX_Retired;
+
+typedef struct APEX_Retire_Trace
+{
+    FILE* out;			// Not owned
+    long instructions;
+} APEX_Retire_Trace;
+
+APEX_Retire_Trace*
+APEX_retire_trace_create(FILE* out, const char* input);
+
+int
+APEX_retire_trace_close(APEX_Retire_Trace* trace);
+
+/* Appends one record, write errors show when the trace is closed */
+static inline void
+APEX_retire_trace_write(APEX_Retire_Trace* trace, const APEX_Retired* retired)
+{
+  fwrite(retired, sizeof(*retired), 1, trace->out);
+  trace->instructions++;
+}
+
+#endif
@@ -0,0 +1,481 @@
+/*
+ *  simpoint.c
+ *  Contains basic block vector profiling on the functional pass, k-means
+ *  clustering of the intervals and the weighted detailed simulation of
+ *  their representatives
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "simpoint.h"
+#include "parallel.h"
+#include "arena.h"
+
+#define KMEANS_ITERATIONS 100
+
+/* Share of the BIC range a smaller k must reach to be chosen, as in SimPoint */
+#define BIC_THRESHOLD 0.9
+
+/*
+ * Deterministic entry of the random projection matrix for a block leader
+ * and a dimension, uniform in [-1, 1].
+ */
+static double
+projection(int leader, int dimension)
+{
+  unsigned int h = (unsigned int)leader * 2654435761u ^ (unsigned int)(dimension + 1) * 40503u;
+  h ^= h >> 15;
+  h *= 2246822519u;
+  h ^= h >> 13;
+  return (double)(h & 0xffff) / 32767.5 - 1.0;
+}
+
+static int
+is_control(const char* opcode)
+{
+  return strcmp(opcode, "BZ") == 0 || strcmp(opcode, "BNZ") == 0 ||
+         strcmp(opcode, "JUMP") == 0 || strcmp(opcode, "HALT") == 0;
+}
+
+/* Closes the current interval: write it out, project it and clear the counts */
+static int
+end_interval(APEX_BBV_Profile* profile, int length)
+{
+  if (!length) {
+    return 0;
+  }
+  if (profile->num_intervals == profile->capacity) {
+    int capacity = profile->capacity ? profile->capacity * 2 : 64;
+    double* vectors = APEX_realloc(profile->vectors, sizeof(double) * BBV_DIMENSIONS * capacity);
+    if (!vectors) {
+      return -1;
+    }
+    profile->vectors = vectors;
+    profile->capacity = capacity;
+  }
+
+  double* v = &profile->vectors[profile->num_intervals * BBV_DIMENSIONS];
+  memset(v, 0, sizeof(double) * BBV_DIMENSIONS);
+  if (profile->out) {
+    fprintf(profile->out, "T");
+  }
+  for (int i = 0; i < profile->num_touched; ++i) {
+    int leader = profile->touched[i];
+    double share = (double)profile->counts[leader] / length;
+    for (int d = 0; d < BBV_DIMENSIONS; ++d) {
+      v[d] += share * projection(leader, d);
+    }
+    if (profile->out) {
+      /* SimPoint block ids start at 1 */
+      fprintf(profile->out, ":%d:%d ", leader + 1, profile->counts[leader]);
+    }
+    profile->counts[leader] = 0;
+  }
+  if (profile->out) {
+    fprintf(profile->out, "\n");
+  }
+  profile->num_touched = 0;
+  profile->num_intervals++;
+  return 0;
+}
+
+/* Functional pass hook: attribute the instruction to its basic block */
+static void
+bbv_observe(void* arg, APEX_CPU* cpu, int count)
+{
+  APEX_BBV_Profile* profile = arg;
+  int index = get_code_index(cpu->pc);
+  if (index < 0 || index >= cpu->code_memory_size) {
+    return;
+  }
+
+  if (count && count % profile->interval == 0) {
+    end_interval(profile, profile->interval);
+  }
+  if (profile->new_block) {
+    profile->leader = index;
+    profile->new_block = 0;
+  }
+  if (!profile->counts[profile->leader]++) {
+    profile->touched[profile->num_touched++] = profile->leader;
+  }
+  profile->new_block = is_control(APEX_code_at(cpu, index)->opcode);
+}
+
+static double
+distance2(const double* a, const double* b)
+{
+  double d = 0;
+  for (int i = 0; i < BBV_DIMENSIONS; ++i) {
+    d += (a[i] - b[i]) * (a[i] - b[i]);
+  }
+  return d;
+}
+
+/*
+ * k-means with k-means++ seeding from a fixed seed. Returns the sum of
+ * squared distances of the points to their centres.
+ */
+static double
+kmeans(const double* points, int n, int k, double* centres, int* assignment)
+{
+  unsigned int seed = 12345;
+  double* nearest = APEX_malloc(sizeof(double) * n);
+  int* members = APEX_malloc(sizeof(int) * k);
+  if (!nearest || !members) {
+    APEX_free(nearest);
+    APEX_free(members);
+    return -1;
+  }
+
+  seed = seed * 1103515245u + 12345u;
+  memcpy(centres, &points[(seed >> 16) % n * BBV_DIMENSIONS], sizeof(double) * BBV_DIMENSIONS);
+  for (int i = 0; i < n; ++i) {
+    nearest[i] = distance2(&points[i * BBV_DIMENSIONS], centres);
+  }
+  for (int c = 1; c < k; ++c) {
+    double total = 0;
+    for (int i = 0; i < n; ++i) {
+      total += nearest[i];
+    }
+    seed = seed * 1103515245u + 12345u;
+    double target = total * ((seed >> 16) & 0x7fff) / 32768.0;
+    int pick = n - 1;
+    for (int i = 0; i < n; ++i) {
+      target -= nearest[i];
+      if (target < 0) {
+        pick = i;
+        break;
+      }
+    }
+    memcpy(&centres[c * BBV_DIMENSIONS], &points[pick * BBV_DIMENSIONS],
+           sizeof(double) * BBV_DIMENSIONS);
+    for (int i = 0; i < n; ++i) {
+      double d = distance2(&points[i * BBV_DIMENSIONS], &centres[c * BBV_DIMENSIONS]);
+      if (d < nearest[i]) {
+        nearest[i] = d;
+      }
+    }
+  }
+
+  double sse = 0;
+  for (int iteration = 0; iteration < KMEANS_ITERATIONS; ++iteration) {
+    int changed = 0;
+    sse = 0;
+    for (int i = 0; i < n; ++i) {
+      int best = 0;
+      double best_d = DBL_MAX;
+      for (int c = 0; c < k; ++c) {
+        double d = distance2(&points[i * BBV_DIMENSIONS], &centres[c * BBV_DIMENSIONS]);
+        if (d < best_d) {
+          best_d = d;
+          best = c;
+        }
+      }
+      if (iteration == 0 || assignment[i] != best) {
+        changed = 1;
+      }
+      assignment[i] = best;
+      sse += best_d;
+    }
+    if (!changed) {
+      break;
+    }
+
+    memset(centres, 0, sizeof(double) * BBV_DIMENSIONS * k);
+    memset(members, 0, sizeof(int) * k);
+    for (int i = 0; i < n; ++i) {
+      members[assignment[i]]++;
+      for (int d = 0; d < BBV_DIMENSIONS; ++d) {
+        centres[assignment[i] * BBV_DIMENSIONS + d] += points[i * BBV_DIMENSIONS + d];
+      }
+    }
+    for (int c = 0; c < k; ++c) {
+      for (int d = 0; d < BBV_DIMENSIONS && members[c]; ++d) {
+        centres[c * BBV_DIMENSIONS + d] /= members[c];
+      }
+    }
+  }
+
+  APEX_free(nearest);
+  APEX_free(members);
+  return sse;
+}
+
+/*
+ * Bayesian information criterion of a clustering under identical spherical
+ * Gaussians (Pelleg and Moore), as used by SimPoint to pick k.
+ */
+static double
+bic(int n, int k, const int* assignment, double sse)
+{
+  if (n <= k) {
+    return -DBL_MAX;
+  }
+  double variance = sse / (n - k);
+  if (variance < 1e-12) {
+    variance = 1e-12;
+  }
+
+  int* sizes = APEX_calloc(k, sizeof(int));
+  if (!sizes) {
+    return -DBL_MAX;
+  }
+  for (int i = 0; i < n; ++i) {
+    sizes[assignment[i]]++;
+  }
+
+  double likelihood = 0;
+  for (int c = 0; c < k; ++c) {
+    double rc = sizes[c];
+    if (rc == 0) {
+      continue;
+    }
+    likelihood += rc * log(rc) - rc * log(n) - rc / 2 * log(2 * M_PI) -
+                  rc * BBV_DIMENSIONS / 2 * log(variance) - (rc - k) / 2;
+  }
+  APEX_free(sizes);
+
+  double parameters = (k - 1) + BBV_DIMENSIONS * k + 1;
+  return likelihood - parameters / 2 * log(n);
+}
+
+/*
+ * Clusters the intervals of the profile for every k up to max_k and keeps
+ * the smallest k that scores within BIC_THRESHOLD of the best one. Weights
+ * are shares of instructions, lengths gives the instructions per interval.
+ */
+int
+APEX_bbv_cluster(APEX_BBV_Profile* profile, const int* lengths, int max_k,
+                 APEX_Clustering* result)
+{
+  int n = profile->num_intervals;
+  if (max_k > n) {
+    max_k = n;
+  }
+  if (max_k < 1) {
+    return -1;
+  }
+
+  double* scores = APEX_malloc(sizeof(double) * (max_k + 1));
+  int* assignments = APEX_malloc(sizeof(int) * n * (max_k + 1));
+  double* centres = APEX_malloc(sizeof(double) * BBV_DIMENSIONS * (max_k + 1) * (max_k + 1));
+  if (!scores || !assignments || !centres) {
+    APEX_free(scores);
+    APEX_free(assignments);
+    APEX_free(centres);
+    return -1;
+  }
+
+  double best = -DBL_MAX;
+  double worst = DBL_MAX;
+  for (int k = 1; k <= max_k; ++k) {
+    double sse = kmeans(profile->vectors, n, k, &centres[k * (max_k + 1) * BBV_DIMENSIONS],
+                        &assignments[k * n]);
+    scores[k] = sse < 0 ? -DBL_MAX : bic(n, k, &assignments[k * n], sse);
+    if (scores[k] == -DBL_MAX) {
+      continue;
+    }
+    if (scores[k] > best) {
+      best = scores[k];
+    }
+    if (scores[k] < worst) {
+      worst = scores[k];
+    }
+  }
+
+  int k = 1;
+  if (best != -DBL_MAX) {
+    for (k = 1; k <= max_k; ++k) {
+      if (scores[k] != -DBL_MAX && scores[k] >= worst + BIC_THRESHOLD * (best - worst)) {
+        break;
+      }
+    }
+    if (k > max_k) {
+      k = max_k;
+    }
+  }
+
+  result->k = k;
+  result->assignment = APEX_malloc(sizeof(int) * n);
+  result->representative = APEX_malloc(sizeof(int) * k);
+  result->weight = APEX_calloc(k, sizeof(double));
+  if (!result->assignment || !result->representative || !result->weight) {
+    APEX_clustering_free(result);
+    APEX_free(scores);
+    APEX_free(assignments);
+    APEX_free(centres);
+    return -1;
+  }
+  memcpy(result->assignment, &assignments[k * n], sizeof(int) * n);
+
+  const double* chosen = &centres[k * (max_k + 1) * BBV_DIMENSIONS];
+  long total = 0;
+  for (int i = 0; i < n; ++i) {
+    total += lengths[i];
+  }
+  for (int c = 0; c < k; ++c) {
+    result->representative[c] = -1;
+    double best_d = DBL_MAX;
+    for (int i = 0; i < n; ++i) {
+      if (result->assignment[i] != c) {
+        continue;
+      }
+      result->weight[c] += total ? (double)lengths[i] / total : 0;
+      double d = distance2(&profile->vectors[i * BBV_DIMENSIONS], &chosen[c * BBV_DIMENSIONS]);
+      if (d < best_d) {
+        best_d = d;
+        result->representative[c] = i;
+      }
+    }
+  }
+
+  APEX_free(scores);
+  APEX_free(assignments);
+  APEX_free(centres);
+  return 0;
+}
+
+void
+APEX_clustering_free(APEX_Clustering* clustering)
+{
+  APEX_free(clustering->assignment);
+  APEX_free(clustering->representative);
+  APEX_free(clustering->weight);
+  memset(clustering, 0, sizeof(*clustering));
+}
+
+/*
+ * Profiles the program functionally, picks representative intervals and
+ * simulates only those in detail. Prints the weighted CPI. The cycle limit
+ * bounds the instructions profiled; a final interval it cuts short is
+ * simulated to its end like the others and weighs by the instructions it
+ * holds.
+ */
+int
+APEX_simpoint_run(APEX_CPU* cpu, int interval, int max_k, int warmup, int threads,
+                  const char* bbv_file)
+{
+  APEX_BBV_Profile profile;
+  memset(&profile, 0, sizeof(profile));
+  profile.interval = interval;
+  profile.new_block = 1;
+  profile.counts = APEX_calloc(cpu->code_memory_size, sizeof(int));
+  profile.touched = APEX_malloc(sizeof(int) * cpu->code_memory_size);
+
+  APEX_Checkpoint_Series* checkpoints =
+      APEX_checkpoint_series_create(NULL, cpu->code_memory_size);
+  if (bbv_file) {
+    profile.out = fopen(bbv_file, "w");
+  }
+  if (!profile.counts || !profile.touched || !checkpoints || (bbv_file && !profile.out)) {
+    fprintf(stderr, "APEX_Error : Unable to set up basic block vector profiling\n");
+    APEX_free(profile.counts);
+    APEX_free(profile.touched);
+    APEX_checkpoint_series_free(checkpoints);
+    if (profile.out) {
+      fclose(profile.out);
+    }
+    return -1;
+  }
+
+  int num_segments = 0;
+  APEX_CPU* final = NULL;
+  APEX_Segment* segments = APEX_functional_segments(cpu, checkpoints, interval, warmup,
+                                                    &num_segments, &final, bbv_observe, &profile);
+  int ret = -1;
+  int* lengths = NULL;
+  APEX_Clustering clustering;
+  memset(&clustering, 0, sizeof(clustering));
+  APEX_Segment* chosen = NULL;
+
+  if (!segments) {
+    goto out;
+  }
+  end_interval(&profile, segments[num_segments - 1].length);
+  if (profile.num_intervals != num_segments) {
+    /* Program ended exactly on an interval boundary, or produced nothing */
+    num_segments = profile.num_intervals;
+  }
+  if (!num_segments) {
+    fprintf(stderr, "APEX_Error : Program executed no instructions\n");
+    goto out;
+  }
+
+  lengths = APEX_malloc(sizeof(int) * num_segments);
+  if (!lengths) {
+    goto out;
+  }
+  for (int i = 0; i < num_segments; ++i) {
+    lengths[i] = segments[i].length;
+  }
+  if (APEX_bbv_cluster(&profile, lengths, max_k, &clustering)) {
+    goto out;
+  }
+
+  chosen = APEX_calloc(clustering.k, sizeof(*chosen));
+  if (!chosen) {
+    goto out;
+  }
+  for (int c = 0; c < clustering.k; ++c) {
+    chosen[c] = segments[clustering.representative[c]];
+  }
+
+  APEX_Parallel_Run run;
+  memset(&run, 0, sizeof(run));
+  run.cpu = cpu;
+  run.checkpoints = checkpoints;
+  run.segments = chosen;
+  run.num_segments = clustering.k;
+  run.overlap = 0;
+  if (APEX_simulate_segments(&run, threads)) {
+    fprintf(stderr, "APEX_Error : Detailed simulation of a representative failed\n");
+    goto out;
+  }
+
+  printf("(apex) >> SimPoint: %d intervals of %d instructions, %d clusters\n",
+         num_segments, interval, clustering.k);
+  if (!segments[num_segments - 1].last) {
+    printf("(apex) >> Stopped by the cycle limit, applied as a limit of %d instructions\n",
+           cpu->function_cycles);
+  }
+  printf("%-9s %-10s %-9s %-10s %-10s %s\n", "cluster", "interval", "weight", "start",
+         "cycles", "CPI");
+  long total_instructions = 0;
+  for (int i = 0; i < num_segments; ++i) {
+    total_instructions += lengths[i];
+  }
+  double weighted_cpi = 0;
+  for (int c = 0; c < clustering.k; ++c) {
+    double cpi = chosen[c].length ? (double)chosen[c].cycles / chosen[c].length : 0;
+    weighted_cpi += clustering.weight[c] * cpi;
+    printf("%-9d %-10d %-9.3f %-10d %-10d %.3f\n", c, clustering.representative[c],
+           clustering.weight[c], chosen[c].start, chosen[c].cycles, cpi);
+  }
+
+  printf("(apex) >> Simulation Complete \n");
+  printf("Total Instructions Present: %d, Total instructions processed: %ld \n",
+         cpu->code_memory_size, total_instructions);
+  printf("Weighted CPI: %.3f, estimated clock cycles: %.0f \n", weighted_cpi,
+         weighted_cpi * total_instructions);
+  Print_regs_content(final);
+  ret = 0;
+
+out:
+  APEX_free(chosen);
+  APEX_free(lengths);
+  APEX_clustering_free(&clustering);
+  APEX_free(final);
+  APEX_free(segments);
+  APEX_free(profile.counts);
+  APEX_free(profile.touched);
+  APEX_free(profile.vectors);
+  if (profile.out) {
+    fclose(profile.out);
+  }
+  APEX_checkpoint_series_free(checkpoints);
+  return ret;
+}
@@ -0,0 +1,58 @@
+#ifndef _APEX_SIMPOINT_H_
+#define _APEX_SIMPOINT_H_
+/**
+ *  simpoint.h
+ *  Contains data structures for basic block vector profiling and
+ *  SimPoint-style selection of representative intervals
+ *
+ *  The functional pass counts, per fixed-size interval, the instructions
+ *  executed in every basic block. The vectors are randomly projected to a
+ *  few dimensions and clustered with k-means. One interval per cluster is
+ *  simulated in detail from its checkpoint and weighted by cluster size.
+ */
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+/* Dimensions of the random projection of basic block vectors */
+#define BBV_DIMENSIONS 15
+
+/* Collected by the functional pass */
+typedef struct APEX_BBV_Profile
+{
+    int interval;		// Instructions per interval
+    int* counts;		// Instructions per block leader in the current interval
+    int* touched;		// Leaders with a non-zero count in the current interval
+    int num_touched;
+    int leader;		    // Code index of the leader of the current block
+    int new_block;		// Next instruction starts a basic block
+
+    double* vectors;	// BBV_DIMENSIONS projected values per interval
+    int num_intervals;
+    int capacity;
+
+    FILE* out;		    // Raw vectors in SimPoint .bb format, if set
+} APEX_BBV_Profile;
+
+/* Result of clustering the projected vectors */
+typedef struct APEX_Clustering
+{
+    int k;
+    int* assignment;	// Cluster of every interval
+    int* representative;	// Interval closest to each cluster centre
+    double* weight;		// Share of instructions of each cluster
+} APEX_Clustering;
+
+int
+APEX_bbv_cluster(APEX_BBV_Profile* profile, const int* lengths, int max_k,
+                 APEX_Clustering* result);
+
+void
+APEX_clustering_free(APEX_Clustering* clustering);
+
+int
+APEX_simpoint_run(APEX_CPU* cpu, int interval, int max_k, int warmup, int threads,
+                  const char* bbv_file);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+ *  stall_log.c
+ *  Contains the writer of stall event logs
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stall_log.h"
+#include "trace.h"
+#include "arena.h"
+
+/* Starts the run of input in out, which stays open */
+APEX_Stall_Log*
+APEX_stall_log_create(FILE* out, const char* input)
+{
+  APEX_Stall_Log* log = APEX_calloc(1, sizeof(*log));
+  if (!log) {
+    return NULL;
+  }
+  if (APEX_trace_write_header(out, STALL_LOG_MAGIC, STALL_LOG_VERSION, sizeof(APEX_Stall_Event),
+                              input)) {
+    APEX_free(log);
+    return NULL;
+  }
+  log->out = out;
+  return log;
+}
+
+/* Ends the run with its end record and frees log. Returns 0 on success */
+int
+APEX_stall_log_close(APEX_Stall_Log* log)
+{
+  if (!log) {
+    return 0;
+  }
+  APEX_Stall_Event end = { -1, -1, -1, 0, STALL_REG_NONE, 0 };
+  int failed = fwrite(&end, sizeof(end), 1, log->out) != 1 || fflush(log->out);
+  APEX_free(log);
+  return failed ? -1 : 0;
+}
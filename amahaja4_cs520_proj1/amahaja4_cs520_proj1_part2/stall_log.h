@@ -0,0 +1,57 @@
+#ifndef _APEX_STALL_LOG_H_
+#define _APEX_STALL_LOG_H_
+/**
+ *  stall_log.h
+ *  Contains the binary log of stall events
+ *
+ *  Every cycle decode holds an instruction back, one record names the
+ *  stalled instruction, the CPI_ cause, the register it waits for and the
+ *  in-flight instruction producing it: the LOAD behind a load-use stall,
+ *  the ALU operation setting the zero flag for a BZ, the MUL occupying
+ *  execute. Runs are framed as in trace.h, the end record has cycle -1.
+ *  apex_stalls summarizes a log.
+ */
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+#define STALL_LOG_MAGIC "APEXSTL"
+#define STALL_LOG_VERSION 1
+
+/* Register of a record waiting for the zero flag, or for no register */
+#define STALL_REG_ZERO 16
+#define STALL_REG_NONE -1
+
+typedef struct APEX_Stall_Event
+{
+    int cycle;			// -1 ends the run
+    int pc;			// Stalled instruction
+    int producer_pc;		// -1 if nothing in flight is responsible
+    unsigned char cause;	// CPI_ cause of the bubble
+    signed char reg;		// Register waited for, STALL_REG_ZERO or STALL_REG_NONE
+    short pad;
+} APEX_Stall_Event;
+
+typedef struct APEX_Stall_Log
+{
+    FILE* out;			// Not owned
+    long events;
+} APEX_Stall_Log;
+
+APEX_Stall_Log*
+APEX_stall_log_create(FILE* out, const char* input);
+
+int
+APEX_stall_log_close(APEX_Stall_Log* log);
+
+/* Appends one event, write errors show when the log is closed */
+static inline void
+APEX_stall_log_event(APEX_Stall_Log* log, int cycle, int pc, int cause, int reg, int producer_pc)
+{
+  APEX_Stall_Event event = { cycle, pc, producer_pc, (unsigned char)cause, (signed char)reg, 0 };
+  fwrite(&event, sizeof(event), 1, log->out);
+  log->events++;
+}
+
+#endif
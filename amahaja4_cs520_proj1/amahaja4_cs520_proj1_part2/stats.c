@@ -0,0 +1,308 @@
+/*
+ *  stats.c
+ *  Contains the statistics registry and its JSON and CSV dumps
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "arena.h"
+
+#define STATS_MAX_DEPTH 8
+
+/*
+ * Creates an empty registry dumping to out, which stays open. A CSV
+ * header is written if out is still empty.
+ */
+APEX_Stats*
+APEX_stats_create(FILE* out, int format, const char* input, int interval)
+{
+  APEX_Stats* stats = APEX_calloc(1, sizeof(*stats));
+  if (!stats) {
+    return NULL;
+  }
+  stats->out = out;
+  stats->format = format;
+  stats->input = input;
+  stats->interval = interval;
+  stats->next_dump = interval;
+  if (format == STATS_CSV && ftell(out) == 0) {
+    fprintf(out, "input,clock,stat,value\n");
+  }
+  return stats;
+}
+
+void
+APEX_stats_free(APEX_Stats* stats)
+{
+  if (!stats) {
+    return;
+  }
+  for (int i = 0; i < stats->count; ++i) {
+    APEX_free(stats->stats[i]->buckets);
+    APEX_free(stats->stats[i]);
+  }
+  APEX_free(stats->stats);
+  APEX_free(stats);
+}
+
+static APEX_Stat*
+add_stat(APEX_Stats* stats, const char* name, int kind)
+{
+  if (strlen(name) >= STATS_MAX_NAME || APEX_stats_find(stats, name)) {
+    fprintf(stderr, "APEX_Error : Invalid or duplicate statistic %s\n", name);
+    return NULL;
+  }
+  if (stats->count == stats->capacity) {
+    int capacity = stats->capacity ? stats->capacity * 2 : 64;
+    APEX_Stat** grown = APEX_realloc(stats->stats, sizeof(*grown) * capacity);
+    if (!grown) {
+      return NULL;
+    }
+    stats->stats = grown;
+    stats->capacity = capacity;
+  }
+  APEX_Stat* stat = APEX_calloc(1, sizeof(*stat));
+  if (!stat) {
+    return NULL;
+  }
+  strcpy(stat->name, name);
+  stat->kind = kind;
+  stats->stats[stats->count++] = stat;
+  return stat;
+}
+
+APEX_Stat*
+APEX_stats_counter(APEX_Stats* stats, const char* name)
+{
+  return add_stat(stats, name, STAT_COUNTER);
+}
+
+APEX_Stat*
+APEX_stats_average(APEX_Stats* stats, const char* name)
+{
+  return add_stat(stats, name, STAT_AVERAGE);
+}
+
+/* Buckets of bucket_width values from 0, the last also counts the rest */
+APEX_Stat*
+APEX_stats_histogram(APEX_Stats* stats, const char* name, int bucket_width, int num_buckets)
+{
+  if (bucket_width <= 0 || num_buckets <= 0) {
+    return NULL;
+  }
+  APEX_Stat* stat = add_stat(stats, name, STAT_HISTOGRAM);
+  if (stat) {
+    stat->buckets = APEX_calloc(num_buckets, sizeof(*stat->buckets));
+    if (!stat->buckets) {
+      return NULL;
+    }
+    stat->bucket_width = bucket_width;
+    stat->num_buckets = num_buckets;
+  }
+  return stat;
+}
+
+/* Registers a counter the caller keeps up to date itself */
+APEX_Stat*
+APEX_stats_bind(APEX_Stats* stats, const char* name, const long* counter)
+{
+  APEX_Stat* stat = add_stat(stats, name, STAT_COUNTER);
+  if (stat) {
+    stat->bound_long = counter;
+  }
+  return stat;
+}
+
+APEX_Stat*
+APEX_stats_bind_int(APEX_Stats* stats, const char* name, const int* counter)
+{
+  APEX_Stat* stat = add_stat(stats, name, STAT_COUNTER);
+  if (stat) {
+    stat->bound_int = counter;
+  }
+  return stat;
+}
+
+APEX_Stat*
+APEX_stats_find(APEX_Stats* stats, const char* name)
+{
+  for (int i = 0; i < stats->count; ++i) {
+    if (strcmp(stats->stats[i]->name, name) == 0) {
+      return stats->stats[i];
+    }
+  }
+  return NULL;
+}
+
+static long
+stat_value(const APEX_Stat* stat)
+{
+  if (stat->bound_long) {
+    return *stat->bound_long;
+  }
+  if (stat->bound_int) {
+    return *stat->bound_int;
+  }
+  return stat->count;
+}
+
+static double
+stat_mean(const APEX_Stat* stat)
+{
+  return stat->count ? (double)stat->sum / stat->count : 0;
+}
+
+/* Orders names component by component, so that groups are contiguous */
+static int
+compare_names(const void* a, const void* b)
+{
+  const unsigned char* x = (const unsigned char*)(*(APEX_Stat* const*)a)->name;
+  const unsigned char* y = (const unsigned char*)(*(APEX_Stat* const*)b)->name;
+  while (*x && *x == *y) {
+    x++;
+    y++;
+  }
+  int cx = *x == '.' ? 1 : *x;
+  int cy = *y == '.' ? 1 : *y;
+  return cx - cy;
+}
+
+/* Splits a dotted name into at most STATS_MAX_DEPTH components */
+static int
+split_name(const char* name, const char** start, int* length)
+{
+  int n = 0;
+  while (n < STATS_MAX_DEPTH) {
+    const char* dot = strchr(name, '.');
+    start[n] = name;
+    length[n] = dot && n < STATS_MAX_DEPTH - 1 ? (int)(dot - name) : (int)strlen(name);
+    n++;
+    if (!dot || n == STATS_MAX_DEPTH) {
+      break;
+    }
+    name = dot + 1;
+  }
+  return n;
+}
+
+static void
+write_json_string(FILE* fp, const char* s, int length)
+{
+  fputc('"', fp);
+  for (int i = 0; i < length && s[i]; ++i) {
+    if (s[i] == '"' || s[i] == '\\') {
+      fputc('\\', fp);
+    }
+    fputc(s[i], fp);
+  }
+  fputc('"', fp);
+}
+
+static void
+write_json_value(FILE* fp, const APEX_Stat* stat)
+{
+  if (stat->kind == STAT_COUNTER) {
+    fprintf(fp, "%ld", stat_value(stat));
+    return;
+  }
+  fprintf(fp, "{\"count\": %ld, \"mean\": %.6g", stat->count, stat_mean(stat));
+  if (stat->kind == STAT_HISTOGRAM) {
+    fprintf(fp, ", \"bucket_width\": %d, \"buckets\": [", stat->bucket_width);
+    for (int i = 0; i < stat->num_buckets; ++i) {
+      fprintf(fp, "%s%ld", i ? ", " : "", stat->buckets[i]);
+    }
+    fprintf(fp, "]");
+  }
+  fprintf(fp, "}");
+}
+
+static void
+write_json(APEX_Stats* stats, APEX_Stat** sorted, long clock)
+{
+  FILE* fp = stats->out;
+  fprintf(fp, "{\"input\": ");
+  write_json_string(fp, stats->input, strlen(stats->input));
+  fprintf(fp, ", \"clock\": %ld, \"stats\": {", clock);
+
+  const char* prev_start[STATS_MAX_DEPTH];
+  int prev_length[STATS_MAX_DEPTH];
+  int open = 0;			// Groups open
+  int need_comma[STATS_MAX_DEPTH + 1] = { 0 };
+  for (int i = 0; i < stats->count; ++i) {
+    const char* start[STATS_MAX_DEPTH];
+    int length[STATS_MAX_DEPTH];
+    int n = split_name(sorted[i]->name, start, length);
+
+    /* Groups shared with the previous name stay open */
+    int common = 0;
+    while (common < open && common < n - 1 && length[common] == prev_length[common] &&
+           memcmp(start[common], prev_start[common], length[common]) == 0) {
+      common++;
+    }
+    for (; open > common; --open) {
+      fputc('}', fp);
+    }
+    for (; open < n - 1; ++open) {
+      fprintf(fp, "%s", need_comma[open] ? ", " : "");
+      need_comma[open] = 1;
+      write_json_string(fp, start[open], length[open]);
+      fprintf(fp, ": {");
+      need_comma[open + 1] = 0;
+    }
+    fprintf(fp, "%s", need_comma[open] ? ", " : "");
+    need_comma[open] = 1;
+    write_json_string(fp, start[n - 1], length[n - 1]);
+    fprintf(fp, ": ");
+    write_json_value(fp, sorted[i]);
+
+    memcpy(prev_start, start, sizeof(start));
+    memcpy(prev_length, length, sizeof(length));
+  }
+  for (; open > 0; --open) {
+    fputc('}', fp);
+  }
+  fprintf(fp, "}}\n");
+}
+
+static void
+write_csv(APEX_Stats* stats, APEX_Stat** sorted, long clock)
+{
+  FILE* fp = stats->out;
+  for (int i = 0; i < stats->count; ++i) {
+    const APEX_Stat* stat = sorted[i];
+    if (stat->kind == STAT_COUNTER) {
+      fprintf(fp, "%s,%ld,%s,%ld\n", stats->input, clock, stat->name, stat_value(stat));
+      continue;
+    }
+    fprintf(fp, "%s,%ld,%s.count,%ld\n", stats->input, clock, stat->name, stat->count);
+    fprintf(fp, "%s,%ld,%s.mean,%.6g\n", stats->input, clock, stat->name, stat_mean(stat));
+    for (int b = 0; b < stat->num_buckets; ++b) {
+      fprintf(fp, "%s,%ld,%s.bucket.%ld,%ld\n", stats->input, clock, stat->name,
+              (long)b * stat->bucket_width, stat->buckets[b]);
+    }
+  }
+}
+
+/*
+ * Writes every statistic as of clock and flushes, so that a dump can be
+ * read while the run goes on. Returns 0 on success.
+ */
+int
+APEX_stats_dump(APEX_Stats* stats, long clock)
+{
+  APEX_Stat** sorted = APEX_malloc(sizeof(*sorted) * (stats->count + 1));
+  if (!sorted) {
+    return -1;
+  }
+  memcpy(sorted, stats->stats, sizeof(*sorted) * stats->count);
+  qsort(sorted, stats->count, sizeof(*sorted), compare_names);
+  if (stats->format == STATS_CSV) {
+    write_csv(stats, sorted, clock);
+  } else {
+    write_json(stats, sorted, clock);
+  }
+  APEX_free(sorted);
+  return fflush(stats->out) ? -1 : 0;
+}
@@ -0,0 +1,144 @@
+#ifndef _APEX_STATS_H_
+#define _APEX_STATS_H_
+/**
+ *  stats.h
+ *  Contains the statistics registry
+ *
+ *  Every stage and unit registers its statistics by a dotted name, e.g.
+ *  "pipeline.decode.stalled", and keeps the returned APEX_Stat to update
+ *  it through the inline functions below. Counters a unit already keeps
+ *  can be bound instead and are read when dumped. A dump writes every
+ *  statistic, nested by name, as one JSON object per line or as CSV rows,
+ *  at the end of the run and optionally every interval cycles.
+ */
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+#define STATS_MAX_NAME 64
+
+enum
+{
+    STAT_COUNTER,
+    STAT_AVERAGE,	// Count and mean of the samples
+    STAT_HISTOGRAM	// As an average, also counting samples per bucket
+};
+
+enum
+{
+    STATS_JSON,
+    STATS_CSV
+};
+
+typedef struct APEX_Stat
+{
+    char name[STATS_MAX_NAME];
+    int kind;
+    long count;			// Counter value, or number of samples
+    long sum;			// Of the samples
+    const long* bound_long;	// Counter kept by its unit, if set
+    const int* bound_int;
+    int bucket_width;
+    int num_buckets;		// The last one also counts everything above
+    long* buckets;
+} APEX_Stat;
+
+typedef struct APEX_Stats
+{
+    APEX_Stat** stats;
+    int count;
+    int capacity;
+    FILE* out;			// Not owned
+    int format;
+    const char* input;		// Names the run in every dump
+    int interval;		// Cycles between dumps, 0 dumps at the end only
+    long next_dump;
+} APEX_Stats;
+
+/* Statistics of the pipeline, see APEX_cpu_enable_stats */
+#define STATS_NUM_OPCODES 16
+
+/* Index of an opcode in the instruction mix, and its name */
+int
+APEX_opcode_index(const char* opcode);
+
+const char*
+APEX_opcode_name(int index);
+
+typedef struct APEX_Pipeline_Stats
+{
+    APEX_Stats* registry;
+    APEX_Stat* busy[NUM_STAGES];
+    APEX_Stat* stalled[NUM_STAGES];
+    APEX_Stat* bubble[NUM_STAGES];
+    APEX_Stat* retired[STATS_NUM_OPCODES];	// Instruction mix, last is other opcodes
+    APEX_Stat* forwarded;			// Operands read from a forwarding path
+    APEX_Stat* drains;				// HALT and ROI_END emptying the pipeline
+    APEX_Stat* decode_stall_length;		// Cycles per decode stall
+    int decode_stall_run;
+} APEX_Pipeline_Stats;
+
+static inline void
+APEX_stat_inc(APEX_Stat* stat)
+{
+  stat->count++;
+}
+
+static inline void
+APEX_stat_add(APEX_Stat* stat, long n)
+{
+  stat->count += n;
+}
+
+static inline void
+APEX_stat_sample(APEX_Stat* stat, long value)
+{
+  stat->count++;
+  stat->sum += value;
+  if (stat->buckets) {
+    long bucket = value < 0 ? 0 : value / stat->bucket_width;
+    stat->buckets[bucket < stat->num_buckets ? bucket : stat->num_buckets - 1]++;
+  }
+}
+
+APEX_Stats*
+APEX_stats_create(FILE* out, int format, const char* input, int interval);
+
+void
+APEX_stats_free(APEX_Stats* stats);
+
+APEX_Stat*
+APEX_stats_counter(APEX_Stats* stats, const char* name);
+
+APEX_Stat*
+APEX_stats_average(APEX_Stats* stats, const char* name);
+
+APEX_Stat*
+APEX_stats_histogram(APEX_Stats* stats, const char* name, int bucket_width, int num_buckets);
+
+APEX_Stat*
+APEX_stats_bind(APEX_Stats* stats, const char* name, const long* counter);
+
+APEX_Stat*
+APEX_stats_bind_int(APEX_Stats* stats, const char* name, const int* counter);
+
+APEX_Stat*
+APEX_stats_find(APEX_Stats* stats, const char* name);
+
+int
+APEX_stats_dump(APEX_Stats* stats, long clock);
+
+/* Dumps if the interval has elapsed at clock */
+static inline void
+APEX_stats_tick(APEX_Stats* stats, long clock)
+{
+  if (stats->interval && clock >= stats->next_dump) {
+    APEX_stats_dump(stats, clock);
+    while (stats->next_dump <= clock) {
+      stats->next_dump += stats->interval;
+    }
+  }
+}
+
+#endif
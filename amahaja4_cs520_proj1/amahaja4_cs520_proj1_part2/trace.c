@@ -0,0 +1,53 @@
+/*
+ *  trace.c
+ *  Contains the run headers of binary traces
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+/* Starts a run of input in out. Returns 0 on success */
+int
+APEX_trace_write_header(FILE* out, const char* magic, int version, int record_size,
+                        const char* input)
+{
+  APEX_Trace_Header header;
+  memset(&header, 0, sizeof(header));
+  strncpy(header.magic, magic, sizeof(header.magic));
+  header.version = version;
+  header.record_size = record_size;
+  header.name_length = strlen(input);
+  if (fwrite(&header, sizeof(header), 1, out) != 1 ||
+      fwrite(input, 1, header.name_length, out) != (size_t)header.name_length) {
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Reads the header of the next run in fp and its input name, which the
+ * caller frees. Returns 1 if there is one, 0 at the end of the file and
+ * -1 if fp is not a trace of this kind written by this build.
+ */
+int
+APEX_trace_read_header(FILE* fp, const char* magic, int version, int record_size, char** input)
+{
+  APEX_Trace_Header header;
+  size_t got = fread(&header, 1, sizeof(header), fp);
+  if (got == 0) {
+    return 0;
+  }
+  if (got != sizeof(header) || strncmp(header.magic, magic, sizeof(header.magic)) ||
+      header.version != version || header.record_size != record_size || header.name_length < 0) {
+    return -1;
+  }
+  *input = malloc(header.name_length + 1);
+  if (!*input || fread(*input, 1, header.name_length, fp) != (size_t)header.name_length) {
+    free(*input);
+    return -1;
+  }
+  (*input)[header.name_length] = '\0';
+  return 1;
+}
@@ -0,0 +1,32 @@
+#ifndef _APEX_TRACE_H_
+#define _APEX_TRACE_H_
+/**
+ *  trace.h
+ *  Contains the framing shared by the binary traces of a run
+ *
+ *  A trace file is a sequence of runs, so a batch writes all its jobs to
+ *  one file. Each run is a header, the name of its input and fixed-size
+ *  records, the last of which the trace marks as ending the run. A run
+ *  cut short has no end record, its records still count. Fields are in
+ *  host byte order, like checkpoints.
+ */
+
+#include <stdio.h>
+
+typedef struct APEX_Trace_Header
+{
+    char magic[8];
+    int version;
+    int record_size;		// Of the build writing it
+    int name_length;		// Bytes of input name following the header
+    int pad;
+} APEX_Trace_Header;
+
+int
+APEX_trace_write_header(FILE* out, const char* magic, int version, int record_size,
+                        const char* input);
+
+int
+APEX_trace_read_header(FILE* fp, const char* magic, int version, int record_size, char** input);
+
+#endif
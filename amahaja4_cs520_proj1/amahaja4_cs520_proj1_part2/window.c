@@ -0,0 +1,81 @@
+/*
+ *  window.c
+ *  Contains the windowed time series of a run and its CSV rows
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "window.h"
+#include "cpi.h"
+#include "arena.h"
+
+static void
+start_window(APEX_Window* window, APEX_CPU* cpu)
+{
+  window->start_clock = cpu->clock;
+  window->start_instructions = cpu->ins_completed;
+  memcpy(window->start_cpi, cpu->cpi_cycles, sizeof(window->start_cpi));
+  window->start_redirects = cpu->redirects;
+  window->start_loads = window->loads;
+  window->start_stores = window->stores;
+  while (window->next <= cpu->clock) {
+    window->next += window->interval;
+  }
+}
+
+/*
+ * Starts the series of cpu from its current clock. A CSV header is
+ * written if out is still empty, it stays open.
+ */
+APEX_Window*
+APEX_window_create(APEX_CPU* cpu, FILE* out, const char* input, int interval)
+{
+  APEX_Window* window = APEX_calloc(1, sizeof(*window));
+  if (!window) {
+    return NULL;
+  }
+  window->out = out;
+  window->input = input;
+  window->interval = interval;
+  window->next = cpu->clock;
+  start_window(window, cpu);
+  if (ftell(out) == 0) {
+    fprintf(out, "input,start,end,instructions,ipc");
+    for (int i = 0; i < CPI_NUM_CAUSES; ++i) {
+      fprintf(out, ",%s", APEX_cpi_cause_name(i));
+    }
+    fprintf(out, ",flushes,loads,stores\n");
+  }
+  return window;
+}
+
+void
+APEX_window_free(APEX_Window* window)
+{
+  APEX_free(window);
+}
+
+/*
+ * Appends the row of the window up to the current clock, if it has any
+ * cycles, and starts the next one. Returns 0 on success.
+ */
+int
+APEX_window_write(APEX_Window* window, APEX_CPU* cpu)
+{
+  int cycles = cpu->clock - window->start_clock;
+  if (cycles <= 0) {
+    return 0;
+  }
+  int instructions = cpu->ins_completed - window->start_instructions;
+  FILE* fp = window->out;
+  fprintf(fp, "%s,%d,%d,%d,%.4f", window->input, window->start_clock, cpu->clock, instructions,
+          (double)instructions / cycles);
+  for (int i = 0; i < CPI_NUM_CAUSES; ++i) {
+    fprintf(fp, ",%ld", cpu->cpi_cycles[i] - window->start_cpi[i]);
+  }
+  fprintf(fp, ",%d,%ld,%ld\n", cpu->redirects - window->start_redirects,
+          window->loads - window->start_loads, window->stores - window->start_stores);
+  start_window(window, cpu);
+  return fflush(fp) ? -1 : 0;
+}
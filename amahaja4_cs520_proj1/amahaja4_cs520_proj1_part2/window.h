@@ -0,0 +1,64 @@
+#ifndef _APEX_WINDOW_H_
+#define _APEX_WINDOW_H_
+/**
+ *  window.h
+ *  Contains the windowed time series of a run
+ *
+ *  Every interval cycles one CSV row is appended with what the window
+ *  did: instructions, IPC, cycles by CPI stack cause (see cpi.h), flushes
+ *  and retired LOADs and STOREs. Rows are flushed as written, so the file
+ *  can be followed while the run goes on. A window a --memo or --loops
+ *  replay runs over ends with it, so rows give their actual cycles.
+ */
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+typedef struct APEX_Window
+{
+    FILE* out;			// Not owned
+    const char* input;		// Names the run in every row
+    int interval;
+    long next;			// Clock ending the current window
+    long loads;			// Retired so far
+    long stores;
+    /* Counters of the cpu when the current window started */
+    int start_clock;
+    int start_instructions;
+    long start_cpi[CPI_NUM_CAUSES];
+    int start_redirects;
+    long start_loads;
+    long start_stores;
+} APEX_Window;
+
+APEX_Window*
+APEX_window_create(APEX_CPU* cpu, FILE* out, const char* input, int interval);
+
+void
+APEX_window_free(APEX_Window* window);
+
+int
+APEX_window_write(APEX_Window* window, APEX_CPU* cpu);
+
+/* Counts the memory operations of a retiring instruction */
+static inline void
+APEX_window_retired(APEX_Window* window, const char* opcode)
+{
+  if (opcode[0] == 'L') {
+    window->loads++;
+  } else if (opcode[0] == 'S' && opcode[1] == 'T') {
+    window->stores++;
+  }
+}
+
+/* Writes the current window once it has run its interval */
+static inline void
+APEX_window_tick(APEX_Window* window, APEX_CPU* cpu)
+{
+  if (cpu->clock >= window->next) {
+    APEX_window_write(window, cpu);
+  }
+}
+
+#endif